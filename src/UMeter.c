@@ -38,9 +38,14 @@
 #include "UMeter.h"
 #include "lib/INI/umeter_ini.h"
 #include "lib/Inputs/umeter_adc.h"
+#include "lib/Inputs/umeter_mcp3208.h"
+#include "lib/Inputs/umeter_sched.h"
+#include "lib/Timer/umeter_clock.h"
 #include <util/delay.h>
 
+#ifndef DEBUG
 #define DEBUG 1
+#endif
 
 /** Structure to hold the latest Command Block Wrapper issued by the host, containing a SCSI command to execute. */
 CommandBlockWrapper_t  CommandBlock;
@@ -79,25 +84,55 @@ int main(void)
 #endif
 		mass_storage_main();
 	}
+	return 0;
 }
 
 void mass_storage_main(void)
 {
+#if UMETER_STATUS_LUN
+	// the status volume shows the config and free space as of now, read
+	// them while the card is still ours
+	StatusDisk_Init();
+#endif
 	for(;;) {
 		MassStorage_Task();
 		USB_USBTask();
+#if UMETER_PROFILE
+		// the host owns the file system, only report over serial
+		if(prof_due()) {
+			prof_dump();
+		}
+#endif
 	}
 }
 
 void data_logger_main(void)
 {
 	unsigned int delay;
-	const umeter_config const* umeter = UMeter_Init();
+	uint8_t mask;
+	const umeter_config* umeter = UMeter_Init();
+#if UMETER_TRIGGER
+	if(umeter && umeter->trigger.enabled) {
+		for(;;) {
+			UMeter_Trigger_Task();
+		}
+	}
+#endif
 	if(umeter) {
-		delay = umeter->sampling_interval;
+		sched_init(umeter);
 		for(;;) {
-			my_delay_ms(delay);
-			UMeter_Task();
+			mask = sched_next(&delay);
+			if(!mask) { // no sensor enabled, nothing to log
+				break;
+			}
+			sched_wait(delay);
+			UMeter_Task(mask);
+#if UMETER_PROFILE
+			if(prof_due()) {
+				prof_dump();
+				UMeter_Write_Stats();
+			}
+#endif
 		}
 	}
 	else {
@@ -125,8 +160,19 @@ void SetupHardware(void)
 	clock_prescale_set(clock_div_1);
 
 	/* Hardware Initialization */
+#if UMETER_PROFILE
+	prof_init();
+#endif
 	//LEDs_Init();
-	SerialStream_Init(9600, false);
+	log_init();
+
+	// card accesses time out on the millisecond clock
+	clock_init();
+	// the serial log, the clock and the profiling timer all run on
+	// interrupts, nothing before this point may wait for them
+	GlobalInterruptEnable();
+	// the external ADC shares the bus with the card, deselect it first
+	mcp3208_init();
 	SDCardManager_Init();
 	
 	USB_Init();
@@ -44,12 +44,13 @@
 		#include "Descriptors.h"
 
 		#include "lib/MassStorage/SCSI.h"
+		#include "lib/MassStorage/StatusDisk.h"
 		#include "lib/FatSD/SDCardManager.h"
 
 		#include <LUFA/Version.h>
 		#include <LUFA/Drivers/USB/USB.h>
 		#include <LUFA/Drivers/Board/LEDs.h>
-		#include <LUFA/Drivers/Peripheral/SerialStream.h>
+		#include "lib/Debug/umeter_log.h"
 
 	/* Macros: */
 		/** Mass Storage Class specific request to reset the Mass Storage interface, ready for the next command. */
@@ -61,13 +62,25 @@
 		/** Maximum length of a SCSI command which can be issued by the device or host in a Mass Storage bulk wrapper. */
 		#define MAX_SCSI_COMMAND_LENGTH    16
 		
-		/** Total number of Logical Units (drives) in the device. The total device capacity is shared equally between
-		 *  each drive - this can be set to any positive non-zero amount.
-		 */
-		#define TOTAL_LUNS                 1
-		
-		/** Blocks in each LUN, calculated from the total capacity divided by the total number of Logical Units in the device. */
-		#define LUN_MEDIA_BLOCKS           (SDCardManager_GetNbBlocks() / TOTAL_LUNS)    
+		#if !defined(UMETER_STATUS_LUN)
+			/** Set to 1 (STATUS_LUN = 1 in the makefile) to add the read-only status volume of StatusDisk.c as a second LUN. */
+			#define UMETER_STATUS_LUN      0
+		#endif
+
+		/** Logical Unit of the SD card, with its whole capacity. */
+		#define CARD_LUN                   0
+
+		/** Logical Unit of the read-only status volume, see StatusDisk.c. */
+		#define STATUS_LUN                 1
+
+		/** Total number of Logical Units (drives) in the device. */
+		#define TOTAL_LUNS                 (1 + UMETER_STATUS_LUN)
+
+		/** Indicates if the current command is issued to the status volume rather than the SD card. */
+		#define IS_STATUS_LUN()            (UMETER_STATUS_LUN && (CommandBlock.LUN == STATUS_LUN))
+
+		/** Blocks in the LUN the current command is issued to. */
+		#define LUN_MEDIA_BLOCKS           (IS_STATUS_LUN() ? STATUS_DISK_BLOCKS : SDCardManager_GetNbBlocks())
 		
 		/** Magic signature for a Command Block Wrapper used in the Mass Storage Bulk-Only transport protocol. */
 		#define CBW_SIGNATURE              0x43425355UL
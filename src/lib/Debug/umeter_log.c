@@ -0,0 +1,130 @@
+#include "umeter_log.h"
+
+#include <stdarg.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define LOG_BUFFER_MASK	(LOG_BUFFER_SIZE - 1)
+
+static const uint8_t event_level[LOG_EVENT_COUNT] PROGMEM = {
+#define LOG_EVENT(id, level, args, format) level,
+#include "umeter_log_events.h"
+#undef LOG_EVENT
+};
+
+static const uint8_t event_args[LOG_EVENT_COUNT] PROGMEM = {
+#define LOG_EVENT(id, level, args, format) args,
+#include "umeter_log_events.h"
+#undef LOG_EVENT
+};
+
+static uint8_t buffer[LOG_BUFFER_SIZE];
+static volatile uint8_t head;	// next free byte, only moved by the main loop
+static volatile uint8_t tail;	// next byte to send, only moved by the ISR
+static uint8_t verbosity = LOG_LEVEL_DEFAULT;
+static uint16_t dropped;		// events dropped since the last LOG_DROPPED
+static uint32_t lost;			// events dropped since boot
+
+static int log_putchar(char c, FILE* stream);
+static FILE log_stream = FDEV_SETUP_STREAM(log_putchar, NULL, _FDEV_SETUP_WRITE);
+
+ISR(USART1_UDRE_vect)
+{
+	if(tail == head) { // nothing left to send
+		UCSR1B &= ~(1 << UDRIE1);
+		return;
+	}
+	UDR1 = buffer[tail];
+	tail = (tail + 1) & LOG_BUFFER_MASK;
+}
+
+static uint8_t log_free(void)
+{
+	return (tail - head - 1) & LOG_BUFFER_MASK;
+}
+
+static void log_put(uint8_t b)
+{
+	buffer[head] = b;
+	head = (head + 1) & LOG_BUFFER_MASK;
+}
+
+void log_init(void)
+{
+	UBRR1 = (F_CPU + 4UL * LOG_BAUD) / (8UL * LOG_BAUD) - 1;
+	UCSR1A = (1 << U2X1);
+	UCSR1C = (1 << UCSZ11) | (1 << UCSZ10);	// 8N1
+	UCSR1B = (1 << TXEN1);
+
+	stdout = &log_stream;
+}
+
+void log_set_level(uint8_t level)
+{
+	verbosity = level;
+}
+
+// Number of events dropped for lack of buffer space since boot.
+uint32_t log_lost(void)
+{
+	return lost;
+}
+
+// Text output for stdout. Waits for room in the buffer instead of dropping
+// characters; with interrupts still disabled (early during boot) it sends a
+// byte itself to make room.
+static int log_putchar(char c, FILE* stream)
+{
+	while(!log_free()) {
+		if(!(SREG & (1 << SREG_I))) {
+			while(!(UCSR1A & (1 << UDRE1))) {
+				;
+			}
+			UDR1 = buffer[tail];
+			tail = (tail + 1) & LOG_BUFFER_MASK;
+		}
+	}
+	log_put(c);
+	UCSR1B |= (1 << UDRIE1);
+	return 0;
+}
+
+// Queue an event with its 16 bit arguments, see the LOG*() macros. Never
+// waits: if the event doesn't fit into the buffer it is dropped.
+void log_event(uint8_t id, ...)
+{
+	va_list ap;
+	uint8_t i, args;
+	uint16_t v;
+
+	if(id >= LOG_EVENT_COUNT || pgm_read_byte(&event_level[id]) > verbosity) {
+		return;
+	}
+	args = pgm_read_byte(&event_args[id]);
+
+	// report earlier drops first, if there is room for that and this event
+	if(dropped && log_free() >= 4 + 4 + 2 * args) {
+		log_put(LOG_SYNC);
+		log_put(LOG_DROPPED);
+		log_put(dropped);
+		log_put(dropped >> 8);
+		dropped = 0;
+	}
+	if(log_free() < 2 + 2 * args) {
+		dropped++;
+		lost++;
+		return;
+	}
+
+	log_put(LOG_SYNC);
+	log_put(id);
+	va_start(ap, id);
+	for(i = 0; i < args; i++) {
+		v = va_arg(ap, unsigned int);
+		log_put(v);
+		log_put(v >> 8);
+	}
+	va_end(ap);
+	UCSR1B |= (1 << UDRIE1);
+}
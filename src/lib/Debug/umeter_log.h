@@ -0,0 +1,60 @@
+#ifndef __UMETER_LOG_H__
+#define __UMETER_LOG_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Buffered serial debug channel.
+//
+// Output goes through a ring buffer which the USART1 data register empty
+// interrupt drains in the background, so writing to it costs only the time to
+// copy the bytes. stdout is connected to it for plain text, which waits for
+// room in the buffer. Hot paths use LOG*() events instead: only an event id and
+// its 16 bit arguments are sent, formatting is done on the host by
+// tools/log_decode, and an event that doesn't fit is dropped (and counted)
+// rather than stalling the caller.
+
+#ifndef DEBUG
+#define DEBUG 1
+#endif
+
+#define LOG_BAUD		57600
+#define LOG_BUFFER_SIZE	64		// must be a power of 2
+#define LOG_SYNC		0xA5	// first byte of an event, never part of text
+
+// verbosity levels, events above the configured level are not sent
+#define LOG_OFF			0
+#define LOG_ERROR		1
+#define LOG_INFO		2
+#define LOG_DEBUG		3
+
+#define LOG_LEVEL_DEFAULT	LOG_INFO
+
+enum
+{
+#define LOG_EVENT(id, level, args, format) id,
+#include "umeter_log_events.h"
+#undef LOG_EVENT
+	LOG_EVENT_COUNT
+};
+
+void log_init(void);
+void log_set_level(uint8_t level);
+void log_event(uint8_t id, ...);
+uint32_t log_lost(void);
+
+#if DEBUG
+#define LOG0(id)			log_event(id)
+#define LOG1(id, a)			log_event(id, (uint16_t)(a))
+#define LOG2(id, a, b)		log_event(id, (uint16_t)(a), (uint16_t)(b))
+#define LOG3(id, a, b, c)	log_event(id, (uint16_t)(a), (uint16_t)(b), (uint16_t)(c))
+#define LOG4(id, a, b, c, d)	log_event(id, (uint16_t)(a), (uint16_t)(b), (uint16_t)(c), (uint16_t)(d))
+#else
+#define LOG0(id)
+#define LOG1(id, a)
+#define LOG2(id, a, b)
+#define LOG3(id, a, b, c)
+#define LOG4(id, a, b, c, d)
+#endif
+
+#endif
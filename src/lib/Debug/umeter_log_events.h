@@ -0,0 +1,30 @@
+// Log events, shared by the firmware and tools/log_decode.
+//
+// LOG_EVENT(id, level, args, format)
+//   id		event name, becomes an enum constant on the device
+//   level	LOG_ERROR, LOG_INFO or LOG_DEBUG
+//   args	number of 16 bit arguments sent along with the event
+//   format	printf format used by the host to print the event; it never
+//			makes it into the firmware. Only %d, %u, %X and %c (with
+//			optional flags and width) are supported.
+//
+// Append new events at the end only, the ids are part of the wire format.
+
+LOG_EVENT(LOG_DROPPED,		LOG_ERROR,	1, "%u log events dropped")
+LOG_EVENT(LOG_ERR_OPEN,		LOG_ERROR,	0, "error opening file")
+LOG_EVENT(LOG_ERR_SEEK,		LOG_ERROR,	0, "error seeking to EOF")
+LOG_EVENT(LOG_ERR_READ,		LOG_ERROR,	0, "error reading from file")
+LOG_EVENT(LOG_ERR_WRITE,	LOG_ERROR,	0, "error writing to file")
+LOG_EVENT(LOG_RECORD,		LOG_INFO,	1, "record: mask=%X")
+LOG_EVENT(LOG_SAMPLE,		LOG_DEBUG,	2, "sensor %u: adc=%u")
+LOG_EVENT(LOG_VALUE,		LOG_DEBUG,	4, "sensor %u: %c%u.%03u")
+LOG_EVENT(LOG_BURST,		LOG_INFO,	2, "burst %u: sensor=%u")
+LOG_EVENT(LOG_RESUME,		LOG_INFO,	1, "log resumed, %u bytes recovered")
+LOG_EVENT(LOG_SD_FAILED,	LOG_ERROR,	0, "card failed")
+LOG_EVENT(LOG_SD_RECOVERED,	LOG_INFO,	1, "card recovered after %u failed attempts")
+LOG_EVENT(LOG_SD_REPLACED,	LOG_ERROR,	0, "card replaced, left alone until reset")
+LOG_EVENT(LOG_RECORDS_DROPPED,	LOG_ERROR,	1, "%u records dropped while the card was away")
+LOG_EVENT(LOG_CARDTEST,		LOG_INFO,	2, "card test: %u KiB/s written in runs, %u ms worst write")
+LOG_EVENT(LOG_CARD_SLOW,	LOG_ERROR,	2, "sampling every %u ms, the card keeps up with %u ms")
+LOG_EVENT(LOG_ERR_CARDTEST,	LOG_ERROR,	0, "card test failed")
+LOG_EVENT(LOG_ERR_MANIFEST,	LOG_ERROR,	0, "umeter.man unusable, no manifest")
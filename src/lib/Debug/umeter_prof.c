@@ -0,0 +1,133 @@
+#include "umeter_prof.h"
+
+#if UMETER_PROFILE
+
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+// Timer1 runs free at F_CPU, its overflows extend it to a 32 bit cycle count
+// (about 4.5 minutes at 16MHz, more than enough for a single scope).
+
+typedef struct
+{
+	uint32_t calls;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+} prof_counter;
+
+static prof_counter counters[PROF_COUNT];
+static volatile uint16_t overflows;
+static uint32_t last_dump;
+
+static const char name_sd_command[] PROGMEM = "sd_raw_send_command";
+static const char name_sd_busy[] PROGMEM = "sd_busy_wait";
+static const char name_fat_next_cluster[] PROGMEM = "fat_get_next_cluster";
+static const char name_fat_append_clusters[] PROGMEM = "fat_append_clusters";
+static const char name_fat_write_dir_entry[] PROGMEM = "fat_write_dir_entry";
+static const char name_adc_conversion[] PROGMEM = "adc_conversion";
+static const char name_umeter_task[] PROGMEM = "UMeter_Task";
+
+static PGM_P const names[PROF_COUNT] PROGMEM = {
+	name_sd_command,
+	name_sd_busy,
+	name_fat_next_cluster,
+	name_fat_append_clusters,
+	name_fat_write_dir_entry,
+	name_adc_conversion,
+	name_umeter_task
+};
+
+ISR(TIMER1_OVF_vect)
+{
+	overflows++;
+}
+
+void prof_init(void)
+{
+	uint8_t i;
+	for(i = 0; i < PROF_COUNT; i++) {
+		counters[i].min = UINT32_MAX;
+	}
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);	// no prescaling, count CPU cycles
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1);
+	TIMSK1 |= (1 << TOIE1);
+}
+
+uint32_t prof_cycles(void)
+{
+	uint16_t hi, lo;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hi = overflows;
+		lo = TCNT1;
+		// an overflow may have happened after interrupts were disabled
+		if((TIFR1 & (1 << TOV1)) && lo < 0x8000) {
+			hi++;
+		}
+	}
+	return ((uint32_t)hi << 16) | lo;
+}
+
+prof_scope prof_enter(uint8_t id)
+{
+	prof_scope scope = { id, prof_cycles() };
+	return scope;
+}
+
+void prof_leave(prof_scope* scope)
+{
+	uint32_t cycles = prof_cycles() - scope->start;
+	prof_counter* c = &counters[scope->id];
+	c->calls++;
+	c->total += cycles;
+	if(cycles < c->min) {
+		c->min = cycles;
+	}
+	if(cycles > c->max) {
+		c->max = cycles;
+	}
+}
+
+// Returns 1 once every PROF_DUMP_SECONDS.
+uint8_t prof_due(void)
+{
+	uint32_t now = prof_cycles();
+	if(now - last_dump < PROF_DUMP_SECONDS * F_CPU) {
+		return 0;
+	}
+	last_dump = now;
+	return 1;
+}
+
+// Format the counter 'id' as one line of text: name, calls, min, max and
+// average cycles and the total time in ms. Returns the length of the line.
+uint8_t prof_format(uint8_t id, char* buff, uint8_t len)
+{
+	prof_counter c = counters[id];
+	int n;
+	if(!c.calls) {
+		c.min = 0;
+	}
+	n = snprintf_P(buff, len, PSTR("%S calls=%lu min=%lu max=%lu avg=%lu total_ms=%lu\r\n"),
+			(PGM_P)pgm_read_word(&names[id]), c.calls, c.min, c.max,
+			c.calls ? (uint32_t)(c.total / c.calls) : 0, (uint32_t)(c.total / (F_CPU / 1000)));
+	return n < len ? n : len - 1;
+}
+
+// Print all counters to the serial port.
+void prof_dump(void)
+{
+	char buff[96];
+	uint8_t i;
+	for(i = 0; i < PROF_COUNT; i++) {
+		prof_format(i, buff, sizeof(buff));
+		fputs(buff, stdout);
+	}
+}
+
+#endif
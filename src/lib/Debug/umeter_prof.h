@@ -0,0 +1,58 @@
+#ifndef __UMETER_PROF_H__
+#define __UMETER_PROF_H__
+
+#include <stdint.h>
+
+// Hot path profiling, enabled by building with PROFILE = 1 in the makefile.
+//
+// Put PROF_SCOPE(id) at the top of a function (or block) to count its calls
+// and the CPU cycles spent in it until it returns. The counters are dumped
+// over serial and to stats.txt every PROF_DUMP_SECONDS.
+
+#ifndef UMETER_PROFILE
+#define UMETER_PROFILE 0
+#endif
+
+#define PROF_FILE			"stats.txt"
+#define PROF_DUMP_SECONDS	10
+
+enum
+{
+	PROF_SD_COMMAND = 0,		// sd_raw_send_command()
+	PROF_SD_BUSY,				// waiting for the card to finish programming
+	PROF_FAT_NEXT_CLUSTER,		// fat_get_next_cluster()
+	PROF_FAT_APPEND_CLUSTERS,	// fat_append_clusters()
+	PROF_FAT_WRITE_DIR_ENTRY,	// fat_write_dir_entry()
+	PROF_ADC_CONVERSION,		// adc_conversion()
+	PROF_UMETER_TASK,			// UMeter_Task()
+	PROF_COUNT
+};
+
+#if UMETER_PROFILE
+
+typedef struct
+{
+	uint8_t id;
+	uint32_t start;
+} prof_scope;
+
+#define PROF_CONCAT_(a, b)	a ## b
+#define PROF_CONCAT(a, b)	PROF_CONCAT_(a, b)
+#define PROF_SCOPE(id) \
+	prof_scope PROF_CONCAT(prof_scope_, __LINE__) __attribute__((cleanup(prof_leave))) = prof_enter(id)
+
+void prof_init(void);
+uint32_t prof_cycles(void);
+prof_scope prof_enter(uint8_t id);
+void prof_leave(prof_scope* scope);
+uint8_t prof_due(void);
+uint8_t prof_format(uint8_t id, char* buff, uint8_t len);
+void prof_dump(void);
+
+#else
+
+#define PROF_SCOPE(id)
+
+#endif
+
+#endif
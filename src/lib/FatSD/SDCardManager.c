@@ -40,6 +40,7 @@ this software.
 #include "SDCardManager.h"
 
 #include <string.h>
+#include <math.h>
 #include <avr/pgmspace.h>
 #include <avr/sleep.h>
 #include "fat.h"
@@ -47,11 +48,18 @@ this software.
 #include "partition.h"
 #include "sd_raw.h"
 #include "sd_raw_config.h"
+#include "umeter_fs_cache.h"
+#include "umeter_cardtest.h"
+#include "umeter_manifest.h"
 
 #include "lib/INI/umeter_ini.h"
 #include "lib/Inputs/umeter_adc.h"
+#include "lib/Inputs/umeter_sensor.h"
+#include "lib/Timer/umeter_clock.h"
 
+#ifndef DEBUG
 #define DEBUG 1
+#endif
 // teensy
 //#define LED_ON()	PORTD |= (1<<PD6)
 //#define LED_OFF()	PORTD &= ~(1<<PD6)
@@ -60,62 +68,132 @@ this software.
 #define LED_ON()	PORTB &= ~(1<<PB6)
 #define LED_OFF()	PORTB |= (1<<PB6)
 
+#define INIT_TIMEOUT		2000	// ms to wait for the card at power up
+#define RECOVER_DELAY_MIN	10		// ms between attempts to bring a failed card back,
+#define RECOVER_DELAY_MAX	10000	// doubling while it stays away
+#define BACKLOG_SIZE		256		// bytes of records kept while the card is away
+
 static struct sd_raw_info disk_info;
 static uint32_t CachedTotalBlocks = 0;
 static uint8_t Buffer[16];
+static uint32_t WriteBytesLeft;		// bytes of the current WRITE (10) not taken from the endpoint yet
+
+static uint8_t disk_info_valid;
 
+static struct partition_struct* partition;
 static struct fat_fs_struct* fs;	// filesystem object
 static struct fat_dir_struct* dd;	// current directory object
+static offset_t log_entry_offset;	// directory entry of umeter.txt, 0 if unknown
 
-void SDCardManager_Init(void)
-{
-	while(!sd_raw_init()) {
-		printf_P(PSTR("MMC/SD initialization failed\r\n"));
-	}
+static struct fat_file_struct* log_fd;	// umeter.txt, kept open while logging
+static struct fat_file_struct* delta_fd;	// umeter.dlt instead with format=delta
+static uint32_t log_committed;			// size of the open log file in its directory entry
+static offset_t log_run_end;			// end of the write run announced for it
+
+static uint8_t card_replaced;		// another card showed up after a failure, left alone until reset
+static uint16_t recover_delay;		// ms until the next attempt to bring the card back, 0 if it works
+static uint32_t recover_time;		// clock_ms() of that attempt
+static uint16_t recover_attempts;	// failed attempts since the card went away
 
-	/* open first partition */
-	struct partition_struct* partition = partition_open(sd_raw_read,
-										 sd_raw_read_interval,
+static char backlog[BACKLOG_SIZE];	// records not in umeter.txt yet
+static uint16_t backlog_length;
+static uint16_t records_dropped;	// records lost since the last one written
+
+static struct partition_struct* SDCardManager_Open_Partition(int8_t index)
+{
+	return partition_open(sd_raw_read,
+						  sd_raw_read_interval,
 #if SD_RAW_WRITE_SUPPORT
-										 sd_raw_write,
-										 sd_raw_write_interval,
+						  sd_raw_write,
+						  sd_raw_write_interval,
+						  sd_raw_erase,
+						  sd_raw_zero,
 #else
-										 0,
-										 0,
+						  0,
+						  0,
+						  0,
+						  0,
 #endif
-										 0
-													   );
+						  index
+						 );
+}
 
+// Mount the file system found on this card last time (see umeter_fs_cache.h)
+// without reading the MBR or the boot sector parameters. Returns 0 if the
+// card has been formatted since.
+static uint8_t SDCardManager_Mount_Cached(const fs_cache_entry* cache)
+{
+	uint32_t serial;
+
+	// a superfloppy partition is opened without reading the card
+	partition = SDCardManager_Open_Partition(-1);
 	if(!partition) {
-		/* If the partition did not open, assume the storage device
-		* is a "superfloppy", i.e. has no MBR.
-		*/
-		partition = partition_open(sd_raw_read,
-								   sd_raw_read_interval,
-#if SD_RAW_WRITE_SUPPORT
-								   sd_raw_write,
-								   sd_raw_write_interval,
-#else
-								   0,
-								   0,
-#endif
-								   -1
-								  );
+		return 0;
+	}
+	partition->type = cache->partition_type;
+	partition->offset = cache->partition_offset;
+	partition->length = cache->partition_length;
+
+	fs = fat_open_header(partition, &cache->header);
+	if(fs && fat_get_volume_serial(fs, &serial) && serial == cache->volume_serial) {
+		log_entry_offset = cache->log_entry_offset;
+		return 1;
+	}
+	fat_close(fs);
+	fs = 0;
+	partition_close(partition);
+	partition = 0;
+	fs_cache_invalidate();
+	return 0;
+}
+
+// Wait until the next attempt to bring the card back is due, backing off
+// while it stays away.
+static void SDCardManager_Backoff(void)
+{
+	if(!recover_delay) {
+		recover_delay = RECOVER_DELAY_MIN;
+	}
+	else if(recover_delay < RECOVER_DELAY_MAX / 2) {
+		recover_delay *= 2;
+	}
+	else {
+		recover_delay = RECOVER_DELAY_MAX;
+	}
+	recover_time = clock_ms() + recover_delay;
+}
+
+// Open the file system and its root directory on the card, from where the
+// cache says they are if it's the same card. Returns 0 if there is none.
+static uint8_t SDCardManager_Mount(void)
+{
+	fs_cache_entry cache;
+
+	if(!disk_info_valid || !fs_cache_load(&cache, &disk_info) || !SDCardManager_Mount_Cached(&cache)) {
+		/* open first partition */
+		partition = SDCardManager_Open_Partition(0);
+
 		if(!partition) {
+			/* If the partition did not open, assume the storage device
+			* is a "superfloppy", i.e. has no MBR.
+			*/
+			partition = SDCardManager_Open_Partition(-1);
+			if(!partition) {
 #if DEBUG
-			printf_P(PSTR("opening partition failed\r\n"));
+				printf_P(PSTR("opening partition failed\r\n"));
 #endif
-			return;
+				return 0;
+			}
 		}
-	}
 
-	/* open file system */
-	fs = fat_open(partition);
-	if(!fs) {
+		/* open file system */
+		fs = fat_open(partition);
+		if(!fs) {
 #if DEBUG
-		printf_P(PSTR("opening filesystem failed\r\n"));
+			printf_P(PSTR("opening filesystem failed\r\n"));
 #endif
-		return;
+			return 0;
+		}
 	}
 
 	/* open root directory */
@@ -127,132 +205,765 @@ void SDCardManager_Init(void)
 #if DEBUG
 		printf_P(PSTR("opening root directory failed\r\n"));
 #endif
+		return 0;
+	}
+	return 1;
+}
+
+void SDCardManager_Init(void)
+{
+	uint32_t start = clock_ms();
+
+	// without a card the device still comes up, the card is tried again by
+	// SDCardManager_Recover()
+	while(!sd_raw_init()) {
+		printf_P(PSTR("MMC/SD initialization failed\r\n"));
+		if(clock_ms() - start >= INIT_TIMEOUT) {
+			LOG0(LOG_SD_FAILED);
+			SDCardManager_Backoff();
+			return;
+		}
+	}
+	disk_info_valid = sd_raw_get_info(&disk_info);
+	SDCardManager_Mount();
+}
+
+/** Brings the card back after it failed (see sd_raw_failed()). The card is initialized again, at most every few
+*  milliseconds at first and backing off up to every 10 seconds while it stays away, so this is cheap to call before
+*  every access. Only the card which failed is taken back: the file system and the block held back by the SD write
+*  buffer stay valid for it. A different card is left alone until the next reset.
+*
+*  \return Boolean true if the card can be accessed, false otherwise
+*/
+bool SDCardManager_Recover(void)
+{
+	struct sd_raw_info info;
+
+	if(card_replaced) {
+		return false;
+	}
+	if(!sd_raw_failed()) {
+		return true;
+	}
+	if(!recover_delay) {
+		// the first attempt right away, the card may just have missed a beat
+		LOG0(LOG_SD_FAILED);
+	}
+	else if((int32_t)(clock_ms() - recover_time) < 0) {
+		return false;
+	}
+
+	if(!sd_raw_reinit() || !sd_raw_get_info(&info)) {
+		if(recover_attempts < UINT16_MAX) {
+			recover_attempts++;
+		}
+		SDCardManager_Backoff();
+		return false;
+	}
+	if(disk_info_valid && (info.manufacturer != disk_info.manufacturer || info.serial != disk_info.serial)) {
+		LOG0(LOG_SD_REPLACED);
+		card_replaced = 1;
+		return false;
+	}
+	if(!disk_info_valid) {
+		disk_info = info;
+		disk_info_valid = 1;
+	}
+
+	// the write run of umeter.txt was closed with the card
+	log_run_end = 0;
+	LOG1(LOG_SD_RECOVERED, recover_attempts);
+	recover_attempts = 0;
+	recover_delay = 0;
+	return true;
+}
+
+// Read the directory entry of umeter.txt from where it was found last time,
+// instead of searching the root directory for it. Returns 0 if that is not
+// known or the file is not there anymore.
+static uint8_t UMeter_Find_Log(struct fat_dir_entry_struct* file_entry)
+{
+	if(!log_entry_offset) {
+		return 0;
+	}
+	memset(file_entry, 0, sizeof(*file_entry));
+	strcpy(file_entry->long_name, LOG_FILE);
+	file_entry->entry_offset = log_entry_offset;
+	if(!fat_reload_dir_entry(fs, file_entry)) {
+		log_entry_offset = 0;
+		return 0;
+	}
+	return 1;
+}
+
+// Remember where the file system and umeter.txt are, so that the next boot
+// with this card can skip looking for them.
+static void UMeter_Store_Mount(void)
+{
+	fs_cache_entry cache;
+	uint32_t serial;
+
+	if(!disk_info_valid || !partition || !fat_get_volume_serial(fs, &serial)) {
 		return;
 	}
+	memset(&cache, 0, sizeof(cache));
+	cache.partition_type = partition->type;
+	cache.partition_offset = partition->offset;
+	cache.partition_length = partition->length;
+	cache.volume_serial = serial;
+	memcpy(&cache.header, fat_get_header(fs), sizeof(cache.header));
+	cache.log_entry_offset = log_entry_offset;
+	fs_cache_store(&cache, &disk_info);
+}
+
+// Shortest interval any sensor is sampled at.
+static unsigned int UMeter_Min_Interval(const umeter_config* umeter)
+{
+	unsigned int interval = umeter->sampling_interval;
+	uint8_t i;
+
+	for(i = 0; i < 4; i++) {
+		if(umeter->sensors[i].enabled && umeter->sensors[i].interval &&
+		   umeter->sensors[i].interval < interval) {
+			interval = umeter->sensors[i].interval;
+		}
+	}
+	return interval;
 }
 
-const umeter_config const* UMeter_Init(void)
+// Benchmark the card on the clusters of a scratch file and write the results
+// to cardtest.txt. The scratch file is started in a free allocation unit, so
+// it is contiguous unless the file system is nearly full; only the part
+// which is gets benchmarked.
+static void UMeter_Card_Test(const umeter_config* umeter)
 {
 	struct fat_dir_entry_struct file_entry;
+	struct fat_file_struct* fd;
+	cardtest_result result;
+	offset_t offset = 0;
+	uint32_t length = 0;
+	uint32_t size;
+	uint16_t cluster_size;
+	char line[48];
+	unsigned int interval;
+	uint8_t ok, n;
+
+	fat_create_file(dd, CARDTEST_FILE, &file_entry);
+	fd = open_file_in_dir(fs, dd, CARDTEST_FILE);
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		return;
+	}
+	// grown a cluster at a time, clusters allocated together are chained
+	// in descending order
+	cluster_size = fat_get_header(fs)->cluster_size;
+	for(size = cluster_size; size <= CARDTEST_SIZE; size += cluster_size) {
+		if(!fat_resize_file(fd, size)) {
+			break;
+		}
+	}
+	if(!fat_get_file_run(fd, &offset, &length)) {
+		length = 0;
+	}
+	fat_close_file(fd);
+
+	ok = cardtest_run(offset, length & ~511UL, &result);
+	// freeing the clusters erases them again
+	if(find_file_in_dir(fs, dd, CARDTEST_FILE, &file_entry)) {
+		fat_delete_file(fs, &file_entry);
+	}
+
+	fat_create_file(dd, CARDTEST_REPORT, &file_entry);
+	fd = open_file_in_dir(fs, dd, CARDTEST_REPORT);
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		return;
+	}
+	fat_resize_file(fd, 0);
+	if(!ok) {
+		n = snprintf_P(line, sizeof(line), PSTR("card test failed, %lu KiB contiguous\r\n"), (unsigned long)(length / 1024));
+		fat_write_file(fd, (uint8_t*)line, n);
+		fat_close_file(fd);
+		LOG0(LOG_ERR_CARDTEST);
+		return;
+	}
+	n = snprintf_P(line, sizeof(line), PSTR("read=%u KiB/s\r\nwrite=%u KiB/s\r\n"),
+	               result.read_rate, result.write_rate);
+	fat_write_file(fd, (uint8_t*)line, n);
+	n = snprintf_P(line, sizeof(line), PSTR("write_run=%u KiB/s\r\nrandom_write=%u IOPS\r\n"),
+	               result.run_rate, result.iops);
+	fat_write_file(fd, (uint8_t*)line, n);
+	n = snprintf_P(line, sizeof(line), PSTR("latency_max=%u ms\r\nlatency_mean=%u us\r\n"),
+	               result.latency_max, result.latency_mean);
+	fat_write_file(fd, (uint8_t*)line, n);
+	n = snprintf_P(line, sizeof(line), PSTR("min_sampling_interval=%u ms\r\n"), result.min_interval);
+	if(fat_write_file(fd, (uint8_t*)line, n) != n) {
+		LOG0(LOG_ERR_WRITE);
+	}
+	fat_close_file(fd);
+
+	LOG2(LOG_CARDTEST, result.run_rate, result.latency_max);
+	interval = UMeter_Min_Interval(umeter);
+	if(interval < result.min_interval) {
+		LOG2(LOG_CARD_SLOW, interval, result.min_interval);
+	}
+}
+
+// Open umeter.man, creating it if it doesn't exist, see umeter_manifest.c.
+// Like the scratch file of the card test it is grown a cluster at a time
+// within a free allocation unit; if it isn't contiguous, only the part which
+// is gets used.
+static void UMeter_Open_Manifest(void)
+{
+	struct fat_dir_entry_struct file_entry;
+	struct fat_file_struct* fd;
+	offset_t offset = 0;
+	uint32_t length = 0;
+	uint32_t size;
+	uint16_t cluster_size;
+	uint8_t created = 0;
+
+	if(!find_file_in_dir(fs, dd, MANIFEST_FILE, &file_entry)) {
+		if(!fat_create_file(dd, MANIFEST_FILE, &file_entry)) {
+			LOG0(LOG_ERR_OPEN);
+			return;
+		}
+		created = 1;
+	}
+	fd = fat_open_file(fs, &file_entry);
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		return;
+	}
+	cluster_size = fat_get_header(fs)->cluster_size;
+	if(created) {
+		for(size = cluster_size; size < MANIFEST_SIZE + cluster_size; size += cluster_size) {
+			if(!fat_resize_file(fd, size)) {
+				break;
+			}
+		}
+	}
+	if(!fat_get_file_run(fd, &offset, &length)) {
+		length = 0;
+	}
+	fat_close_file(fd);
+
+	if(created && !manifest_clear(offset, length)) {
+		length = 0;
+	}
+	if(!manifest_open(offset, length, cluster_size)) {
+		LOG0(LOG_ERR_MANIFEST);
+	}
+}
+
+const umeter_config* UMeter_Init(void)
+{
+	struct fat_dir_entry_struct file_entry;
+	const umeter_config* umeter;
+	offset_t cached_offset;
+
+	// the configuration is on the card: without one at power up, wait for it
+	// to be put in, tried with the backoff of SDCardManager_Recover()
+	while(!dd) {
+		if(SDCardManager_Recover() && !SDCardManager_Mount()) {
+			return 0;
+		}
+		my_delay_ms(RECOVER_DELAY_MIN);
+	}
+	cached_offset = log_entry_offset;
 
 	// create data log file if it doesn't exist
-	if(!fat_create_file(dd, "umeter.txt", &file_entry)) {
+	if(!UMeter_Find_Log(&file_entry) && !fat_create_file(dd, LOG_FILE, &file_entry)) {
 #if DEBUG
-		printf_P(PSTR("error creating file 'umeter.txt'\r\n"));
+		printf_P(PSTR("error creating file '" LOG_FILE "'\r\n"));
 #endif
 	}
+	else if(file_entry.entry_offset != cached_offset) {
+		log_entry_offset = file_entry.entry_offset;
+		UMeter_Store_Mount();
+	}
 
 	// create config file if it doesn't exist
-	if(!fat_create_file(dd, "umeter.ini", &file_entry)) {
+	if(!fat_create_file(dd, INI_FILE, &file_entry)) {
 #if DEBUG
-		printf_P(PSTR("error creating file 'umeter.ini'\r\n"));
+		printf_P(PSTR("error creating file '" INI_FILE "'\r\n"));
 #endif
 	}
-	return get_umeter_ini(fs, dd);
-}
 
+	umeter = get_umeter_ini(fs, dd);
+	if(umeter) {
+		log_set_level(umeter->verbosity);
+	}
 
-void UMeter_Task(void)
-{
-	int32_t file_pos;		// file position
-	unsigned int n, j, adc;	// n= number of bytes r/w, adc=conv val
-	float volts, out;
-	unsigned char buff[8];
-	unsigned char* units;
-	const umeter_config const* umeter;
+	// start new clusters of the log files in free allocation units of the
+	// card, so they are written sequentially within each unit
+	if(disk_info_valid) {
+		fat_set_alloc_unit(fs, (disk_info.au_size ? disk_info.au_size : disk_info.erase_sector) * 512UL);
+	}
+
+	if(umeter && umeter->cardtest) {
+		UMeter_Card_Test(umeter);
+	}
+
+	if(umeter && umeter->format == FORMAT_TEXT && umeter->manifest) {
+		UMeter_Open_Manifest();
+	}
+
+#if UMETER_DELTA
+	// create compressed log file if it's going to be used
+	if(umeter && umeter->format == FORMAT_DELTA && !fat_create_file(dd, DELTA_FILE, &file_entry)) {
 #if DEBUG
-	printf_P(PSTR("writing...\r\n"));
+		printf_P(PSTR("error creating file '" DELTA_FILE "'\r\n"));
 #endif
-	// search file in current directory and open it
-	struct fat_file_struct* fd = open_file_in_dir(fs, dd, "umeter.txt");
-	if(!fd) {
+	}
+#endif
+
+#if UMETER_TRIGGER
+	// create burst capture file if it's going to be used
+	if(umeter && umeter->trigger.enabled && !fat_create_file(dd, TRIGGER_FILE, &file_entry)) {
 #if DEBUG
-		printf_P(PSTR("error opening file\r\n"));
+		printf_P(PSTR("error creating file '" TRIGGER_FILE "'\r\n"));
 #endif
+	}
+#endif
+	return umeter;
+}
+
+// Count a record lost while the card is away, see UMeter_Report_Dropped().
+static void UMeter_Drop_Record(void)
+{
+	if(records_dropped < UINT16_MAX) {
+		records_dropped++;
+	}
+}
+
+// Log how many records were lost, once the card takes them again.
+static void UMeter_Report_Dropped(void)
+{
+	if(records_dropped) {
+		LOG1(LOG_RECORDS_DROPPED, records_dropped);
+		records_dropped = 0;
+	}
+}
+
+#if UMETER_TRIGGER
+// Wait for the next trigger and append the captured burst to trigger.bin.
+void UMeter_Trigger_Task(void)
+{
+	uint16_t ring[TRIGGER_RING_SIZE];
+	trigger_header hdr;
+	uint8_t start;
+	const umeter_config* umeter = get_umeter_ini(fs, dd);
+
+	start = trigger_capture(&umeter->trigger, ring, &hdr);
+	if(!SDCardManager_Recover()) {
+		UMeter_Drop_Record();
 		return;
 	}
+	LED_ON();
+	struct fat_file_struct* fd = open_file_in_dir(fs, dd, TRIGGER_FILE);
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		LED_OFF();
+		return;
+	}
+	if(!trigger_write_burst(fd, ring, start, &hdr)) {
+		LOG0(LOG_ERR_WRITE);
+	}
+	else {
+		LOG2(LOG_BURST, hdr.seq, hdr.sensor);
+		UMeter_Report_Dropped();
+	}
+	fat_close_file(fd);
 
-	// seek to EOF to append
-	file_pos = -1;
-	if(!fat_seek_file(fd, &file_pos, FAT_SEEK_END))
-	{
-#if DEBUG
-	   printf_P(PSTR("Error seeking to EOF. Likely trying to seek on an empty file.\r\n"));
+	// bursts are rare, don't leave the last one in the write buffer
+	sd_raw_sync();
+	LED_OFF();
+}
 #endif
+
+
+// Commit the size of umeter.txt to its directory entry, list the records
+// appended since in the manifest and checkpoint where it ends, see
+// UMeter_Resume_Log().
+static uint8_t UMeter_Sync_Log(struct fat_file_struct* fd, uint32_t size)
+{
+	log_checkpoint checkpoint;
+
+	if(!fat_sync_file(fd) || !manifest_commit() || !sd_raw_flush()) {
+		return 0;
 	}
-	
+	log_committed = size;
+
+	// not known when the file ends exactly on a cluster boundary; umeter.dlt
+	// isn't resumed
+	checkpoint.cluster = fat_get_file_cluster(fd);
+	checkpoint.size = size;
+	if(checkpoint.cluster && fd == log_fd) {
+		fs_cache_store_checkpoint(&checkpoint);
+	}
+	return 1;
+}
+
+// Characters of the records in umeter.txt, see UMeter_Task().
+static uint8_t UMeter_Is_Record_Char(uint8_t c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || c == '.' || c == '-' || c == ' ';
+}
+
+// Continue umeter.txt where the last checkpoint says it ends, once its
+// cluster is found on the file's cluster chain. Records appended after the checkpoint, up to
+// a power failure, are taken back into the file as far as they are found in
+// the rest of that cluster: complete lines up to the first byte which can't
+// be part of a record. Blocks the logger never got to write still hold what
+// was on the card before, which can't be told apart from records if it was
+// an older log. Returns 0 if the checkpoint doesn't match the file.
+static uint8_t UMeter_Resume_Log(struct fat_file_struct* fd)
+{
+	log_checkpoint checkpoint;
+	int32_t file_pos = 0;
+	offset_t offset;
+	uint16_t length, i, n;
+	uint32_t end;
+	uint8_t buff[16], j;
+
+	if(!fat_seek_file(fd, &file_pos, FAT_SEEK_END) ||
+	   !fs_cache_load_checkpoint(&checkpoint) || checkpoint.size != (uint32_t)file_pos ||
+	   !fat_seek_file_cluster(fd, checkpoint.size, checkpoint.cluster)) {
+		return 0;
+	}
+	log_committed = checkpoint.size;
+
+	end = checkpoint.size;
+	if(fat_get_file_extent(fd, &offset, &length)) {
+		for(i = 0; i < length; i += n) {
+			n = length - i;
+			if(n > sizeof(buff)) {
+				n = sizeof(buff);
+			}
+			if(!sd_raw_read(offset + i, buff, n)) {
+				break;
+			}
+			for(j = 0; j < n; j++) {
+				if(buff[j] == '\n') {
+					end = checkpoint.size + i + j + 1;
+				}
+				else if(!UMeter_Is_Record_Char(buff[j])) {
+					break;
+				}
+			}
+			if(j < n) {
+				break;
+			}
+		}
+	}
+	if(end != checkpoint.size) {
+		if(!fat_seek_file_cluster(fd, end, checkpoint.cluster) || !UMeter_Sync_Log(fd, end)) {
+			LOG0(LOG_ERR_WRITE);
+		}
+	}
+	LOG1(LOG_RESUME, end - checkpoint.size);
+	return 1;
+}
+
+// Open umeter.txt for appending. It stays open while logging, so records
+// only go to its data blocks and are written to the card a whole block at
+// a time; its size is committed by UMeter_Commit_Log().
+static struct fat_file_struct* UMeter_Open_Log(void)
+{
+	struct fat_dir_entry_struct file_entry;
+	int32_t file_pos;
+	uint8_t c;
+
+	if(log_fd) {
+		return log_fd;
+	}
+	// created again if it went missing, e.g. when UMeter_Init() couldn't
+	if(!UMeter_Find_Log(&file_entry) && !fat_create_file(dd, LOG_FILE, &file_entry)) {
+		return 0;
+	}
+	log_fd = fat_open_file(fs, &file_entry);
+	if(!log_fd) {
+		return 0;
+	}
+	if(UMeter_Resume_Log(log_fd)) {
+		return log_fd;
+	}
+
+	// seek to EOF to append
+	file_pos = 0;
+	if(!fat_seek_file(log_fd, &file_pos, FAT_SEEK_END)) {
+		LOG0(LOG_ERR_SEEK);
+	}
+	log_committed = file_pos;
+
 	// check for newline char, add one if none
 	if(file_pos > 0) {
-		if(fat_read_file(fd, buff, 1) != 1) {
-#if DEBUG
-			printf_P(PSTR("error reading 1 byte\r\n"));
-#endif
+		file_pos = -1;
+		if(!fat_seek_file(log_fd, &file_pos, FAT_SEEK_END) || fat_read_file(log_fd, &c, 1) != 1) {
+			LOG0(LOG_ERR_READ);
 		}
-		if(buff[0] != '\n') {
-			if(fat_write_file(fd, "\n", 1) != 1) {
-#if DEBUG
-				printf_P(PSTR("error writing newline\r\n"));
-#endif
+		else if(c != '\n' && fat_write_file(log_fd, (const uint8_t*)"\n", 1) != 1) {
+			LOG0(LOG_ERR_WRITE);
+		}
+	}
+	return log_fd;
+}
+
+// Called after every record appended to umeter.txt or umeter.dlt. Every
+// 'sync_blocks' blocks the size of the file is committed to its directory entry, data
+// beyond that is only partly recovered after a power failure (see
+// UMeter_Resume_Log()). The rest of the cluster being
+// filled is announced to the card as one write run (see sd_raw_write_run()),
+// so the blocks go out as a multiple block write without being read first.
+static void UMeter_Commit_Log(struct fat_file_struct* fd, const umeter_config* umeter)
+{
+	int32_t file_pos = 0;
+	offset_t offset, end;
+	uint16_t length;
+
+	if(!fat_seek_file(fd, &file_pos, FAT_SEEK_CUR)) {
+		return;
+	}
+	if((uint32_t)file_pos - log_committed >= (uint32_t)umeter->sync_blocks * 512 &&
+	   !UMeter_Sync_Log(fd, file_pos)) {
+		LOG0(LOG_ERR_WRITE);
+	}
+
+	if(fat_get_file_extent(fd, &offset, &length)) {
+		end = offset + length;
+		if(end != log_run_end) {
+			// the block at the file position may hold data already
+			offset = (offset + 511) & ~(offset_t)511;
+			if(offset < end) {
+				sd_raw_write_run(offset, (end - offset) / 512);
 			}
+			log_run_end = end;
 		}
 	}
+}
 
-	// read sensor values
-#if DEBUG
-	printf("sensors: ");
+// Commit and close umeter.txt or umeter.dlt, it is opened again by the
+// next record. The write buffer is flushed either way.
+void UMeter_Close_Log(void)
+{
+	if(log_fd && !manifest_commit()) {
+		LOG0(LOG_ERR_WRITE);
+	}
+	if(log_fd || delta_fd) {
+		fat_close_file(log_fd ? log_fd : delta_fd);
+		log_fd = delta_fd = 0;
+		log_run_end = 0;
+		sd_raw_write_run(0, 0);
+	}
+	sd_raw_flush();
+}
+
+#if UMETER_DELTA
+// Open umeter.dlt for appending, like UMeter_Open_Log() but without taking
+// back records beyond its committed size: a record cut short would garble
+// the rest of the file for the decoder.
+static struct fat_file_struct* UMeter_Open_Delta(void)
+{
+	int32_t file_pos = 0;
+
+	if(delta_fd) {
+		return delta_fd;
+	}
+	delta_fd = open_file_in_dir(fs, dd, DELTA_FILE);
+	if(!delta_fd) {
+		return 0;
+	}
+	if(!fat_seek_file(delta_fd, &file_pos, FAT_SEEK_END)) {
+		LOG0(LOG_ERR_SEEK);
+	}
+	log_committed = file_pos;
+	return delta_fd;
+}
+
+// Append the window means of the sensors in 'ready' to umeter.dlt, which
+// stays open and is committed like umeter.txt.
+static void UMeter_Write_Delta(uint8_t ready, const umeter_config* umeter)
+{
+	uint16_t codes[4];
+	uint8_t j;
+
+	for(j = 0; j < 4; j++) {
+		if(ready & SCHED_CHANNEL(j)) {
+			codes[j] = stats_get_code(j);
+		}
+	}
+
+	struct fat_file_struct* fd = UMeter_Open_Delta();
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		return;
+	}
+	if(!delta_write_record(fd, ready, codes)) {
+		LOG0(LOG_ERR_WRITE);
+		return;
+	}
+	UMeter_Report_Dropped();
+	UMeter_Commit_Log(fd, umeter);
+}
 #endif
+
+// Append 'n' bytes to the record being put together at backlog[*length].
+// Returns 0 if the backlog is full.
+static uint8_t UMeter_Backlog_Put(uint16_t* length, const void* data, uint8_t n)
+{
+	if(*length + n > sizeof(backlog)) {
+		return 0;
+	}
+	memcpy(&backlog[*length], data, n);
+	*length += n;
+	return 1;
+}
+
+// Move the records in the backlog to umeter.txt. Whatever the card doesn't
+// take stays in the backlog for the next record to try again.
+static void UMeter_Flush_Log(const umeter_config* umeter)
+{
+	intptr_t n;
+
+	if(!SDCardManager_Recover()) {
+		return;
+	}
+	struct fat_file_struct* fd = UMeter_Open_Log();
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		return;
+	}
+	n = manifest_write_file(fd, (const uint8_t*)backlog, backlog_length);
+	if(n > 0) {
+		backlog_length -= n;
+		memmove(backlog, &backlog[n], backlog_length);
+	}
+	if(backlog_length) {
+		LOG0(LOG_ERR_WRITE);
+		return;
+	}
+	UMeter_Report_Dropped();
+	UMeter_Commit_Log(fd, umeter);
+}
+
+// Sample the sensors selected by 'mask' (see umeter_sched.h) and append a
+// record holding every sensor whose aggregation window is complete. Each
+// record starts with the mask of the sensors it holds in hex, so that lines
+// written at different rates can be told apart, followed by the selected
+// statistics of each of those sensors. Records are put together in the
+// backlog, which keeps them while the card is away.
+void UMeter_Task(uint8_t mask)
+{
+	unsigned int n, j, adc;	// n= number of bytes r/w, adc=conv val
+	uint8_t i, count, ready, full;
+	uint16_t length;
+	float out[4];
+	unsigned char buff[8];
+	const umeter_config* umeter;
+	PROF_SCOPE(PROF_UMETER_TASK);
+
+	// read sensor values, calibration is left to the end of the window
 	umeter = get_umeter_ini(fs, dd);
+	ready = 0;
 	for(j = 0; j < 4; j++) {
-		if(!umeter->sensors[j].enabled) { // skip a sensor if it's disabled
+		if(!(mask & SCHED_CHANNEL(j)) || !umeter->sensors[j].enabled) { // skip a sensor if it's not due or disabled
 			continue;
 		}
 		LED_ON();
-		select_sensor(j+1);
-		adc = adc_conversion();
-		// v_in = ADC_value * Vref / (2^10)-1 * volt div. scaler
-		volts = adc * 2.56 / 1023 * 2;
-		if(umeter->sensors[j].raw_output) {
-			out = volts;
-			units = "V";
+		adc = sensor_conversion(j, &umeter->sensors[j]);
+		LOG2(LOG_SAMPLE, j+1, adc);
+		if(stats_add(j, adc, &umeter->sensors[j])) {
+			ready |= SCHED_CHANNEL(j);
+		}
+		LED_OFF();
+	}
+	if(!ready) { // no window complete, nothing to write
+		return;
+	}
+#if UMETER_DELTA
+	if(umeter->format == FORMAT_DELTA) {
+		// binary records aren't kept back, they are lost while the card is away
+		if(SDCardManager_Recover()) {
+			UMeter_Write_Delta(ready, umeter);
 		}
 		else {
-			out = (volts - umeter->sensors[j].offset) / umeter->sensors[j].slope;
-			units = umeter->sensors[j].units;
+			UMeter_Drop_Record();
 		}
-		n = float2str(out, buff);
-#if DEBUG
-		printf("[%d: %s%s] ", j+1, buff, units);
-#endif
-		// write buff to file
-		if(fat_write_file(fd, buff, n) != n) {
-#if DEBUG
-			printf_P(PSTR("error writing to file\r\n"));
+		return;
+	}
 #endif
-			break;
+
+	LOG1(LOG_RECORD, ready);
+
+	// tag the record with the channel mask
+	length = backlog_length;
+	n = sprintf((char*)buff, "%X ", ready);
+	full = !UMeter_Backlog_Put(&length, buff, n);
+
+	for(j = 0; j < 4; j++) {
+		if(!(ready & SCHED_CHANNEL(j))) {
+			continue;
+		}
+		count = stats_get(j, &umeter->sensors[j], out);
+		for(i = 0; i < count; i++) {
+			n = float2str(out[i], (char*)buff);
+			// the sign on its own, -0.5 has no negative integer part
+			LOG4(LOG_VALUE, j+1, out[i] < 0 ? '-' : '+', (unsigned int)fabs(out[i]),
+				(unsigned int)((fabs(out[i]) - (unsigned int)fabs(out[i])) * 1000));
+			if(!full && !UMeter_Backlog_Put(&length, buff, n)) {
+				full = 1;
+			}
 		}
-		LED_OFF();
 	}
-#if DEBUG
-	printf("\r\n");
-#endif
-	// write newline
-	if(fat_write_file(fd, "\n", 1) != 1) {
-#if DEBUG
-		printf_P(PSTR("error writing to file\r\n"));
-#endif
+	// end the record with a newline, it only counts once it's complete
+	if(full || !UMeter_Backlog_Put(&length, "\n", 1)) {
+		UMeter_Drop_Record();
+	}
+	else {
+		backlog_length = length;
+	}
+	UMeter_Flush_Log(umeter);
+}
+
+#if UMETER_PROFILE
+// Replace stats.txt with the current profiling counters.
+void UMeter_Write_Stats(void)
+{
+	struct fat_dir_entry_struct file_entry;
+	char buff[96];
+	uint8_t i, n;
+
+	if(!SDCardManager_Recover()) {
+		return;
+	}
+	// the only file handle may be held by umeter.txt
+	UMeter_Close_Log();
+	fat_create_file(dd, PROF_FILE, &file_entry);
+	struct fat_file_struct* fd = open_file_in_dir(fs, dd, PROF_FILE);
+	if(!fd) {
+		LOG0(LOG_ERR_OPEN);
+		return;
+	}
+	fat_resize_file(fd, 0);
+	for(i = 0; i < PROF_COUNT; i++) {
+		n = prof_format(i, buff, sizeof(buff));
+		if(fat_write_file(fd, (uint8_t*)buff, n) != n) {
+			LOG0(LOG_ERR_WRITE);
+			break;
+		}
 	}
 	fat_close_file(fd);
 }
+#endif
 
 uint32_t SDCardManager_GetNbBlocks(void)
 {
-	uint32_t TotalBlocks = 0;
-
 	if(CachedTotalBlocks != 0) {
 		return CachedTotalBlocks;
 	}
 
-	if(!sd_raw_get_info(&disk_info)) {
+	if(!SDCardManager_Recover() || !sd_raw_get_info(&disk_info)) {
 #if DEBUG
 		printf_P(PSTR("Error reading SD card info\r\n"));
 #endif
@@ -260,17 +971,49 @@ uint32_t SDCardManager_GetNbBlocks(void)
 	}
 
 	CachedTotalBlocks = disk_info.capacity / 512;
-	//printf_P(PSTR("SD blocks: %li\r\n"), TotalBlocks);
+	//printf_P(PSTR("SD blocks: %li\r\n"), CachedTotalBlocks);
 
 	return CachedTotalBlocks;
 }
 
+/** Returns the configuration in umeter.ini, without creating any of the log files like UMeter_Init() does.
+*
+*  \return Pointer to the parsed configuration, NULL if the card holds no valid umeter.ini
+*/
+const umeter_config* SDCardManager_GetConfig(void)
+{
+	if(!dd) {
+		return 0;
+	}
+	return get_umeter_ini(fs, dd);
+}
+
+/** Free space of the mounted file system, see fat_get_fs_free_hint(): a FAT16 is counted, which reads at most
+*  128 KiB, a FAT32 reports the count its FSInfo sector holds instead of reading a FAT of up to megabytes.
+*
+*  \param[out] FreeKiB  Free space in KiB
+*
+*  \return Boolean true if the free space is known, false otherwise
+*/
+bool SDCardManager_GetFreeKiB(uint32_t* const FreeKiB)
+{
+	offset_t Bytes;
+
+	if(!fs || !fat_get_fs_free_hint(fs, &Bytes)) {
+		return false;
+	}
+	*FreeKiB = Bytes / 1024;
+	return true;
+}
+
 /** Writes blocks (OS blocks, not Dataflash pages) to the storage medium, the board dataflash IC(s), from
 *  the pre-selected data OUT endpoint. This routine reads in OS sized blocks from the endpoint and writes
 *  them to the dataflash in Dataflash page sized blocks.
 *
 *  \param[in] BlockAddress  Data block starting address for the write sequence
 *  \param[in] TotalBlocks   Number of blocks of data to write
+*
+*  \return Boolean true if the blocks were handed to the card, false if the card failed
 */
 uintptr_t SDCardManager_WriteBlockHandler(uint8_t* buffer, offset_t offset, void* p)
 {
@@ -286,6 +1029,7 @@ uintptr_t SDCardManager_WriteBlockHandler(uint8_t* buffer, offset_t offset, void
 	}
 
 	/* Write one 16-byte chunk of data to the dataflash */
+	WriteBytesLeft -= 16;
 	buffer[0] = Endpoint_Read_Byte();
 	buffer[1] = Endpoint_Read_Byte();
 	buffer[2] = Endpoint_Read_Byte();
@@ -306,25 +1050,61 @@ uintptr_t SDCardManager_WriteBlockHandler(uint8_t* buffer, offset_t offset, void
 	return 16;
 }
 
-void SDCardManager_WriteBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
+/** Discards the data of the current WRITE (10) which the card didn't take, so the host gets to the command status
+*  instead of sending into a stalled endpoint.
+*/
+static void SDCardManager_DiscardWrite(void)
+{
+	uint16_t Length;
+
+	while(WriteBytesLeft) {
+		Length = (WriteBytesLeft > 0x8000) ? 0x8000 : WriteBytesLeft;
+		if(Endpoint_Discard_Stream(Length, StreamCallback_AbortOnMassStoreReset)) {
+			return;
+		}
+		WriteBytesLeft -= Length;
+	}
+	if(!(Endpoint_IsReadWriteAllowed())) {
+		Endpoint_ClearOUT();
+	}
+}
+
+bool SDCardManager_WriteBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
 {
-	bool     UsingSecondBuffer   = false;
 #if DEBUG
 	//printf_P(PSTR("W %li %i\r\n"), BlockAddress, TotalBlocks);
 #endif
+	WriteBytesLeft = (uint32_t) TotalBlocks * VIRTUAL_MEMORY_BLOCK_SIZE;
+	if(!SDCardManager_Recover()) {
+		SDCardManager_DiscardWrite();
+		return false;
+	}
 	LED_ON();
 	
 	/* Wait until endpoint is ready before continuing */
 	if(Endpoint_WaitUntilReady()) {
-		return;
+		return true;
 	}
 
+	/* The host may move or delete the log file or format the card, mount it from scratch on the next boot */
+	fs_cache_invalidate();
+
+	/* The host overwrites the blocks completely, so they need not be read before being merged with the data
+	 * and go to the card as one multiple block write
+	 */
+	sd_raw_write_run((offset_t) BlockAddress * VIRTUAL_MEMORY_BLOCK_SIZE, TotalBlocks);
+
 	while(TotalBlocks) {
-		sd_raw_write_interval(BlockAddress *  VIRTUAL_MEMORY_BLOCK_SIZE, Buffer, VIRTUAL_MEMORY_BLOCK_SIZE, &SDCardManager_WriteBlockHandler, NULL);
+		if(!sd_raw_write_interval((offset_t) BlockAddress * VIRTUAL_MEMORY_BLOCK_SIZE, Buffer, VIRTUAL_MEMORY_BLOCK_SIZE, &SDCardManager_WriteBlockHandler, NULL)) {
+			SDCardManager_DiscardWrite();
+			LED_OFF();
+			return false;
+		}
 
 		/* Check if the current command is being aborted by the host */
 		if(IsMassStoreReset) {
-			return;
+			sd_raw_write_run(0, 0);
+			return true;
 		}
 
 		/* Decrement the blocks remaining counter and reset the sub block counter */
@@ -337,6 +1117,7 @@ void SDCardManager_WriteBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
 		Endpoint_ClearOUT();
 	}
 	LED_OFF();
+	return true;
 }
 
 /** Reads blocks (OS blocks, not Dataflash pages) from the storage medium, the board dataflash IC(s), into
@@ -345,12 +1126,12 @@ void SDCardManager_WriteBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
 *
 *  \param[in] BlockAddress  Data block starting address for the read sequence
 *  \param[in] TotalBlocks   Number of blocks of data to read
+*
+*  \return Boolean true if the blocks were read, false if the card failed
 */
 
 uint8_t SDCardManager_ReadBlockHandler(uint8_t* buffer, offset_t offset, void* p)
 {
-	uint8_t i;
-
 	/* Check if the endpoint is currently full */
 	if(!(Endpoint_IsReadWriteAllowed())) {
 		/* Clear the endpoint bank to send its contents to the host */
@@ -387,23 +1168,27 @@ uint8_t SDCardManager_ReadBlockHandler(uint8_t* buffer, offset_t offset, void* p
 	return 1;
 }
 
-void SDCardManager_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
+bool SDCardManager_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
 {
-	uint16_t CurrPage          = BlockAddress;
-	uint16_t CurrPageByte      = 0;
 #if DEBUG
 	//printf_P(PSTR("R %li %i\r\n"), BlockAddress, TotalBlocks);
 #endif
 
+	if(!SDCardManager_Recover()) {
+		return false;
+	}
 	LED_ON();
 	/* Wait until endpoint is ready before continuing */
 	if(Endpoint_WaitUntilReady()) {
-		return;
+		return true;
 	}
 
 	while(TotalBlocks) {
 		/* Read a data block from the SD card */
-		sd_raw_read_interval(BlockAddress * VIRTUAL_MEMORY_BLOCK_SIZE, Buffer, 16, 512, &SDCardManager_ReadBlockHandler, NULL);
+		if(!sd_raw_read_interval((offset_t) BlockAddress * VIRTUAL_MEMORY_BLOCK_SIZE, Buffer, 16, 512, &SDCardManager_ReadBlockHandler, NULL)) {
+			LED_OFF();
+			return false;
+		}
 
 		/* Decrement the blocks remaining counter */
 		BlockAddress++;
@@ -415,13 +1200,45 @@ void SDCardManager_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
 		Endpoint_ClearIN();
 	}
 	LED_OFF();
+	return true;
 }
 
-/** Performs a simple test on the attached Dataflash IC(s) to ensure that they are working.
+/** Writes the block held back by the SD write buffer (see SD_RAW_WRITE_BUFFERING) to the card. Writes from the host
+*  are cached there until a different block is written, so this has to be called before the host expects the data
+*  to be on the card, i.e. on SYNCHRONIZE CACHE and before the medium is ejected. The multiple block write of the
+*  last WRITE (10) is ended and the card is waited for until it has programmed everything, the host may cut the
+*  power right after.
+*
+*  \return Boolean true if all data written is on the card, false otherwise (also if the card stays busy)
+*/
+bool SDCardManager_Flush(void)
+{
+	if(!SDCardManager_Recover() || !sd_raw_flush()) {
+		return false;
+	}
+	// what is left of the run announced by SDCardManager_WriteBlocks() is not coming
+	return sd_raw_write_run(0, 0);
+}
+
+/** Performs a simple test on the attached Dataflash IC(s) to ensure that they are working. The card belongs
+*  to the host while it sends SEND DIAGNOSTIC, so nothing is written: the card has to answer, and blocks
+*  spread over its whole capacity have to read back within the timeouts of sd_raw. The write benchmark
+*  runs at power up instead, see UMeter_Card_Test().
 *
 *  \return Boolean true if all media chips are working, false otherwise
 */
 bool SDCardManager_CheckDataflashOperation(void)
 {
-	return true;
+	uint32_t TotalBlocks = SDCardManager_GetNbBlocks();
+	uint8_t i;
+
+	if(!SDCardManager_Recover() || !sd_raw_sync() || !TotalBlocks) {
+		return false;
+	}
+	for(i = 0; i < 16; i++) {
+		if(!sd_raw_read((offset_t)(TotalBlocks / 16 * i) * VIRTUAL_MEMORY_BLOCK_SIZE, Buffer, sizeof(Buffer))) {
+			return false;
+		}
+	}
+	return !sd_raw_failed();
 }
@@ -11,6 +11,11 @@
 		
 		#include "UMeter.h"
 		#include "lib/INI/umeter_ini.h"
+		#include "lib/Inputs/umeter_sched.h"
+		#include "lib/Inputs/umeter_trigger.h"
+		#include "lib/Inputs/umeter_stats.h"
+		#include "lib/Inputs/umeter_delta.h"
+		#include "lib/Debug/umeter_prof.h"
 		#include "Descriptors.h"
 		
 		#include <LUFA/Common/Common.h>
@@ -22,19 +27,33 @@
 		 */
 		#define VIRTUAL_MEMORY_BLOCK_SIZE           512
 
+		/** Name of the data log file in the root directory of the card. */
+		#define LOG_FILE                            "umeter.txt"
+
 	/* Function Prototypes: */
 		void SDCardManager_Init(void);
+		bool SDCardManager_Recover(void);
 		
 		umeter_config const* UMeter_Init(void);
-		void UMeter_Task(void);
+		void UMeter_Task(uint8_t mask);
+		#if UMETER_TRIGGER
+		void UMeter_Trigger_Task(void);
+		#endif
+		void UMeter_Close_Log(void);
+		#if UMETER_PROFILE
+		void UMeter_Write_Stats(void);
+		#endif
 		
 		uint32_t SDCardManager_GetNbBlocks(void);
-		void SDCardManager_WriteBlocks(const uint32_t BlockAddress, uint16_t TotalBlocks);
-		void SDCardManager_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks);
+		const umeter_config* SDCardManager_GetConfig(void);
+		bool SDCardManager_GetFreeKiB(uint32_t* const FreeKiB);
+		bool SDCardManager_WriteBlocks(const uint32_t BlockAddress, uint16_t TotalBlocks);
+		bool SDCardManager_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks);
 		void SDCardManager_WriteBlocks_RAM(const uint32_t BlockAddress, uint16_t TotalBlocks,
 		                                      uint8_t* BufferPtr) ATTR_NON_NULL_PTR_ARG(3);
 		void SDCardManagerManager_ReadBlocks_RAM(const uint32_t BlockAddress, uint16_t TotalBlocks,
 		                                     uint8_t* BufferPtr) ATTR_NON_NULL_PTR_ARG(3);
+		bool SDCardManager_Flush(void);
 		void SDCardManager_ResetDataflashProtections(void);
 		bool SDCardManager_CheckDataflashOperation(void);
 		
@@ -13,6 +13,7 @@
 #include "fat.h"
 #include "fat_config.h"
 #include "sd-reader_config.h"
+#include "lib/Debug/umeter_prof.h"
 
 #include <string.h>
 
@@ -134,29 +135,12 @@
  * For deleted lfn entries, the ordinal field is set to 0xe5.
  */
 
-struct fat_header_struct
-{
-    offset_t size;
-
-    offset_t fat_offset;
-    uint32_t fat_size;
-
-    uint16_t sector_size;
-    uint16_t cluster_size;
-
-    offset_t cluster_zero_offset;
-
-    offset_t root_dir_offset;
-#if FAT_FAT32_SUPPORT
-    cluster_t root_dir_cluster;
-#endif
-};
-
 struct fat_fs_struct
 {
     struct partition_struct* partition;
     struct fat_header_struct header;
     cluster_t cluster_free;
+    cluster_t cluster_unit;
 };
 
 struct fat_file_struct
@@ -165,6 +149,9 @@ struct fat_file_struct
     struct fat_dir_entry_struct dir_entry;
     offset_t pos;
     cluster_t pos_cluster;
+#if FAT_DELAY_DIRENTRY_UPDATE
+    uint8_t dir_entry_changed;
+#endif
 };
 
 struct fat_dir_struct
@@ -212,8 +199,11 @@ static uint8_t fat_get_fs_free_32_callback(uint8_t* buffer, offset_t offset, voi
 
 #if FAT_WRITE_SUPPORT
 static cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t count);
+static uint8_t fat_is_free_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat_find_free_unit(const struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t cluster_count);
 static uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num);
 static uint8_t fat_terminate_clusters(struct fat_fs_struct* fs, cluster_t cluster_num);
+static void fat_erase_clusters(const struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t cluster_count);
 static uint8_t fat_clear_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
 static uintptr_t fat_clear_cluster_callback(uint8_t* buffer, offset_t offset, void* p);
 static offset_t fat_find_offset_for_dir_entry(struct fat_fs_struct* fs, const struct fat_dir_struct* parent, const struct fat_dir_entry_struct* dir_entry);
@@ -233,6 +223,25 @@ static void fat_set_file_modification_time(struct fat_dir_entry_struct* dir_entr
  * \see fat_close
  */
 struct fat_fs_struct* fat_open(struct partition_struct* partition)
+{
+    return fat_open_header(partition, 0);
+}
+
+/**
+ * \ingroup fat_fs
+ * Opens a FAT filesystem with a known header.
+ *
+ * The header is taken as given instead of being read from the
+ * boot sector, e.g. one saved by fat_get_header() on an earlier
+ * mount. The partition type has to be set to PARTITION_TYPE_FAT16
+ * or PARTITION_TYPE_FAT32 accordingly.
+ *
+ * \param[in] partition Discriptor of partition on which the filesystem resides.
+ * \param[in] header The parsed header of the filesystem, 0 to read it from the partition.
+ * \returns 0 on error, a FAT filesystem descriptor on success.
+ * \see fat_open, fat_get_header
+ */
+struct fat_fs_struct* fat_open_header(struct partition_struct* partition, const struct fat_header_struct* header)
 {
     if(!partition ||
 #if FAT_WRITE_SUPPORT
@@ -265,7 +274,9 @@ struct fat_fs_struct* fat_open(struct partition_struct* partition)
     memset(fs, 0, sizeof(*fs));
 
     fs->partition = partition;
-    if(!fat_read_header(fs))
+    if(header)
+        memcpy(&fs->header, header, sizeof(*header));
+    else if(!fat_read_header(fs))
     {
 #if USE_DYNAMIC_MEMORY
         free(fs);
@@ -423,6 +434,53 @@ uint8_t fat_read_header(struct fat_fs_struct* fs)
     return 1;
 }
 
+/**
+ * \ingroup fat_fs
+ * Returns the parsed header of a FAT filesystem.
+ *
+ * \param[in] fs The filesystem of which to return the header.
+ * \returns 0 on failure, the header otherwise.
+ * \see fat_open_header
+ */
+const struct fat_header_struct* fat_get_header(const struct fat_fs_struct* fs)
+{
+    if(!fs)
+        return 0;
+
+    return &fs->header;
+}
+
+/**
+ * \ingroup fat_fs
+ * Reads the volume serial number from the boot sector.
+ *
+ * Formatting a volume assigns it a new serial number, so this
+ * tells whether a saved header still describes the filesystem.
+ *
+ * \param[in] fs The filesystem of which to read the serial number.
+ * \param[out] serial The serial number.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t fat_get_volume_serial(const struct fat_fs_struct* fs, uint32_t* serial)
+{
+    if(!fs || !serial)
+        return 0;
+
+    /* in the extended boot record, behind the FAT32 fields for FAT32 */
+    offset_t offset = (offset_t) fs->partition->offset * 512 + 0x27;
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+        offset += 0x1c;
+#endif
+
+    uint8_t buffer[4];
+    if(!fs->partition->device_read(offset, buffer, sizeof(buffer)))
+        return 0;
+
+    *serial = read32(buffer);
+    return 1;
+}
+
 /**
  * \ingroup fat_fs
  * Retrieves the next following cluster of a given cluster.
@@ -437,6 +495,8 @@ uint8_t fat_read_header(struct fat_fs_struct* fs)
  */
 cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num)
 {
+    PROF_SCOPE(PROF_FAT_NEXT_CLUSTER);
+
     if(!fs || cluster_num < 2)
         return 0;
 
@@ -492,6 +552,8 @@ cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster
  */
 cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t count)
 {
+    PROF_SCOPE(PROF_FAT_APPEND_CLUSTERS);
+
     if(!fs)
         return 0;
 
@@ -513,6 +575,15 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
 #endif
         cluster_count = fs->header.fat_size / sizeof(fat_entry16);
 
+    /* Keep a growing chain contiguous. Otherwise start the new
+     * clusters in an allocation unit of the card which is
+     * still entirely free.
+     */
+    if(cluster_num >= 2 && cluster_num + 1 < cluster_count && fat_is_free_cluster(fs, cluster_num + 1))
+        cluster_current = cluster_num + 1;
+    else if(fs->cluster_unit > 1)
+        cluster_current = fat_find_free_unit(fs, cluster_current, cluster_count);
+
     fs->cluster_free = 0;
     for(cluster_t cluster_left = cluster_count; cluster_left > 0; --cluster_left, ++cluster_current)
     {
@@ -630,6 +701,83 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
 }
 #endif
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_fs
+ * Checks wether a cluster is free.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster to check.
+ * \returns 1 if the cluster is free, 0 if it is in use or on failure.
+ */
+uint8_t fat_is_free_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num)
+{
+    offset_t fat_offset = fs->header.fat_offset;
+
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+    {
+        uint32_t fat_entry32;
+        if(!fs->partition->device_read(fat_offset + (offset_t) cluster_num * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+            return 0;
+
+        return fat_entry32 == HTOL32(FAT32_CLUSTER_FREE);
+    }
+    else
+#endif
+    {
+        uint16_t fat_entry16;
+        if(!fs->partition->device_read(fat_offset + (offset_t) cluster_num * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+            return 0;
+
+        return fat_entry16 == HTOL16(FAT16_CLUSTER_FREE);
+    }
+}
+
+/**
+ * \ingroup fat_fs
+ * Searches an allocation unit of the card whose clusters are all free.
+ *
+ * Only the next FAT_UNIT_SEARCH units are looked at, a nearly full
+ * filesystem falls back to the first free cluster.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster from which to search.
+ * \param[in] cluster_count The number of clusters in the FAT.
+ * \returns The first cluster of a free allocation unit, or \c cluster_num if none was found.
+ * \see fat_set_alloc_unit
+ */
+cluster_t fat_find_free_unit(const struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t cluster_count)
+{
+    cluster_t unit = fs->cluster_unit;
+    uint16_t cluster_size = fs->header.cluster_size;
+    offset_t unit_size = (offset_t) unit * cluster_size;
+
+    if(cluster_num < 2)
+        cluster_num = 2;
+
+    /* the data region need not start on a unit boundary, take the
+     * first cluster beginning at or after one
+     */
+    offset_t unit_offset = (fat_cluster_offset(fs, cluster_num) + unit_size - 1) / unit_size * unit_size;
+    cluster_t cluster_current = 2 + (unit_offset - fs->header.cluster_zero_offset + cluster_size - 1) / cluster_size;
+
+    for(uint8_t units_left = FAT_UNIT_SEARCH; units_left > 0 && cluster_current + unit <= cluster_count; --units_left, cluster_current += unit)
+    {
+        cluster_t i;
+        for(i = 0; i < unit; ++i)
+        {
+            if(!fat_is_free_cluster(fs, cluster_current + i))
+                break;
+        }
+        if(i == unit)
+            return cluster_current;
+    }
+
+    return cluster_num;
+}
+#endif
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_fs
@@ -639,6 +787,9 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
  * referenced by it as free. They may then be used again for future
  * file allocations.
  *
+ * Runs of contiguous clusters freed are erased on the device, see
+ * fat_erase_clusters().
+ *
  * \note If this function is used for freeing just a part of a cluster
  *       chain, the new end of the chain is not correctly terminated
  *       within the FAT. Use fat_terminate_clusters() instead.
@@ -653,6 +804,9 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
     if(!fs || cluster_num < 2)
         return 0;
 
+    cluster_t erase_first = cluster_num;
+    cluster_t erase_count = 0;
+
     offset_t fat_offset = fs->header.fat_offset;
 #if FAT_FAT32_SUPPORT
     if(fs->partition->type == PARTITION_TYPE_FAT32)
@@ -667,7 +821,7 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
             uint32_t cluster_num_next = ltoh32(fat_entry);
 
             if(cluster_num_next == FAT32_CLUSTER_FREE)
-                return 1;
+                break;
             if(cluster_num_next == FAT32_CLUSTER_BAD ||
                (cluster_num_next >= FAT32_CLUSTER_RESERVED_MIN &&
                 cluster_num_next <= FAT32_CLUSTER_RESERVED_MAX
@@ -691,6 +845,15 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
              * The cluster is lost, but maybe we can still free up some later ones.
              */
 
+            /* collect contiguous clusters for erasing them at once */
+            if(cluster_num != erase_first + erase_count)
+            {
+                fat_erase_clusters(fs, erase_first, erase_count);
+                erase_first = cluster_num;
+                erase_count = 0;
+            }
+            ++erase_count;
+
             cluster_num = cluster_num_next;
         }
     }
@@ -707,14 +870,15 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
             uint16_t cluster_num_next = ltoh16(fat_entry);
 
             if(cluster_num_next == FAT16_CLUSTER_FREE)
-                return 1;
+                break;
             if(cluster_num_next == FAT16_CLUSTER_BAD ||
                (cluster_num_next >= FAT16_CLUSTER_RESERVED_MIN &&
                 cluster_num_next <= FAT16_CLUSTER_RESERVED_MAX
                )
               )
                 return 0;
-            if(cluster_num_next >= FAT16_CLUSTER_LAST_MIN && cluster_num_next <= FAT16_CLUSTER_LAST_MAX)
+            /* FAT16_CLUSTER_LAST_MAX is the largest 16 bit value */
+            if(cluster_num_next >= FAT16_CLUSTER_LAST_MIN)
                 cluster_num_next = 0;
 
             /* free cluster */
@@ -725,10 +889,21 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
              * The cluster is lost, but maybe we can still free up some later ones.
              */
 
+            /* collect contiguous clusters for erasing them at once */
+            if(cluster_num != erase_first + erase_count)
+            {
+                fat_erase_clusters(fs, erase_first, erase_count);
+                erase_first = cluster_num;
+                erase_count = 0;
+            }
+            ++erase_count;
+
             cluster_num = cluster_num_next;
         }
     }
 
+    fat_erase_clusters(fs, erase_first, erase_count);
+
     return 1;
 }
 #endif
@@ -778,6 +953,29 @@ uint8_t fat_terminate_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
 }
 #endif
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_fs
+ * Erases a run of contiguous clusters which has been freed.
+ *
+ * This lets the device prepare the blocks for being written again
+ * ahead of time. Failures are ignored, the clusters are free anyway.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The first cluster of the run.
+ * \param[in] cluster_count The number of clusters in the run.
+ * \see fat_free_clusters
+ */
+void fat_erase_clusters(const struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t cluster_count)
+{
+    if(!cluster_count || !fs->partition->device_erase)
+        return;
+
+    offset_t cluster_offset = fat_cluster_offset(fs, cluster_num);
+    fs->partition->device_erase(cluster_offset, cluster_offset + (offset_t) cluster_count * fs->header.cluster_size);
+}
+#endif
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_fs
@@ -796,6 +994,11 @@ uint8_t fat_clear_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num)
 
     offset_t cluster_offset = fat_cluster_offset(fs, cluster_num);
 
+    /* a single command if the device erases to zeros */
+    if(fs->partition->device_zero &&
+       fs->partition->device_zero(cluster_offset, cluster_offset + fs->header.cluster_size))
+        return 1;
+
     uint8_t zero[16];
     memset(zero, 0, sizeof(zero));
     return fs->partition->device_write_interval(cluster_offset,
@@ -949,6 +1152,9 @@ struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat
     fd->fs = fs;
     fd->pos = 0;
     fd->pos_cluster = dir_entry->cluster;
+#if FAT_DELAY_DIRENTRY_UPDATE
+    fd->dir_entry_changed = 0;
+#endif
 
     return fd;
 }
@@ -965,8 +1171,9 @@ void fat_close_file(struct fat_file_struct* fd)
     if(fd)
     {
 #if FAT_DELAY_DIRENTRY_UPDATE
-        /* write directory entry */
-        fat_write_dir_entry(fd->fs, &fd->dir_entry);
+        /* write directory entry, unless the file was only read */
+        if(fd->dir_entry_changed)
+            fat_write_dir_entry(fd->fs, &fd->dir_entry);
 #endif
 
 #if USE_DYNAMIC_MEMORY
@@ -1190,7 +1397,9 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
         /* update file size */
         fd->dir_entry.file_size = fd->pos;
 
-#if !FAT_DELAY_DIRENTRY_UPDATE
+#if FAT_DELAY_DIRENTRY_UPDATE
+        fd->dir_entry_changed = 1;
+#else
         /* write directory entry */
         if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
         {
@@ -1208,6 +1417,106 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
 }
 #endif
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Writes the directory entry of an open file.
+ *
+ * With FAT_DELAY_DIRENTRY_UPDATE, a file grown by fat_write_file()
+ * keeps its old size on disk until it is closed. This commits the
+ * current size of a file which is kept open.
+ *
+ * \param[in] fd The file handle of the file to commit.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_close_file
+ */
+uint8_t fat_sync_file(struct fat_file_struct* fd)
+{
+    if(!fd)
+        return 0;
+
+#if FAT_DELAY_DIRENTRY_UPDATE
+    if(!fd->dir_entry_changed)
+        return 1;
+    fd->dir_entry_changed = 0;
+#endif
+    return fat_write_dir_entry(fd->fs, &fd->dir_entry);
+}
+#endif
+
+/**
+ * \ingroup fat_file
+ * Determines where on the device the next write to a file goes.
+ *
+ * \param[in] fd The file handle of the file.
+ * \param[out] offset The device offset of the current file position.
+ * \param[out] length The number of bytes from there to the end of its cluster.
+ * \returns 0 if the cluster of the file position is not known yet, 1 otherwise.
+ */
+uint8_t fat_get_file_extent(const struct fat_file_struct* fd, offset_t* offset, uint16_t* length)
+{
+    if(!fd || !offset || !length || !fd->pos_cluster)
+        return 0;
+
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    uint16_t cluster_offset = (uint16_t) (fd->pos & (cluster_size - 1));
+
+    *offset = fat_cluster_offset(fd->fs, fd->pos_cluster) + cluster_offset;
+    *length = cluster_size - cluster_offset;
+    return 1;
+}
+
+/**
+ * \ingroup fat_file
+ * Determines how much of a file is stored contiguously from its start.
+ *
+ * The clusters of the file are followed as long as each is the
+ * successor of the one before.
+ *
+ * \param[in] fd The file handle of the file.
+ * \param[out] offset The device offset of the start of the file.
+ * \param[out] length The number of bytes of the file stored contiguously from there.
+ * \returns 0 if the file is empty, 1 otherwise.
+ */
+uint8_t fat_get_file_run(const struct fat_file_struct* fd, offset_t* offset, uint32_t* length)
+{
+    if(!fd || !offset || !length || !fd->dir_entry.cluster)
+        return 0;
+
+    cluster_t cluster_num = fd->dir_entry.cluster;
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    uint32_t file_size = fd->dir_entry.file_size;
+    uint32_t run = cluster_size;
+
+    while(run < file_size && fat_get_next_cluster(fd->fs, cluster_num) == cluster_num + 1)
+    {
+        ++cluster_num;
+        run += cluster_size;
+    }
+
+    *offset = fat_cluster_offset(fd->fs, fd->dir_entry.cluster);
+    *length = run < file_size ? run : file_size;
+    return 1;
+}
+
+/**
+ * \ingroup fat_file
+ * Returns the cluster holding the current file position.
+ *
+ * Together with the file position, this allows to return to the
+ * same place later on with fat_seek_file_cluster().
+ *
+ * \param[in] fd The file handle of the file.
+ * \returns The cluster number, or 0 if it is not known yet.
+ */
+cluster_t fat_get_file_cluster(const struct fat_file_struct* fd)
+{
+    if(!fd)
+        return 0;
+
+    return fd->pos_cluster;
+}
+
 /**
  * \ingroup fat_file
  * Repositions the read/write file offset.
@@ -1272,14 +1581,81 @@ uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whenc
        )
         return 0;
 
-    fd->pos = new_pos;
-    fd->pos_cluster = 0;
+    /* the cluster of the current position stays known */
+    if(new_pos != fd->pos)
+    {
+        fd->pos = new_pos;
+        fd->pos_cluster = 0;
+    }
 
     *offset = (int32_t) new_pos;
     return 1;
 }
 
 #if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Repositions the read/write file offset within a known cluster.
+ *
+ * Unlike fat_seek_file(), the cluster holding the new position is
+ * given, e.g. as saved from fat_get_file_cluster() before. It is checked
+ * against the file's cluster chain, so a saved cluster which was freed or
+ * handed to another file since is refused.
+ *
+ * A position behind the end of the file enlarges the file, taking over
+ * whatever the disk holds there. It has to lie within the given cluster.
+ *
+ * \param[in] fd The file handle of the file.
+ * \param[in] pos The new file position.
+ * \param[in] cluster The number of the cluster holding the new position.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_get_file_cluster
+ */
+uint8_t fat_seek_file_cluster(struct fat_file_struct* fd, uint32_t pos, cluster_t cluster)
+{
+    if(!fd || !fd->dir_entry.cluster || cluster < 2)
+        return 0;
+
+    /* only up to the end of the cluster the file ends in */
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    if(pos > fd->dir_entry.file_size && (pos - 1) / cluster_size != fd->dir_entry.file_size / cluster_size)
+        return 0;
+
+    /* follow the chain from the directory entry to the new position, which
+     * at a cluster boundary may be the start of the next cluster as well */
+    cluster_t cluster_num = fd->dir_entry.cluster;
+    uint32_t cluster_count = (pos ? pos - 1 : 0) / cluster_size;
+    while(cluster_count--)
+    {
+        cluster_num = fat_get_next_cluster(fd->fs, cluster_num);
+        if(!cluster_num)
+            return 0;
+    }
+    if(cluster_num != cluster &&
+       ((pos & (cluster_size - 1)) || fat_get_next_cluster(fd->fs, cluster_num) != cluster))
+        return 0;
+
+    fd->pos = pos;
+    fd->pos_cluster = cluster;
+
+    if(pos > fd->dir_entry.file_size)
+    {
+        fd->dir_entry.file_size = pos;
+#if FAT_DELAY_DIRENTRY_UPDATE
+        fd->dir_entry_changed = 1;
+#else
+        if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
+            return 0;
+#endif
+
+        /* the end of the cluster is the start of the next one */
+        if(!(pos & (cluster_size - 1)))
+            fd->pos_cluster = fat_get_next_cluster(fd->fs, cluster);
+    }
+
+    return 1;
+}
+
 /**
  * \ingroup fat_file
  * Resizes a file to have a specific size.
@@ -1336,6 +1712,9 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
              * it to the existing one, if available.
              */
             cluster_t cluster_count = (size_new + cluster_size - 1) / cluster_size;
+            /* the last cluster of the existing chain holds the first part */
+            if(cluster_num)
+                --cluster_count;
             cluster_t cluster_new_chain = fat_append_clusters(fd->fs, cluster_num, cluster_count);
             if(!cluster_new_chain)
                 return 0;
@@ -1571,6 +1950,55 @@ uint8_t fat_reset_dir(struct fat_dir_struct* dd)
     return 1;
 }
 
+/**
+ * \ingroup fat_dir
+ * Reads a directory entry again from its place on the device.
+ *
+ * The entry is expected at the entry_offset of the given one, e.g.
+ * a copy saved on an earlier mount. This saves searching the
+ * directory for a file which is known to be there. When the entry
+ * still names the same file, its cluster and size are updated.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in,out] dir_entry The directory entry to read again.
+ * \returns 0 if the file has been renamed, moved or deleted meanwhile or on failure, 1 on success.
+ */
+uint8_t fat_reload_dir_entry(const struct fat_fs_struct* fs, struct fat_dir_entry_struct* dir_entry)
+{
+    if(!fs || !dir_entry)
+        return 0;
+
+    struct fat_dir_entry_struct entry;
+    struct fat_read_dir_callback_arg arg;
+    uint8_t buffer[32];
+
+    memset(&arg, 0, sizeof(arg));
+    memset(&entry, 0, sizeof(entry));
+    arg.dir_entry = &entry;
+
+    /* the lfn entries of a long name, then the 8.3 entry */
+    if(!fs->partition->device_read_interval(dir_entry->entry_offset,
+                                            buffer,
+                                            sizeof(buffer),
+#if FAT_LFN_SUPPORT
+                                            ((sizeof(entry.long_name) + 12) / 13 + 1) * sizeof(buffer),
+#else
+                                            sizeof(buffer),
+#endif
+                                            fat_dir_entry_read_callback,
+                                            &arg)
+      )
+        return 0;
+
+    if(!arg.finished ||
+       entry.entry_offset != dir_entry->entry_offset ||
+       strcmp(entry.long_name, dir_entry->long_name) != 0)
+        return 0;
+
+    memcpy(dir_entry, &entry, sizeof(entry));
+    return 1;
+}
+
 /**
  * \ingroup fat_fs
  * Callback function for reading a directory entry.
@@ -1869,6 +2297,8 @@ offset_t fat_find_offset_for_dir_entry(struct fat_fs_struct* fs, const struct fa
  */
 uint8_t fat_write_dir_entry(const struct fat_fs_struct* fs, struct fat_dir_entry_struct* dir_entry)
 {
+    PROF_SCOPE(PROF_FAT_WRITE_DIR_ENTRY);
+
     if(!fs || !dir_entry)
         return 0;
     
@@ -2458,6 +2888,28 @@ offset_t fat_get_fs_size(const struct fat_fs_struct* fs)
         return (offset_t) (fs->header.fat_size / 2 - 2) * fs->header.cluster_size;
 }
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_fs
+ * Tells the filesystem the allocation unit size of the card.
+ *
+ * New cluster chains are then started at the beginning of an
+ * allocation unit which is entirely free, so a file written
+ * sequentially fills whole units instead of the gaps left by
+ * deleted files.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] size The allocation unit size in bytes, zero if unknown.
+ */
+void fat_set_alloc_unit(struct fat_fs_struct* fs, uint32_t size)
+{
+    if(!fs)
+        return;
+
+    fs->cluster_unit = size / fs->header.cluster_size;
+}
+#endif
+
 /**
  * \ingroup fat_fs
  * Returns the amount of free storage capacity on the filesystem in bytes.
@@ -2509,6 +2961,55 @@ offset_t fat_get_fs_free(const struct fat_fs_struct* fs)
     return (offset_t) count_arg.cluster_count * fs->header.cluster_size;
 }
 
+/**
+ * \ingroup fat_fs
+ * Returns the free storage capacity without reading a FAT32's FAT.
+ *
+ * A FAT16's FAT is at most 128kB and is counted like fat_get_fs_free()
+ * does. On FAT32 the free cluster count of the FSInfo sector is taken,
+ * which is only a hint: it is kept by the hosts, not by this library.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[out] bytes The free filesystem space in bytes.
+ * \returns 0 if the free space is unknown, 1 on success.
+ */
+uint8_t fat_get_fs_free_hint(const struct fat_fs_struct* fs, offset_t* bytes)
+{
+    if(!fs)
+        return 0;
+
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+    {
+        offset_t partition_offset = (offset_t) fs->partition->offset * 512;
+        uint8_t buffer[8];
+
+        /* the FSInfo sector number follows the FAT32 root directory cluster */
+        if(!fs->partition->device_read(partition_offset + 0x30, buffer, 2))
+            return 0;
+        offset_t fsinfo_offset = partition_offset + (offset_t) read16(buffer) * fs->header.sector_size;
+
+        /* lead signature, then structure signature and free cluster count */
+        if(!fs->partition->device_read(fsinfo_offset, buffer, 4) ||
+           read32(buffer) != 0x41615252 ||
+           !fs->partition->device_read(fsinfo_offset + 0x1e4, buffer, 8) ||
+           read32(buffer) != 0x61417272)
+            return 0;
+
+        uint32_t free_clusters = read32(&buffer[4]);
+        if(free_clusters > fs->header.fat_size / 4 - 2)
+            /* 0xffffffff, never computed */
+            return 0;
+
+        *bytes = (offset_t) free_clusters * fs->header.cluster_size;
+        return 1;
+    }
+#endif
+
+    *bytes = fat_get_fs_free(fs);
+    return 1;
+}
+
 /**
  * \ingroup fat_fs
  * Callback function used for counting free clusters in a FAT.
@@ -2568,4 +3069,20 @@ struct fat_file_struct* open_file_in_dir(struct fat_fs_struct* fs, struct fat_di
 	}
 
 	return fat_open_file(fs, &file_entry);
-}
\ No newline at end of file
+}
+
+// Append 'count' zero bytes to 'fd', e.g. to pad it to a block boundary.
+// Returns 1 on success.
+uint8_t write_zero_to_file(struct fat_file_struct* fd, uint16_t count)
+{
+	static const uint8_t zero[16];
+	uint16_t n;
+	while(count) {
+		n = count < sizeof(zero) ? count : sizeof(zero);
+		if(fat_write_file(fd, zero, n) != n) {
+			return 0;
+		}
+		count -= n;
+	}
+	return 1;
+}
@@ -89,8 +89,41 @@ struct fat_dir_entry_struct
     offset_t entry_offset;
 };
 
+/**
+ * \ingroup fat_fs
+ * Describes the layout of a filesystem, as parsed from its boot sector.
+ */
+struct fat_header_struct
+{
+    /** The size of the filesystem in bytes. */
+    offset_t size;
+
+    /** The device offset of the first FAT. */
+    offset_t fat_offset;
+    /** The size of one FAT in bytes. */
+    uint32_t fat_size;
+
+    /** The size of a sector in bytes. */
+    uint16_t sector_size;
+    /** The size of a cluster in bytes. */
+    uint16_t cluster_size;
+
+    /** The device offset of the (nonexistent) cluster 0. */
+    offset_t cluster_zero_offset;
+
+    /** The device offset of the FAT16 root directory. */
+    offset_t root_dir_offset;
+#if FAT_FAT32_SUPPORT
+    /** The first cluster of the FAT32 root directory. */
+    cluster_t root_dir_cluster;
+#endif
+};
+
 struct fat_fs_struct* fat_open(struct partition_struct* partition);
+struct fat_fs_struct* fat_open_header(struct partition_struct* partition, const struct fat_header_struct* header);
 void fat_close(struct fat_fs_struct* fs);
+const struct fat_header_struct* fat_get_header(const struct fat_fs_struct* fs);
+uint8_t fat_get_volume_serial(const struct fat_fs_struct* fs, uint32_t* serial);
 
 struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat_dir_entry_struct* dir_entry);
 void fat_close_file(struct fat_file_struct* fd);
@@ -98,11 +131,17 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
 intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len);
 uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whence);
 uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size);
+uint8_t fat_sync_file(struct fat_file_struct* fd);
+uint8_t fat_get_file_extent(const struct fat_file_struct* fd, offset_t* offset, uint16_t* length);
+uint8_t fat_get_file_run(const struct fat_file_struct* fd, offset_t* offset, uint32_t* length);
+cluster_t fat_get_file_cluster(const struct fat_file_struct* fd);
+uint8_t fat_seek_file_cluster(struct fat_file_struct* fd, uint32_t pos, cluster_t cluster);
 
 struct fat_dir_struct* fat_open_dir(struct fat_fs_struct* fs, const struct fat_dir_entry_struct* dir_entry);
 void fat_close_dir(struct fat_dir_struct* dd);
 uint8_t fat_read_dir(struct fat_dir_struct* dd, struct fat_dir_entry_struct* dir_entry);
 uint8_t fat_reset_dir(struct fat_dir_struct* dd);
+uint8_t fat_reload_dir_entry(const struct fat_fs_struct* fs, struct fat_dir_entry_struct* dir_entry);
 
 uint8_t fat_create_file(struct fat_dir_struct* parent, const char* file, struct fat_dir_entry_struct* dir_entry);
 uint8_t fat_delete_file(struct fat_fs_struct* fs, struct fat_dir_entry_struct* dir_entry);
@@ -118,9 +157,12 @@ uint8_t fat_get_dir_entry_of_path(struct fat_fs_struct* fs, const char* path, st
 
 offset_t fat_get_fs_size(const struct fat_fs_struct* fs);
 offset_t fat_get_fs_free(const struct fat_fs_struct* fs);
+uint8_t fat_get_fs_free_hint(const struct fat_fs_struct* fs, offset_t* bytes);
+void fat_set_alloc_unit(struct fat_fs_struct* fs, uint32_t size);
 
 uint8_t find_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name, struct fat_dir_entry_struct* dir_entry);
 struct fat_file_struct* open_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name);
+uint8_t write_zero_to_file(struct fat_file_struct* fd, uint16_t count);
 
 /**
  * @}
@@ -68,8 +68,19 @@ extern "C"
  * Set to 1 to delay directory entry updates until the file is closed.
  * This can boost performance significantly, but may cause data loss
  * if the file is not properly closed.
+ *
+ * The logger keeps umeter.txt open and commits its size with
+ * fat_sync_file() every few blocks, see UMeter_Task().
+ */
+#define FAT_DELAY_DIRENTRY_UPDATE 1
+
+/**
+ * \ingroup fat_config
+ * Number of allocation units searched for a free one.
+ *
+ * See fat_set_alloc_unit().
  */
-#define FAT_DELAY_DIRENTRY_UPDATE 0
+#define FAT_UNIT_SEARCH 64
 
 /**
  * \ingroup fat_config
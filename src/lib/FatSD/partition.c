@@ -54,6 +54,8 @@ static struct partition_struct partition_handles[PARTITION_COUNT];
  * \param[in] device_read_interval A function pointer which is used to read in constant intervals from the disk.
  * \param[in] device_write A function pointer which is used to write to the disk.
  * \param[in] device_write_interval A function pointer which is used to write a data stream to disk.
+ * \param[in] device_erase A function pointer which is used to erase blocks no longer in use, may be zero.
+ * \param[in] device_zero A function pointer which is used to clear blocks by erasing them, may be zero.
  * \param[in] index The index of the partition which should be opened, range 0 to 3.
  *                  A negative value is allowed as well. In this case, the partition opened is
  *                  not checked for existance, begins at offset zero, has a length of zero
@@ -62,7 +64,7 @@ static struct partition_struct partition_handles[PARTITION_COUNT];
  * \returns 0 on failure, a partition descriptor on success.
  * \see partition_close
  */
-struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_write_t device_write, device_write_interval_t device_write_interval, int8_t index)
+struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_write_t device_write, device_write_interval_t device_write_interval, device_erase_t device_erase, device_erase_t device_zero, int8_t index)
 {
     struct partition_struct* new_partition = 0;
     uint8_t buffer[0x10];
@@ -107,6 +109,8 @@ struct partition_struct* partition_open(device_read_t device_read, device_read_i
     new_partition->device_read_interval = device_read_interval;
     new_partition->device_write = device_write;
     new_partition->device_write_interval = device_write_interval;
+    new_partition->device_erase = device_erase;
+    new_partition->device_zero = device_zero;
 
     if(index >= 0)
     {
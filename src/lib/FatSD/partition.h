@@ -147,6 +147,19 @@ typedef uintptr_t (*device_write_callback_t)(uint8_t* buffer, offset_t offset, v
  */
 typedef uint8_t (*device_write_interval_t)(offset_t offset, uint8_t* buffer, uintptr_t length, device_write_callback_t callback, void* p);
 
+/**
+ * A function pointer used to erase a range of the partition.
+ *
+ * The device may fail without erasing anything, e.g. if it does not
+ * support erasing. A function meant to clear the range also fails if
+ * erased data does not read as zeros.
+ *
+ * \param[in] start The offset on the device of the first block to erase.
+ * \param[in] end The offset on the device following the last block to erase.
+ * \returns 0 on failure, 1 on success
+ */
+typedef uint8_t (*device_erase_t)(offset_t start, offset_t end);
+
 /**
  * Describes a partition.
  */
@@ -180,6 +193,20 @@ struct partition_struct
      *       not to the start of the partition.
      */
     device_write_interval_t device_write_interval;
+    /**
+     * The function which erases blocks of the partition no longer in use, may be zero.
+     *
+     * \note The offset given to this function is relative to the whole disk,
+     *       not to the start of the partition.
+     */
+    device_erase_t device_erase;
+    /**
+     * The function which clears blocks of the partition by erasing them, may be zero.
+     *
+     * \note The offset given to this function is relative to the whole disk,
+     *       not to the start of the partition.
+     */
+    device_erase_t device_zero;
 
     /**
      * The type of the partition.
@@ -197,7 +224,7 @@ struct partition_struct
     uint32_t length;
 };
 
-struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_write_t device_write, device_write_interval_t device_write_interval, int8_t index);
+struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_write_t device_write, device_write_interval_t device_write_interval, device_erase_t device_erase, device_erase_t device_zero, int8_t index);
 uint8_t partition_close(struct partition_struct* partition);
 
 /**
@@ -10,7 +10,10 @@
 
 #include <string.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "sd_raw.h"
+#include "lib/Debug/umeter_prof.h"
+#include "lib/Timer/umeter_clock.h"
 
 /**
  * \addtogroup sd_raw MMC/SD/SDHC card raw access
@@ -54,6 +57,8 @@
 #define CMD_STOP_TRANSMISSION 0x0c
 /* CMD13: response R2 */
 #define CMD_SEND_STATUS 0x0d
+/* ACMD13: arg0[31:0]: stuff bits, response R2 */
+#define CMD_SD_STATUS 0x0d
 /* CMD16: arg0[31:0]: block length, response R1 */
 #define CMD_SET_BLOCKLEN 0x10
 /* CMD17: arg0[31:0]: data address, response R1 */
@@ -62,6 +67,8 @@
 #define CMD_READ_MULTIPLE_BLOCK 0x12
 /* CMD24: arg0[31:0]: data address, response R1 */
 #define CMD_WRITE_SINGLE_BLOCK 0x18
+/* ACMD23: arg0[22:0]: number of blocks, response R1 */
+#define CMD_SET_WR_BLK_ERASE_COUNT 0x17
 /* CMD25: arg0[31:0]: data address, response R1 */
 #define CMD_WRITE_MULTIPLE_BLOCK 0x19
 /* CMD27: response R1 */
@@ -76,6 +83,9 @@
 #define CMD_TAG_SECTOR_START 0x20
 /* CMD33: arg0[31:0]: data address, response R1 */
 #define CMD_TAG_SECTOR_END 0x21
+/* CMD32 and CMD33 of SD cards, the first and last block to erase */
+#define CMD_ERASE_WR_BLK_START CMD_TAG_SECTOR_START
+#define CMD_ERASE_WR_BLK_END CMD_TAG_SECTOR_END
 /* CMD34: arg0[31:0]: data address, response R1 */
 #define CMD_UNTAG_SECTOR 0x22
 /* CMD35: arg0[31:0]: data address, response R1 */
@@ -90,6 +100,8 @@
 #define CMD_SD_SEND_OP_COND 0x29
 /* CMD42: arg0[31:0]: stuff bits, response R1b */
 #define CMD_LOCK_UNLOCK 0x2a
+/* ACMD51: arg0[31:0]: stuff bits, response R1 */
+#define CMD_SEND_SCR 0x33
 /* CMD55: arg0[31:0]: stuff bits, response R1 */
 #define CMD_APP 0x37
 /* CMD58: arg0[31:0]: stuff bits, response R3 */
@@ -138,11 +150,32 @@
 #define DR_STATUS_ACCEPTED 0x05
 #define DR_STATUS_CRC_ERR 0x0a
 #define DR_STATUS_WRITE_ERR 0x0c
+/* Data tokens */
+#define TOKEN_START_BLOCK 0xfe
+#define TOKEN_START_MULTI 0xfc
+#define TOKEN_STOP_TRAN 0xfd
+
+/* timeouts in milliseconds, the maximum times of the SD specification */
+#define SD_RAW_TIMEOUT_INIT 1000
+#define SD_RAW_TIMEOUT_READ 100
+#define SD_RAW_TIMEOUT_WRITE 500
+/* per 4 MiB erased, the erase timeout of a typical allocation unit */
+#define SD_RAW_TIMEOUT_ERASE 250
+
+/* failure classes, see struct sd_raw_errors */
+#define SD_RAW_ERROR_COMMAND 0
+#define SD_RAW_ERROR_TIMEOUT 1
+#define SD_RAW_ERROR_DATA 2
+#define SD_RAW_ERROR_INIT 3
 
 /* status bits for card types */
 #define SD_RAW_SPEC_1 0
 #define SD_RAW_SPEC_2 1
 #define SD_RAW_SPEC_SDHC 2
+/* the card erases single blocks, see sd_raw_erase() */
+#define SD_RAW_ERASE 3
+/* erased blocks read as zeros */
+#define SD_RAW_ERASE_ZERO 4
 
 #if !SD_RAW_SAVE_RAM
 /* static data buffer for acceleration */
@@ -155,21 +188,87 @@ static uint8_t raw_block_written;
 #endif
 #endif
 
+/* allocation unit sizes in MiB of AU_SIZE 0x0a to 0x0f in the sd status */
+static const uint8_t sd_raw_au_sizes_mib[] PROGMEM = { 8, 12, 16, 24, 32, 64 };
+
 /* card type state */
 static uint8_t sd_raw_card_type;
+/* flag to remember if the card failed, it is not accessed until initialized again */
+static uint8_t sd_raw_card_failed;
+/* failures since power up, by SD_RAW_ERROR_* class */
+static uint16_t sd_raw_error_counts[4];
+#if SD_RAW_WRITE_SUPPORT
+/* flag to remember if the card may still be programming the last block written */
+static uint8_t sd_raw_card_busy;
+/* milliseconds the card may stay busy */
+static uint16_t sd_raw_busy_timeout;
+/* next block of the write run announced by sd_raw_write_run() */
+static offset_t sd_raw_run_address;
+/* blocks left in the write run */
+static uint32_t sd_raw_run_blocks;
+/* flag to remember if the card is within a multiple block write */
+static uint8_t sd_raw_run_open;
+#endif
 
 /* private helper functions */
 static void sd_raw_send_byte(uint8_t b);
 static uint8_t sd_raw_rec_byte();
 static uint8_t sd_raw_send_command(uint8_t command, uint32_t arg);
+static uint8_t sd_raw_init_card();
+static void sd_raw_fail(uint8_t error);
+static uint8_t sd_raw_wait_data();
+#if SD_RAW_WRITE_SUPPORT
+static uint8_t sd_raw_wait_ready();
+static void sd_raw_end_run();
+static void sd_raw_read_erase_info();
+#endif
 
 /**
  * \ingroup sd_raw
  * Initializes memory card communication.
  *
  * \returns 0 on failure, 1 on success.
+ * \see sd_raw_reinit
  */
 uint8_t sd_raw_init()
+{
+#if SD_RAW_WRITE_BUFFERING
+    /* nothing is held back for this card yet */
+    raw_block_written = 1;
+#endif
+
+    return sd_raw_reinit();
+}
+
+/**
+ * \ingroup sd_raw
+ * Initializes the card again after it failed.
+ *
+ * Unlike sd_raw_init(), a block still held back by the write buffer
+ * is kept and written to the card later on. The caller has to make
+ * sure it is the same card, e.g. by comparing its serial number.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_failed
+ */
+uint8_t sd_raw_reinit()
+{
+    if(sd_raw_init_card())
+        return 1;
+
+    if(sd_raw_error_counts[SD_RAW_ERROR_INIT] < UINT16_MAX)
+        ++sd_raw_error_counts[SD_RAW_ERROR_INIT];
+    sd_raw_card_failed = 1;
+    return 0;
+}
+
+/**
+ * \ingroup sd_raw
+ * Runs the initialization procedure of the card.
+ *
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_init_card()
 {
     /* enable inputs for reading card status */
     configure_pin_available();
@@ -196,6 +295,13 @@ uint8_t sd_raw_init()
 
     /* initialization procedure */
     sd_raw_card_type = 0;
+    sd_raw_card_failed = 0;
+#if SD_RAW_WRITE_SUPPORT
+    sd_raw_card_busy = 0;
+    sd_raw_busy_timeout = SD_RAW_TIMEOUT_WRITE;
+    sd_raw_run_blocks = 0;
+    sd_raw_run_open = 0;
+#endif
     
     if(!sd_raw_available()) {
         return 0;
@@ -234,9 +340,15 @@ uint8_t sd_raw_init()
         sd_raw_rec_byte();
         sd_raw_rec_byte();
         if((sd_raw_rec_byte() & 0x01) == 0)
+        {
+            unselect_card();
             return 0; /* card operation voltage range doesn't match */
+        }
         if(sd_raw_rec_byte() != 0xaa)
+        {
+            unselect_card();
             return 0; /* wrong test pattern */
+        }
 
         /* card conforms to SD 2 card specification */
         sd_raw_card_type |= (1 << SD_RAW_SPEC_2);
@@ -259,7 +371,7 @@ uint8_t sd_raw_init()
     }
 
     /* wait for card to get ready */
-    for(uint16_t i = 0; ; ++i)
+    for(uint32_t start = clock_ms(); ; )
     {
         if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
         {
@@ -279,7 +391,7 @@ uint8_t sd_raw_init()
         if((response & (1 << R1_IDLE_STATE)) == 0)
             break;
 
-        if(i == 0x7fff)
+        if(clock_ms() - start >= SD_RAW_TIMEOUT_INIT)
         {
             unselect_card();
             return 0;
@@ -318,17 +430,56 @@ uint8_t sd_raw_init()
     SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
     SPSR |= (1 << SPI2X); /* Doubled Clock Frequency: f_OSC / 2 */
 
+#if SD_RAW_WRITE_SUPPORT
+    select_card();
+    sd_raw_read_erase_info();
+    unselect_card();
+#endif
+
 #if !SD_RAW_SAVE_RAM
-    /* the first block is likely to be accessed first, so precache it here */
-    raw_block_address = (offset_t) -1;
+    /* the first block is likely to be accessed first, so precache it here,
+     * unless the buffer holds a block still to be written
+     */
 #if SD_RAW_WRITE_BUFFERING
-    raw_block_written = 1;
+    if(raw_block_written)
 #endif
-    if(!sd_raw_read(0, raw_block, sizeof(raw_block)))
-        return 0;
+    {
+        raw_block_address = (offset_t) -1;
+        if(!sd_raw_read(0, raw_block, sizeof(raw_block)))
+            return 0;
+    }
 #endif
 
-    return 1;
+    return !sd_raw_card_failed;
+}
+
+/**
+ * \ingroup sd_raw
+ * Checks wether the card failed since it was initialized.
+ *
+ * A command went unanswered or was refused, a data block did not
+ * arrive or was rejected, or the card stayed busy for too long.
+ * Until sd_raw_reinit() succeeds, all accesses fail immediately.
+ *
+ * \returns 1 if the card failed, 0 if it did not.
+ */
+uint8_t sd_raw_failed()
+{
+    return sd_raw_card_failed;
+}
+
+/**
+ * \ingroup sd_raw
+ * Returns the number of card failures since power up.
+ *
+ * \param[out] errors The structure into which to save the counters.
+ */
+void sd_raw_get_errors(struct sd_raw_errors* errors)
+{
+    errors->command = sd_raw_error_counts[SD_RAW_ERROR_COMMAND];
+    errors->timeout = sd_raw_error_counts[SD_RAW_ERROR_TIMEOUT];
+    errors->data = sd_raw_error_counts[SD_RAW_ERROR_DATA];
+    errors->init = sd_raw_error_counts[SD_RAW_ERROR_INIT];
 }
 
 /**
@@ -353,6 +504,188 @@ uint8_t sd_raw_locked()
     return get_pin_locked() == 0x00;
 }
 
+#if DOXYGEN || SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Checks wether the card is still programming a block written before.
+ *
+ * Writes return as soon as the card has accepted the data, the
+ * busy period which follows is only waited for when the card is
+ * addressed the next time. This lets the caller do other work
+ * meanwhile and use this function to find out when the next
+ * card access will no longer block.
+ *
+ * \returns 1 if the card is busy, 0 if it is ready.
+ */
+uint8_t sd_raw_busy()
+{
+    if(!sd_raw_card_busy)
+        return 0;
+
+    select_card();
+    if(sd_raw_rec_byte() == 0xff)
+        sd_raw_card_busy = 0;
+    unselect_card();
+
+    return sd_raw_card_busy;
+}
+
+/**
+ * \ingroup sd_raw
+ * Waits until the card has finished programming a previously written block.
+ *
+ * The card has to be selected.
+ *
+ * \returns 0 if the card is still busy after the timeout, 1 otherwise.
+ */
+uint8_t sd_raw_wait_ready()
+{
+    if(!sd_raw_card_busy)
+        return 1;
+
+    PROF_SCOPE(PROF_SD_BUSY);
+    uint32_t start = clock_ms();
+    while(sd_raw_rec_byte() != 0xff)
+    {
+        if(clock_ms() - start >= sd_raw_busy_timeout)
+        {
+            sd_raw_fail(SD_RAW_ERROR_TIMEOUT);
+            return 0;
+        }
+    }
+    sd_raw_card_busy = 0;
+    sd_raw_busy_timeout = SD_RAW_TIMEOUT_WRITE;
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Ends a multiple block write the card is within.
+ *
+ * The remaining blocks of the write run stay announced, the next
+ * write to them starts a new multiple block write.
+ *
+ * The card has to be selected.
+ */
+void sd_raw_end_run()
+{
+    if(!sd_raw_run_open)
+        return;
+
+    sd_raw_run_open = 0;
+    if(!sd_raw_wait_ready())
+        return;
+    sd_raw_send_byte(TOKEN_STOP_TRAN);
+    /* the card starts signalling busy one byte after the token */
+    sd_raw_rec_byte();
+    sd_raw_card_busy = 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Finds out whether and how the card erases blocks.
+ *
+ * Only SD cards erasing single blocks are erased: SDHC cards, and
+ * standard capacity cards setting ERASE_BLK_EN in the CSD. Others
+ * would erase whole sectors around the blocks addressed. The SCR
+ * tells wether erased blocks read as zeros or as ones.
+ *
+ * The card has to be selected.
+ */
+void sd_raw_read_erase_info()
+{
+    if(!(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2))))
+        return;
+
+#if SD_RAW_SDHC
+    if(!(sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC)))
+#endif
+    {
+        if(sd_raw_send_command(CMD_SEND_CSD, 0))
+            return;
+
+        uint8_t erase_blk_en = 0;
+        if(!sd_raw_wait_data())
+            return;
+        for(uint8_t i = 0; i < 18; ++i)
+        {
+            uint8_t b = sd_raw_rec_byte();
+            if(i == 10)
+                erase_blk_en = b & 0x40;
+        }
+        if(!erase_blk_en)
+            return;
+    }
+    sd_raw_card_type |= (1 << SD_RAW_ERASE);
+
+    sd_raw_send_command(CMD_APP, 0);
+    if(sd_raw_send_command(CMD_SEND_SCR, 0))
+        return;
+
+    /* DATA_STAT_AFTER_ERASE is the top bit of the second byte */
+    if(!sd_raw_wait_data())
+        return;
+    for(uint8_t i = 0; i < 10; ++i)
+    {
+        uint8_t b = sd_raw_rec_byte();
+        if(i == 1 && !(b & 0x80))
+            sd_raw_card_type |= (1 << SD_RAW_ERASE_ZERO);
+    }
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Marks the card as failed and counts the failure.
+ *
+ * Only the failure which took the card down is counted, the card
+ * is not accessed again until sd_raw_reinit() succeeds.
+ *
+ * \param[in] error The failure class, one of the \c SD_RAW_ERROR_* constants.
+ */
+void sd_raw_fail(uint8_t error)
+{
+    if(!sd_raw_card_failed && sd_raw_error_counts[error] < UINT16_MAX)
+        ++sd_raw_error_counts[error];
+    sd_raw_card_failed = 1;
+
+#if SD_RAW_WRITE_SUPPORT
+    /* nothing is waited for or continued on a card which went away */
+    sd_raw_card_busy = 0;
+    sd_raw_run_open = 0;
+#endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Waits for the start token of a data block.
+ *
+ * The card has to be selected.
+ *
+ * \returns 1 when the data block follows, 0 on an error token or timeout.
+ */
+uint8_t sd_raw_wait_data()
+{
+    uint32_t start = clock_ms();
+    for(;;)
+    {
+        uint8_t b = sd_raw_rec_byte();
+        if(b == 0xfe)
+            return 1;
+
+        if(b != 0xff)
+        {
+            sd_raw_fail(SD_RAW_ERROR_DATA);
+            return 0;
+        }
+        if(clock_ms() - start >= SD_RAW_TIMEOUT_READ)
+        {
+            sd_raw_fail(SD_RAW_ERROR_TIMEOUT);
+            return 0;
+        }
+    }
+}
+
 /**
  * \ingroup sd_raw
  * Sends a raw byte to the memory card.
@@ -397,6 +730,19 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
 {
     uint8_t response;
 
+    /* the card is left alone until it is initialized again */
+    if(sd_raw_card_failed)
+        return 0xff;
+
+#if SD_RAW_WRITE_SUPPORT
+    /* the card does not accept commands while receiving or programming blocks */
+    sd_raw_end_run();
+    if(!sd_raw_wait_ready())
+        return 0xff;
+#endif
+
+    PROF_SCOPE(PROF_SD_COMMAND);
+
     /* wait some clock cycles */
     sd_raw_rec_byte();
 
@@ -474,12 +820,17 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
 #endif
             {
+                sd_raw_fail(SD_RAW_ERROR_COMMAND);
                 unselect_card();
                 return 0;
             }
 
             /* wait for data block (start byte 0xfe) */
-            while(sd_raw_rec_byte() != 0xfe);
+            if(!sd_raw_wait_data())
+            {
+                unselect_card();
+                return 0;
+            }
 
 #if SD_RAW_SAVE_RAM
             /* read byte block */
@@ -592,12 +943,17 @@ uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interva
         if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, offset - block_offset))
 #endif
         {
+            sd_raw_fail(SD_RAW_ERROR_COMMAND);
             unselect_card();
             return 0;
         }
 
         /* wait for data block (start byte 0xfe) */
-        while(sd_raw_rec_byte() != 0xfe);
+        if(!sd_raw_wait_data())
+        {
+            unselect_card();
+            return 0;
+        }
 
         /* read up to the data of interest */
         for(uint16_t i = 0; i < block_offset; ++i)
@@ -693,7 +1049,10 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
 
             if(block_offset || write_length < 512)
             {
-                if(!sd_raw_read(block_address, raw_block, sizeof(raw_block)))
+                /* the old content of the next block of a write run is not needed */
+                if(sd_raw_run_blocks && block_address == sd_raw_run_address)
+                    memset(raw_block, 0, sizeof(raw_block));
+                else if(!sd_raw_read(block_address, raw_block, sizeof(raw_block)))
                     return 0;
             }
             raw_block_address = block_address;
@@ -711,22 +1070,58 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
 #endif
         }
 
+        /* keep the data until the card is back */
+        if(sd_raw_card_failed)
+            return 0;
+
         /* address card */
         select_card();
 
-        /* send single block request */
+        uint8_t token = TOKEN_START_BLOCK;
 #if SD_RAW_SDHC
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+        uint32_t card_address = (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address);
 #else
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
+        uint32_t card_address = block_address;
 #endif
+        if(sd_raw_run_blocks && block_address == sd_raw_run_address)
         {
+            if(!sd_raw_run_open)
+            {
+                /* let the card pre-erase the rest of the run (ignored by MMC cards) */
+                sd_raw_send_command(CMD_APP, 0);
+                sd_raw_send_command(CMD_SET_WR_BLK_ERASE_COUNT, sd_raw_run_blocks);
+
+                /* send multiple block request */
+                if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, card_address))
+                {
+                    sd_raw_fail(SD_RAW_ERROR_COMMAND);
+                    sd_raw_run_blocks = 0;
+                    unselect_card();
+                    return 0;
+                }
+                sd_raw_run_open = 1;
+            }
+            else
+            {
+                /* the previous block of the run has to be programmed */
+                if(!sd_raw_wait_ready())
+                {
+                    unselect_card();
+                    return 0;
+                }
+            }
+            token = TOKEN_START_MULTI;
+        }
+        /* send single block request */
+        else if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, card_address))
+        {
+            sd_raw_fail(SD_RAW_ERROR_COMMAND);
             unselect_card();
             return 0;
         }
 
         /* send start byte */
-        sd_raw_send_byte(0xfe);
+        sd_raw_send_byte(token);
 
         /* write byte block */
         uint8_t* cache = raw_block;
@@ -737,9 +1132,33 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
         sd_raw_send_byte(0xff);
         sd_raw_send_byte(0xff);
 
-        /* wait while card is busy */
-        while(sd_raw_rec_byte() != 0xff);
-        sd_raw_rec_byte();
+        /* check the data response token */
+        uint8_t response = sd_raw_rec_byte();
+        if((response & 0x1f) != DR_STATUS_ACCEPTED)
+        {
+            /* wait for the card to leave its busy state before giving up */
+            sd_raw_card_busy = 1;
+            sd_raw_run_blocks = 0;
+            sd_raw_end_run();
+            sd_raw_wait_ready();
+            sd_raw_fail(SD_RAW_ERROR_DATA);
+            unselect_card();
+            return 0;
+        }
+
+        /* don't wait while the card is busy programming the block,
+         * this is done before it is addressed the next time
+         */
+        sd_raw_card_busy = 1;
+
+        /* the multiple block write is left open for a run continuing it, see
+         * sd_raw_write_run(), until sd_raw_flush() or another command ends it
+         */
+        if(token == TOKEN_START_MULTI)
+        {
+            sd_raw_run_address += 512;
+            --sd_raw_run_blocks;
+        }
 
         /* deaddress card */
         unselect_card();
@@ -832,6 +1251,183 @@ uint8_t sd_raw_sync()
 #endif
     return 1;
 }
+
+/**
+ * \ingroup sd_raw
+ * Makes everything written so far durable on the card.
+ *
+ * Unlike sd_raw_sync(), which only hands the buffered block to the
+ * card, this also ends a multiple block write left open for the rest
+ * of its run and waits until the card has finished programming. The
+ * blocks left of the run stay announced, see sd_raw_write_run().
+ *
+ * Call this before reporting data as written to someone who may cut
+ * the power, e.g. when committing a file size or on SYNCHRONIZE CACHE.
+ *
+ * \returns 0 on failure or if the card is still busy after the timeout, 1 on success.
+ * \see sd_raw_sync
+ */
+uint8_t sd_raw_flush()
+{
+    uint8_t ready;
+
+    if(!sd_raw_sync() || sd_raw_card_failed)
+        return 0;
+
+    select_card();
+    sd_raw_end_run();
+    ready = sd_raw_wait_ready();
+    unselect_card();
+
+    return ready && !sd_raw_card_failed;
+}
+#endif
+
+#if DOXYGEN || SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Announces a run of blocks which are written sequentially.
+ *
+ * The blocks of the run are sent to the card as one multiple block
+ * write, preceded by the number of blocks so the card can erase them
+ * ahead. This is much faster than single block writes, at least when
+ * the run lies within one allocation unit (see sd_raw_info).
+ *
+ * The previous content of the blocks is considered lost: the next
+ * block of the run is not read from the card when it is only
+ * partially written. Any other card access ends the multiple block
+ * write early, the following blocks of the run are then written with
+ * a new one.
+ *
+ * A run starting where the current multiple block write continues
+ * extends it. Pass zero blocks to cancel the run.
+ *
+ * \param[in] offset The offset of the first block of the run, a multiple of 512.
+ * \param[in] blocks The number of blocks in the run.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write
+ */
+uint8_t sd_raw_write_run(offset_t offset, uint32_t blocks)
+{
+    if(offset & 0x01ff)
+        return 0;
+
+#if SD_RAW_WRITE_BUFFERING
+    /* write the last block of the current run if it is still buffered,
+     * so a run following it continues the multiple block write
+     */
+    if(!raw_block_written && sd_raw_run_blocks && raw_block_address == sd_raw_run_address && raw_block_address + 512 == offset)
+    {
+        if(!sd_raw_sync())
+            return 0;
+    }
+#endif
+
+    if(sd_raw_run_open && (offset != sd_raw_run_address || !blocks))
+    {
+        select_card();
+        sd_raw_end_run();
+        unselect_card();
+    }
+
+    sd_raw_run_address = offset;
+    sd_raw_run_blocks = blocks;
+
+    return 1;
+}
+#endif
+
+#if DOXYGEN || SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Erases a range of blocks.
+ *
+ * Tells the card the blocks are no longer needed, so it can prepare
+ * them for being written again in the background instead of when
+ * they are written next. Their content is lost, a buffered write to
+ * one of them is dropped.
+ *
+ * Like writes, the function does not wait for the card to finish.
+ *
+ * \note Only SD cards erasing single blocks are erased, the function
+ *       fails on others without touching the card.
+ *
+ * \param[in] start The offset of the first block to erase, a multiple of 512.
+ * \param[in] end The offset following the last block to erase, a multiple of 512.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_zero
+ */
+uint8_t sd_raw_erase(offset_t start, offset_t end)
+{
+    if(((start | end) & 0x01ff) || !(sd_raw_card_type & (1 << SD_RAW_ERASE)) || sd_raw_locked())
+        return 0;
+    if(start >= end)
+        return 1;
+
+    /* the cached block is erased as well */
+    if(raw_block_address >= start && raw_block_address < end)
+    {
+        raw_block_address = (offset_t) -1;
+#if SD_RAW_WRITE_BUFFERING
+        raw_block_written = 1;
+#endif
+    }
+
+    /* the erase timeout grows with the range */
+    uint32_t timeout = ((end - start) / (4UL * 1024 * 1024) + 1) * SD_RAW_TIMEOUT_ERASE;
+    if(timeout > UINT16_MAX)
+        timeout = UINT16_MAX;
+
+    /* the card addresses the last block, not the one following it */
+    end -= 512;
+#if SD_RAW_SDHC
+    if(sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC))
+    {
+        start /= 512;
+        end /= 512;
+    }
+#endif
+
+    select_card();
+    if(sd_raw_send_command(CMD_ERASE_WR_BLK_START, start) ||
+       sd_raw_send_command(CMD_ERASE_WR_BLK_END, end) ||
+       sd_raw_send_command(CMD_ERASE, 0)
+      )
+    {
+        sd_raw_fail(SD_RAW_ERROR_COMMAND);
+        unselect_card();
+        return 0;
+    }
+
+    /* the card signals busy until the blocks are erased */
+    sd_raw_card_busy = 1;
+    sd_raw_busy_timeout = timeout;
+    unselect_card();
+
+    return 1;
+}
+#endif
+
+#if DOXYGEN || SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Fills a range of blocks with zeros by erasing them.
+ *
+ * This only works with cards whose erased blocks read as zeros, for
+ * any other the function fails and the caller has to write the zeros.
+ *
+ * \param[in] start The offset of the first block to clear, a multiple of 512.
+ * \param[in] end The offset following the last block to clear, a multiple of 512.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_erase
+ */
+uint8_t sd_raw_zero(offset_t start, offset_t end)
+{
+    if(!(sd_raw_card_type & (1 << SD_RAW_ERASE_ZERO)))
+        return 0;
+
+    return sd_raw_erase(start, end);
+}
 #endif
 
 /**
@@ -860,11 +1456,16 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
 
     /* read cid register */
     if(sd_raw_send_command(CMD_SEND_CID, 0))
+    {
+        sd_raw_fail(SD_RAW_ERROR_COMMAND);
+        unselect_card();
+        return 0;
+    }
+    if(!sd_raw_wait_data())
     {
         unselect_card();
         return 0;
     }
-    while(sd_raw_rec_byte() != 0xfe);
     for(uint8_t i = 0; i < 18; ++i)
     {
         uint8_t b = sd_raw_rec_byte();
@@ -908,21 +1509,46 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
     uint8_t csd_read_bl_len = 0;
     uint8_t csd_c_size_mult = 0;
 #if SD_RAW_SDHC
-    uint16_t csd_c_size = 0;
-#else
+    /* C_SIZE is 22 bits wide in CSD version 2.0 */
     uint32_t csd_c_size = 0;
+#else
+    uint16_t csd_c_size = 0;
 #endif
     uint8_t csd_structure = 0;
     if(sd_raw_send_command(CMD_SEND_CSD, 0))
+    {
+        sd_raw_fail(SD_RAW_ERROR_COMMAND);
+        unselect_card();
+        return 0;
+    }
+    if(!sd_raw_wait_data())
     {
         unselect_card();
         return 0;
     }
-    while(sd_raw_rec_byte() != 0xfe);
+    uint8_t csd_sector_size = 0;
+    uint8_t csd_write_bl_len = 0;
     for(uint8_t i = 0; i < 18; ++i)
     {
         uint8_t b = sd_raw_rec_byte();
 
+        /* erase sector, at the same place in both CSD versions */
+        switch(i)
+        {
+            case 10:
+                csd_sector_size = (b & 0x3f) << 1;
+                break;
+            case 11:
+                csd_sector_size |= b >> 7;
+                break;
+            case 12:
+                csd_write_bl_len = (b & 0x03) << 2;
+                break;
+            case 13:
+                csd_write_bl_len |= b >> 6;
+                break;
+        }
+
         if(i == 0)
         {
             csd_structure = b >> 6;
@@ -946,6 +1572,7 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
                 {
                     case 7:
                         b &= 0x3f;
+                        /* fall through */
                     case 8:
                     case 9:
                         csd_c_size <<= 8;
@@ -991,6 +1618,38 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
             }
         }
     }
+    if(csd_write_bl_len >= 9)
+        info->erase_sector = (uint16_t) (csd_sector_size + 1) << (csd_write_bl_len - 9);
+
+    /* read sd status for the allocation unit size */
+    if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
+    {
+        sd_raw_send_command(CMD_APP, 0);
+        if(sd_raw_send_command(CMD_SD_STATUS, 0) == 0)
+        {
+            /* second byte of the R2 response */
+            sd_raw_rec_byte();
+
+            uint8_t au_size = 0;
+            if(!sd_raw_wait_data())
+            {
+                unselect_card();
+                return 0;
+            }
+            for(uint8_t i = 0; i < 66; ++i)
+            {
+                uint8_t b = sd_raw_rec_byte();
+                if(i == 10)
+                    au_size = b >> 4;
+            }
+
+            /* 16 KiB doubling up to 4 MiB, then the SDXC sizes of 8 to 64 MiB */
+            if(au_size >= 1 && au_size <= 9)
+                info->au_size = (uint32_t) 16 << au_size;
+            else if(au_size >= 0x0a)
+                info->au_size = (uint32_t) pgm_read_byte(&sd_raw_au_sizes_mib[au_size - 0x0a]) * 2048;
+        }
+    }
 
     unselect_card();
 
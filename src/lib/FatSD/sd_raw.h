@@ -119,22 +119,72 @@ struct sd_raw_info
      * \note This value is not guaranteed to match reality.
      */
     uint8_t format;
+    /**
+     * The card's erase sector size in 512 byte blocks, from the CSD.
+     *
+     * The smallest unit the card erases, writes of whole sectors
+     * avoid a read-modify-write cycle within the card.
+     */
+    uint16_t erase_sector;
+    /**
+     * The card's allocation unit (AU) size in 512 byte blocks, from
+     * the SD status (ACMD13).
+     *
+     * Writes running sequentially through an AU are the ones the SD
+     * speed classes are specified for. A value of zero means the card
+     * did not report it, e.g. MMC and SD 1.x cards.
+     */
+    uint32_t au_size;
+};
+
+/**
+ * This struct is used by sd_raw_get_errors() to return the
+ * number of card failures since power up, by failure class.
+ */
+struct sd_raw_errors
+{
+    /**
+     * Commands the card did not answer or refused.
+     */
+    uint16_t command;
+    /**
+     * Data blocks which did not arrive in time, or busy periods
+     * which did not end in time.
+     */
+    uint16_t timeout;
+    /**
+     * Data error tokens received and written blocks the card
+     * rejected, e.g. because of a CRC error.
+     */
+    uint16_t data;
+    /**
+     * Failed attempts to initialize the card.
+     */
+    uint16_t init;
 };
 
 typedef uint8_t (*sd_raw_read_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 typedef uintptr_t (*sd_raw_write_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 
 uint8_t sd_raw_init();
+uint8_t sd_raw_reinit();
+uint8_t sd_raw_failed();
 uint8_t sd_raw_available();
 uint8_t sd_raw_locked();
+uint8_t sd_raw_busy();
 
 uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length);
 uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interval, uintptr_t length, sd_raw_read_interval_handler_t callback, void* p);
 uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length);
 uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length, sd_raw_write_interval_handler_t callback, void* p);
 uint8_t sd_raw_sync();
+uint8_t sd_raw_flush();
+uint8_t sd_raw_write_run(offset_t offset, uint32_t blocks);
+uint8_t sd_raw_erase(offset_t start, offset_t end);
+uint8_t sd_raw_zero(offset_t start, offset_t end);
 
 uint8_t sd_raw_get_info(struct sd_raw_info* info);
+void sd_raw_get_errors(struct sd_raw_errors* errors);
 
 /**
  * @}
@@ -12,6 +12,7 @@
 #define SD_RAW_CONFIG_H
 
 #include <stdint.h>
+#include "umeter_spi.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -63,9 +64,16 @@ extern "C"
  * Controls support for SDHC cards.
  *
  * Set to 1 to support so-called SDHC memory cards, i.e. SD
- * cards with more than 2 gigabytes of memory.
+ * cards with more than 2 gigabytes of memory. This also
+ * enables FAT32 support, see FAT_FAT32_SUPPORT.
+ *
+ * May be overridden from the makefile (SDHC = 0) for a
+ * smaller build restricted to standard capacity cards and
+ * FAT16.
  */
-#define SD_RAW_SDHC 0
+#ifndef SD_RAW_SDHC
+#define SD_RAW_SDHC 1
+#endif
 
 /**
  * @}
@@ -105,8 +113,9 @@ extern "C"
     #define configure_pin_ss() DDRB |= (1 << DDB0)
     #define configure_pin_miso() DDRB &= ~(1 << DDB3)
 
-    #define select_card() PORTB &= ~(1 << PORTB0)
-    #define unselect_card() PORTB |= (1 << PORTB0)
+    /* the card shares the bus with other SPI devices, see umeter_spi.h */
+    #define select_card() do { spi_card_selected = 1; PORTB &= ~(1 << PORTB0); } while(0)
+    #define unselect_card() do { PORTB |= (1 << PORTB0); spi_card_selected = 0; } while(0)
 #else
     #error "no sd/mmc pin mapping available!"
 #endif
@@ -0,0 +1,155 @@
+#include "umeter_cardtest.h"
+
+#include "lib/Timer/umeter_clock.h"
+
+// Card self-benchmark.
+//
+// Times the card on a scratch region whose content is lost: sequential
+// single block reads, sequential single block writes, one multiple block
+// write over the whole region and single block writes to random blocks.
+// Each single block write is timed on its own from sending the block until
+// the card is ready again, which is how long a record completing a block can
+// hold up the next sample. The block is read into the cache of sd_raw before
+// it is timed, so the write is not preceded by a read (see sd_raw_write()).
+//
+// Times are taken with the millisecond clock; a single write shorter than a
+// tick is counted as 0 or 1 ms depending on where it falls, which averages
+// out over many writes.
+
+// Pieces the blocks are written in, any buffer does since sd_raw caches one
+// block.
+static uint8_t pattern[16];
+
+static uint32_t cardtest_elapsed(uint32_t start)
+{
+	uint32_t ms = clock_ms() - start;
+	return ms ? ms : 1;
+}
+
+// KiB/s of 'blocks' blocks transferred in 'ms'.
+static uint16_t cardtest_rate(uint32_t blocks, uint32_t ms)
+{
+	uint32_t rate = blocks * 500 / ms;
+	return rate > UINT16_MAX ? UINT16_MAX : rate;
+}
+
+// Wait for the card to program the blocks written.
+static uint8_t cardtest_wait(void)
+{
+	uint32_t start = clock_ms();
+
+	while(sd_raw_busy()) {
+		if(clock_ms() - start >= CARDTEST_TIMEOUT) {
+			return 0;
+		}
+	}
+	return !sd_raw_failed();
+}
+
+// Fill the block at 'offset', the data goes to the card with the next sync.
+static uint8_t cardtest_fill(offset_t offset)
+{
+	uint8_t i;
+
+	for(i = 0; i < sizeof(pattern); i++) {
+		pattern[i] = (uint8_t)(offset >> 9) + i;
+	}
+	for(i = 0; i < 512 / sizeof(pattern); i++) {
+		if(!sd_raw_write(offset + i * sizeof(pattern), pattern, sizeof(pattern))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Write the block at 'offset' with a single block write, '*ms' is the time
+// until the card was ready again. Returns 0 if the card failed.
+static uint8_t cardtest_write_block(offset_t offset, uint32_t* ms)
+{
+	uint32_t start;
+
+	if(!sd_raw_read(offset, pattern, sizeof(pattern))) {
+		return 0;
+	}
+	start = clock_ms();
+	if(!cardtest_fill(offset) || !sd_raw_sync() || !cardtest_wait()) {
+		return 0;
+	}
+	*ms = clock_ms() - start;
+	return 1;
+}
+
+// Benchmark the card on the 'length' bytes from 'start', a multiple of 512.
+// Their content is lost. Returns 0 if the card failed.
+uint8_t cardtest_run(offset_t start, uint32_t length, cardtest_result* result)
+{
+	uint32_t blocks = length / 512;
+	uint32_t i, t, ms, total;
+	uint16_t random = 1;
+
+	if(blocks < CARDTEST_WRITES) {
+		return 0;
+	}
+
+	// single block writes, one after the other
+	total = 0;
+	result->latency_max = 0;
+	for(i = 0; i < CARDTEST_WRITES; i++) {
+		if(!cardtest_write_block(start + i * 512, &t)) {
+			return 0;
+		}
+		if(t > result->latency_max) {
+			result->latency_max = t > UINT16_MAX ? UINT16_MAX : t;
+		}
+		total += t;
+	}
+	ms = total ? total : 1;
+	result->write_rate = cardtest_rate(CARDTEST_WRITES, ms);
+	t = total * 1000 / CARDTEST_WRITES;
+	result->latency_mean = t > UINT16_MAX ? UINT16_MAX : t;
+
+	// the same to random blocks
+	total = 0;
+	for(i = 0; i < CARDTEST_WRITES; i++) {
+		random ^= random << 7;		// xorshift
+		random ^= random >> 9;
+		random ^= random << 8;
+		if(!cardtest_write_block(start + (random % blocks) * 512, &t)) {
+			return 0;
+		}
+		total += t;
+	}
+	ms = total ? total : 1;
+	result->iops = CARDTEST_WRITES * 1000UL / ms;
+
+	// sequential single block reads
+	t = clock_ms();
+	for(i = 0; i < blocks; i++) {
+		if(!sd_raw_read(start + i * 512, pattern, sizeof(pattern))) {
+			return 0;
+		}
+	}
+	result->read_rate = cardtest_rate(blocks, cardtest_elapsed(t));
+
+	// one multiple block write over the whole region
+	t = clock_ms();
+	if(!sd_raw_write_run(start, blocks)) {
+		return 0;
+	}
+	for(i = 0; i < blocks; i++) {
+		if(!cardtest_fill(start + i * 512)) {
+			sd_raw_write_run(0, 0);
+			return 0;
+		}
+	}
+	if(!sd_raw_sync() || !sd_raw_write_run(0, 0) || !cardtest_wait()) {
+		return 0;
+	}
+	result->run_rate = cardtest_rate(blocks, cardtest_elapsed(t));
+
+	// a record completing a block may also commit the size of the log file,
+	// two single block writes before the next sample
+	t = 2UL * result->latency_max;
+	result->min_interval = t > UINT16_MAX ? UINT16_MAX : t;
+	return 1;
+}
@@ -0,0 +1,28 @@
+#ifndef __UMETER_CARDTEST_H__
+#define __UMETER_CARDTEST_H__
+
+#include <stdint.h>
+
+#include "sd_raw.h"
+
+#define CARDTEST_FILE		"cardtest.dat"	// scratch region, deleted after the test
+#define CARDTEST_REPORT		"cardtest.txt"
+#define CARDTEST_SIZE		(128 * 1024UL)	// bytes of scratch region used
+#define CARDTEST_WRITES		64				// single block writes timed
+#define CARDTEST_TIMEOUT	1000			// ms a write may keep the card busy
+
+// What the card managed, all rates in KiB/s.
+typedef struct
+{
+	uint16_t read_rate;			// sequential single block reads
+	uint16_t write_rate;		// sequential single block writes, each waited for
+	uint16_t run_rate;			// one multiple block write over the scratch region
+	uint16_t latency_max;		// ms of the slowest single block write until the card was ready
+	uint16_t latency_mean;		// us, mean over CARDTEST_WRITES writes
+	uint16_t iops;				// single block writes per second to random blocks
+	uint16_t min_interval;		// ms, shortest sampling interval the card keeps up with
+} cardtest_result;
+
+uint8_t cardtest_run(offset_t start, uint32_t length, cardtest_result* result);
+
+#endif
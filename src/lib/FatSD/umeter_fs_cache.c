@@ -0,0 +1,185 @@
+#include "umeter_fs_cache.h"
+
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+// Mounted file system cache.
+//
+// The layout of the file system found on the card is kept in EEPROM
+// together with the CID of the card it was found on, so that the next boot
+// with the same card can mount it without reading the MBR and searching
+// the root directory for umeter.txt. The cache is dropped as soon as the
+// host writes to the card over USB; formatting the card in a reader is
+// caught by the volume serial, changes to umeter.txt by re-reading its
+// directory entry.
+//
+// Every commit of the size of umeter.txt also leaves a checkpoint of where
+// the file ends, so that the next boot can append to it without following
+// its cluster chain. Checkpoints go round a ring of slots to spread the
+// EEPROM wear; each commit rewrites only one slot, 100000 cycles per cell
+// last for 1.6 million commits. The newest slot is the one not followed by
+// its successor in sequence.
+
+typedef struct
+{
+	uint8_t version;		// FS_CACHE_VERSION, 0xFF when erased or invalidated
+	uint8_t length;			// sizeof(fs_cache_entry)
+	uint8_t manufacturer;	// CID of the card
+	uint8_t oem[3];
+	uint8_t product[6];
+	uint8_t revision;
+	uint32_t serial;
+	uint8_t generation;		// incremented with every new entry
+	uint16_t crc;			// CRC16 of the cached entry
+} fs_cache_header;
+
+#define CHECKPOINT_SLOTS	16
+
+typedef struct
+{
+	uint8_t seq;			// one more than in the slot before
+	uint8_t generation;		// of the cached entry the checkpoint belongs to
+	log_checkpoint checkpoint;
+	uint8_t crc;			// CRC8 of the above
+} checkpoint_slot;
+
+static fs_cache_header EEMEM cache_header;
+static fs_cache_entry EEMEM cache_entry;
+static checkpoint_slot EEMEM checkpoint_ring[CHECKPOINT_SLOTS];
+
+static uint16_t entry_crc(fs_cache_entry const* entry)
+{
+	const uint8_t* p = (const uint8_t*)entry;
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+	for(i = 0; i < sizeof(*entry); i++) {
+		crc = _crc16_update(crc, p[i]);
+	}
+	return crc;
+}
+
+static void card_id(fs_cache_header* hdr, const struct sd_raw_info* card)
+{
+	hdr->manufacturer = card->manufacturer;
+	memcpy(hdr->oem, card->oem, sizeof(hdr->oem));
+	memcpy(hdr->product, card->product, sizeof(hdr->product));
+	hdr->revision = card->revision;
+	hdr->serial = card->serial;
+}
+
+// Fill 'entry' from the cache if it was stored for the given card. Returns
+// 1 on a hit, 0 if the file system has to be mounted from scratch.
+uint8_t fs_cache_load(fs_cache_entry* entry, const struct sd_raw_info* card)
+{
+	fs_cache_header hdr, id;
+
+	eeprom_read_block(&hdr, &cache_header, sizeof(hdr));
+	card_id(&id, card);
+	if(hdr.version != FS_CACHE_VERSION || hdr.length != sizeof(fs_cache_entry) ||
+	   hdr.manufacturer != id.manufacturer || memcmp(hdr.oem, id.oem, sizeof(id.oem)) ||
+	   memcmp(hdr.product, id.product, sizeof(id.product)) ||
+	   hdr.revision != id.revision || hdr.serial != id.serial) {
+		return 0;
+	}
+	eeprom_read_block(entry, &cache_entry, sizeof(*entry));
+	return entry_crc(entry) == hdr.crc;
+}
+
+// Remember 'entry' for the given card. The EEPROM is left alone if it
+// holds the same already, as it does on every boot after the first.
+void fs_cache_store(const fs_cache_entry* entry, const struct sd_raw_info* card)
+{
+	fs_cache_header hdr;
+	fs_cache_entry cached;
+
+	if(fs_cache_load(&cached, card) && !memcmp(&cached, entry, sizeof(cached))) {
+		return;
+	}
+
+	// invalidate first so that a reset halfway through leaves no stale hit
+	fs_cache_invalidate();
+	eeprom_update_block(entry, &cache_entry, sizeof(*entry));
+
+	card_id(&hdr, card);
+	hdr.version = 0xFF;
+	hdr.length = sizeof(fs_cache_entry);
+	// checkpoints of the file system cached before don't apply anymore
+	hdr.generation = eeprom_read_byte(&cache_header.generation) + 1;
+	hdr.crc = entry_crc(entry);
+	eeprom_update_block(&hdr, &cache_header, sizeof(hdr));
+	eeprom_write_byte(&cache_header.version, FS_CACHE_VERSION);
+}
+
+void fs_cache_invalidate(void)
+{
+	eeprom_update_byte(&cache_header.version, 0xFF);
+}
+
+static uint8_t slot_crc(checkpoint_slot const* slot)
+{
+	const uint8_t* p = (const uint8_t*)slot;
+	uint8_t crc = 0xFF;	// so that neither an erased nor a zeroed slot is valid
+	uint8_t i;
+	for(i = 0; i < sizeof(*slot) - 1; i++) {
+		crc = _crc_ibutton_update(crc, p[i]);
+	}
+	return crc;
+}
+
+// Index of the newest valid slot, copied to 'newest', or CHECKPOINT_SLOTS
+// if no slot is valid.
+static uint8_t newest_slot(checkpoint_slot* newest)
+{
+	checkpoint_slot slot, next;
+	uint8_t i;
+
+	eeprom_read_block(&next, &checkpoint_ring[0], sizeof(next));
+	for(i = 0; i < CHECKPOINT_SLOTS; i++) {
+		slot = next;
+		eeprom_read_block(&next, &checkpoint_ring[(i + 1) % CHECKPOINT_SLOTS], sizeof(next));
+		if(slot_crc(&slot) == slot.crc &&
+		   (slot_crc(&next) != next.crc || next.seq != (uint8_t)(slot.seq + 1))) {
+			*newest = slot;
+			return i;
+		}
+	}
+	return CHECKPOINT_SLOTS;
+}
+
+// Fill 'checkpoint' with the newest checkpoint taken on the cached file
+// system. Returns 0 if there is none.
+uint8_t fs_cache_load_checkpoint(log_checkpoint* checkpoint)
+{
+	checkpoint_slot slot;
+
+	if(eeprom_read_byte(&cache_header.version) != FS_CACHE_VERSION ||
+	   newest_slot(&slot) == CHECKPOINT_SLOTS ||
+	   slot.generation != eeprom_read_byte(&cache_header.generation)) {
+		return 0;
+	}
+	*checkpoint = slot.checkpoint;
+	return 1;
+}
+
+// Write 'checkpoint' to the slot after the newest one. A reset halfway
+// through leaves a slot with a bad CRC, so the one before stays the newest.
+void fs_cache_store_checkpoint(const log_checkpoint* checkpoint)
+{
+	checkpoint_slot slot;
+	uint8_t i;
+
+	i = newest_slot(&slot);
+	if(i == CHECKPOINT_SLOTS) {
+		i = 0;
+		slot.seq = 0;
+	}
+	else {
+		i = (i + 1) % CHECKPOINT_SLOTS;
+		slot.seq++;
+	}
+	slot.generation = eeprom_read_byte(&cache_header.generation);
+	slot.checkpoint = *checkpoint;
+	slot.crc = slot_crc(&slot);
+	eeprom_update_block(&slot, &checkpoint_ring[i], sizeof(slot));
+}
@@ -0,0 +1,37 @@
+#ifndef __UMETER_FS_CACHE_H__
+#define __UMETER_FS_CACHE_H__
+
+#include <stdint.h>
+
+#include "fat.h"
+#include "sd_raw.h"
+
+// bump whenever the meaning of fs_cache_entry changes without its size changing
+#define FS_CACHE_VERSION	2
+
+// Where the file system and umeter.txt were found on the card last time.
+typedef struct
+{
+	uint8_t partition_type;				// PARTITION_TYPE_FAT16 or PARTITION_TYPE_FAT32
+	uint32_t partition_offset;			// in blocks, 0 for a card without MBR
+	uint32_t partition_length;
+	uint32_t volume_serial;				// changes whenever the card is formatted
+	struct fat_header_struct header;
+	offset_t log_entry_offset;			// directory entry of umeter.txt, 0 if unknown
+} fs_cache_entry;
+
+// Where umeter.txt ended when its size was last committed.
+typedef struct
+{
+	cluster_t cluster;					// cluster holding the end, see fat_get_file_cluster()
+	uint32_t size;						// size in the directory entry
+} log_checkpoint;
+
+uint8_t fs_cache_load(fs_cache_entry* entry, const struct sd_raw_info* card);
+void fs_cache_store(const fs_cache_entry* entry, const struct sd_raw_info* card);
+void fs_cache_invalidate(void);
+
+uint8_t fs_cache_load_checkpoint(log_checkpoint* checkpoint);
+void fs_cache_store_checkpoint(const log_checkpoint* checkpoint);
+
+#endif
@@ -0,0 +1,149 @@
+#include "umeter_manifest.h"
+
+#include <string.h>
+#include <util/crc16.h>
+
+// Manifest of umeter.txt.
+//
+// Every time the size of umeter.txt is committed, the records appended since
+// are listed in umeter.man with where they are on the card and their CRC, so
+// a host can fetch just the new part of the log with raw block reads instead
+// of copying the whole file (see tools/log_sync.c). A piece is also listed
+// when the log continues in another cluster, so an entry never spans two.
+//
+// umeter.man is a contiguous region of the card which is written directly,
+// its size in the directory entry never changes. Records which don't make it
+// into an entry (taken back after a power failure, or when the card position
+// of the file isn't known) leave a gap, the host reads those through the
+// file system.
+
+static offset_t manifest_start;		// card offset of the entries, 0 without a manifest
+static uint16_t manifest_slots;		// entries in the ring
+static uint16_t manifest_next;		// slot of the next entry
+static uint32_t manifest_seq;		// of the last entry written
+static uint16_t manifest_cluster_size;
+
+static manifest_entry pending;		// records not listed yet, length 0 if none
+static offset_t pending_card;		// card offset of pending.offset
+
+// Take over the manifest at 'start', 'length' bytes of entries. The next
+// entry follows the one written last.
+uint8_t manifest_open(offset_t start, uint32_t length, uint16_t cluster_size)
+{
+	manifest_entry entry;
+	uint16_t i;
+
+	manifest_start = 0;
+	pending.length = 0;
+	if(length / sizeof(entry) > UINT16_MAX) {
+		length = UINT16_MAX * sizeof(entry);
+	}
+	manifest_slots = length / sizeof(entry);
+	manifest_next = 0;
+	manifest_seq = 0;
+	manifest_cluster_size = cluster_size;
+	if(!manifest_slots) {
+		return 0;
+	}
+	for(i = 0; i < manifest_slots; i++) {
+		if(!sd_raw_read(start + (offset_t)i * sizeof(entry), (uint8_t*)&entry, sizeof(entry))) {
+			return 0;
+		}
+		if(entry.seq > manifest_seq) {
+			manifest_seq = entry.seq;
+			manifest_next = i + 1 < manifest_slots ? i + 1 : 0;
+		}
+	}
+	manifest_start = start;
+	return 1;
+}
+
+// Zero the 'length' bytes of a new manifest at 'start', a multiple of 512.
+uint8_t manifest_clear(offset_t start, uint32_t length)
+{
+	uint8_t zero[16];
+	uint32_t i;
+
+	length &= ~511UL;
+	if(sd_raw_zero(start, start + length)) {
+		return 1;
+	}
+	memset(zero, 0, sizeof(zero));
+	for(i = 0; i < length; i += sizeof(zero)) {
+		if(!sd_raw_write(start + i, zero, sizeof(zero))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Add the 'length' bytes at 'data', written to 'offset' of umeter.txt at
+// 'card', to the pending entry. A piece which doesn't continue it starts the
+// next.
+static void manifest_add(uint32_t offset, offset_t card, const uint8_t* data, uint16_t length)
+{
+	uint16_t i;
+
+	if(pending.length &&
+	   (offset != pending.offset + pending.length || card != pending_card + pending.length ||
+	    pending.length + length > UINT16_MAX)) {
+		manifest_commit();
+	}
+	if(!pending.length) {
+		pending.offset = offset;
+		pending.crc = 0xFFFF;
+		pending_card = card;
+	}
+	for(i = 0; i < length; i++) {
+		pending.crc = _crc16_update(pending.crc, data[i]);
+	}
+	pending.length += length;
+}
+
+// Write 'length' bytes to umeter.txt like fat_write_file() does and keep
+// track of where they went on the card. 'length' is less than a cluster, so
+// they go to at most two clusters.
+intptr_t manifest_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uint16_t length)
+{
+	int32_t pos = 0;
+	offset_t card;
+	uint16_t extent, first = 0;
+	uint8_t known;
+	intptr_t n;
+
+	// the cluster of the file position isn't known on a cluster boundary
+	known = fat_seek_file(fd, &pos, FAT_SEEK_CUR) && fat_get_file_extent(fd, &card, &extent);
+	n = fat_write_file(fd, buffer, length);
+	if(!manifest_start || n <= 0) {
+		return n;
+	}
+	if(known) {
+		first = (uint16_t)n < extent ? (uint16_t)n : extent;
+		manifest_add(pos, card, buffer, first);
+	}
+	// the rest starts the next cluster
+	if(first < n && fat_get_file_extent(fd, &card, &extent) &&
+	   manifest_cluster_size - extent == (uint16_t)n - first) {
+		manifest_add(pos + first, card - (n - first), buffer + first, n - first);
+	}
+	return n;
+}
+
+// List the pending records in umeter.man. Returns 0 if the card failed.
+uint8_t manifest_commit(void)
+{
+	if(!manifest_start || !pending.length) {
+		return 1;
+	}
+	pending.seq = ++manifest_seq;
+	pending.block = pending_card / 512;
+	if(!sd_raw_write(manifest_start + (offset_t)manifest_next * sizeof(pending), (uint8_t*)&pending, sizeof(pending))) {
+		pending.length = 0;
+		return 0;
+	}
+	if(++manifest_next == manifest_slots) {
+		manifest_next = 0;
+	}
+	pending.length = 0;
+	return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef __UMETER_MANIFEST_H__
+#define __UMETER_MANIFEST_H__
+
+#include <stdint.h>
+
+#include "fat.h"
+#include "sd_raw.h"
+
+#define MANIFEST_FILE		"umeter.man"
+#define MANIFEST_SIZE		(16 * 1024UL)	// bytes of entries, rounded up to whole clusters
+
+// A piece of umeter.txt stored contiguously on the card. The entries of
+// umeter.man are a ring: the one with the highest seq was written last and
+// is followed by the oldest. Unused entries are zero.
+typedef struct
+{
+	uint32_t seq;			// numbered from 1 in the order written
+	uint32_t offset;		// in umeter.txt
+	uint32_t block;			// card block holding the byte at 'offset'
+	uint16_t length;		// bytes
+	uint16_t crc;			// _crc16_update() over them, starting from 0xFFFF
+} manifest_entry;
+
+uint8_t manifest_open(offset_t start, uint32_t length, uint16_t cluster_size);
+uint8_t manifest_clear(offset_t start, uint32_t length);
+intptr_t manifest_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uint16_t length);
+uint8_t manifest_commit(void);
+
+#endif
@@ -0,0 +1,54 @@
+#include "umeter_spi.h"
+
+#include <avr/io.h>
+
+// SPI bus arbitration.
+//
+// The card and other SPI devices (see umeter_mcp3208.h) share MOSI, MISO and
+// SCK, each with a chip select of its own. sd_raw owns the bus from
+// select_card() to unselect_card(), which it never leaves in between a
+// command and its response or in the middle of a block, so another device
+// is addressed only between two card transfers. spi_acquire() refuses the
+// bus while the card is selected.
+//
+// Each device gets its own SPCR, i.e. clock polarity, phase and divider, for
+// the transaction, spi_release() puts back the card's. SPI2X is left as the
+// card set it (on once the card is initialized), so SPR1:0 divide F_CPU by
+// 2, 8, 32 or 64. SD cards may keep driving MISO after their chip select
+// went high until they see another clock, so one byte is clocked out with
+// nothing selected before the bus is handed over.
+
+volatile uint8_t spi_card_selected;
+
+static uint8_t card_spcr;
+
+// Take over the bus with the settings 'spcr' (SPE and MSTR included).
+// Returns 0 if the card is in the middle of a transfer. The caller selects
+// its device afterwards.
+uint8_t spi_acquire(uint8_t spcr)
+{
+	if(spi_card_selected) {
+		return 0;
+	}
+	spi_transfer(0xff);		// let the card release MISO
+	card_spcr = SPCR;
+	SPCR = spcr;
+	return 1;
+}
+
+// Hand the bus back to the card, after the device was deselected.
+void spi_release(void)
+{
+	SPCR = card_spcr;
+}
+
+// Send 'b' and return the byte received meanwhile.
+uint8_t spi_transfer(uint8_t b)
+{
+	SPDR = b;
+	while(!(SPSR & (1 << SPIF))) {
+		;
+	}
+	SPSR &= ~(1 << SPIF);
+	return SPDR;
+}
@@ -0,0 +1,13 @@
+#ifndef __UMETER_SPI_H__
+#define __UMETER_SPI_H__
+
+#include <stdint.h>
+
+// set while sd_raw has the card selected, see select_card()
+extern volatile uint8_t spi_card_selected;
+
+uint8_t spi_acquire(uint8_t spcr);
+void spi_release(void);
+uint8_t spi_transfer(uint8_t b);
+
+#endif
@@ -20,7 +20,16 @@ http://code.google.com/p/inih/
 #define MAX_SECTION 50
 #define MAX_NAME 50
 
-int fat_read_line(struct fat_file_struct* fd, uint8_t* buffer, uint8_t buffer_len);
+/* Forward-only line reader over a small refillable window of the file. */
+typedef struct
+{
+	struct fat_file_struct* fd;
+	uint8_t buffer[INI_READ_BUFFER];
+	uint8_t pos;	// next unread byte in buffer
+	uint8_t len;	// valid bytes in buffer
+} ini_reader;
+
+static int ini_read_line(ini_reader* reader, char* line, int line_len);
 
 /* Strip whitespace chars off end of given string, in place. Return s. */
 static char* rstrip(char* s)
@@ -81,6 +90,7 @@ int ini_parse_file(struct fat_file_struct* file,
     char* value;
     int lineno = 0;
     int error = 0;
+    ini_reader reader;
 
 #if !INI_USE_STACK
     line = (unsigned char*)malloc(INI_MAX_LINE);
@@ -91,10 +101,12 @@ int ini_parse_file(struct fat_file_struct* file,
 #if INI_DEBUG
 	printf("reading ini file...\r\n");
 #endif
+    reader.fd = file;
+    reader.pos = 0;
+    reader.len = 0;
+
     /* Scan through file line by line */
-    //while ( (error = fat_read_file(file, line, sizeof(line))) > 0) {
-		//line[error] = '\0';
-	while(fat_read_line(file, line, sizeof(line)) > 0) {
+	while(ini_read_line(&reader, line, INI_MAX_LINE) > 0) {
 #if INI_DEBUG
 		printf("read: '%s'\r\n", line);
 #endif
@@ -181,52 +193,40 @@ int ini_parse_file(struct fat_file_struct* file,
     return error;
 }
 
-// reads a file from the SD card one line at a time
-int fat_read_line(struct fat_file_struct* fd, uint8_t* buffer, uint8_t buffer_len)
+// Reads the next line of the file into 'line', including the newline, and
+// returns the number of bytes it took up in the file (0 on EOF). The file is
+// only ever read forward in INI_READ_BUFFER sized chunks, so the cluster chain
+// is walked once for the whole parse. Lines longer than line_len - 1 are cut,
+// their remainder is skipped.
+static int ini_read_line(ini_reader* reader, char* line, int line_len)
 {
-	char internal[INI_MAX_LINE];
-	int bytesRead, bytesToCopy;
-	int32_t offset;
-	char* pchar;
-	
-	bytesRead = fat_read_file(fd, internal, INI_MAX_LINE);
-#if INI_DEBUG	
-	printf("read_line start: bytesRead=%d\r\n", bytesRead);
-#endif
-	if(bytesRead > 0) { // 0 on EOF, bytes read for >0
-		pchar = strchr(internal, '\n'); // return a pointer to the first newline
-		if(pchar) { // if newline found, compute byte number for matching char
-			bytesToCopy = pchar - internal + 1;
+	int consumed = 0, copied = 0;
+	intptr_t bytesRead;
+	char c;
+
+	for(;;) {
+		if(reader->pos == reader->len) { // window used up, refill it
+			bytesRead = fat_read_file(reader->fd, reader->buffer, sizeof(reader->buffer));
+			if(bytesRead <= 0) { // EOF
+				break;
+			}
+			reader->pos = 0;
+			reader->len = bytesRead;
 		}
-		else { // if newline not found, copy all the bytes read
-			bytesToCopy = bytesRead;
+		c = reader->buffer[reader->pos++];
+		consumed++;
+		if(copied < line_len - 1) {
+			line[copied++] = c;
 		}
-		if(bytesToCopy > buffer_len) {
-			// warn user or exit?
-			bytesToCopy = buffer_len;
+		if(c == '\n') {
+			break;
 		}
-		// copy the bytes to the destination buffer
-		strncpy0(buffer, internal, bytesToCopy);
-
-		// seek backwards from current file pointer to end of copied text
-		offset = bytesToCopy - bytesRead;
-		//offset = bytesToCopy;
-#if INI_DEBUG		
-		printf(	"offset=%d, bytesRead=%d, bytesToCopy=%d\r\n", 
-				(int)offset, bytesRead, bytesToCopy);
-#endif
-		if(!fat_seek_file(fd, &offset, FAT_SEEK_CUR)) {
-		//if(!fat_seek_file(fd, &offset, FAT_SEEK_SET)) {
-#if INI_DEBUG			
-			printf("fat_seek_file: failure\r\n");
-#endif
-		}
-#if INI_DEBUG		
-		printf("after seek: offset=%d\r\n", offset);
-#endif
-		return bytesToCopy;
 	}
-	return bytesRead;
+	line[copied] = '\0';
+#if INI_DEBUG
+	printf("read_line: consumed=%d, copied=%d\r\n", consumed, copied);
+#endif
+	return consumed;
 }
 
 
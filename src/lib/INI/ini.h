@@ -72,6 +72,11 @@ int ini_parse_file(struct fat_file_struct* file,
 #define INI_MAX_LINE 200
 #endif
 
+/* Bytes read from the file at a time while scanning for lines. */
+#ifndef INI_READ_BUFFER
+#define INI_READ_BUFFER 32
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,9 +4,16 @@
 #include <stdlib.h>
 #include <avr/pgmspace.h>
 #include <avr/sleep.h>
+#include <util/crc16.h>
 
 #include "ini.h"
+#include "umeter_ini_cache.h"
 #include "lib/Inputs/umeter_adc.h"
+#include "lib/Inputs/umeter_delta.h"
+#include "lib/Inputs/umeter_stats.h"
+#include "lib/Inputs/umeter_table.h"
+#include "lib/Inputs/umeter_sensor.h"
+#include "lib/Inputs/umeter_mcp3208.h"
 
 static umeter_config umeter;
 
@@ -33,6 +40,96 @@ static int ini_handler(void* user,
 		else {
 			InvalidValue = 1;
 		}
+    } else if (MATCH("UMeter", "format")) {
+		if(strcmp(value, "text") == 0) {
+			pconfig->format = FORMAT_TEXT;
+		} else if(UMETER_DELTA && strcmp(value, "delta") == 0) {
+			pconfig->format = FORMAT_DELTA;
+		}
+		else {
+			InvalidValue = 1;
+		}
+    } else if (MATCH("UMeter", "verbosity")) {
+		x = atoi(value);
+		if(x <= LOG_DEBUG) {
+			pconfig->verbosity = x;
+		}
+		else {
+			InvalidValue = 1;
+		}
+    } else if (MATCH("UMeter", "sync_blocks")) {
+		x = atoi(value);
+		if(x >= 1 && x <= SYNC_BLOCKS_MAX) {
+			pconfig->sync_blocks = x;
+		}
+		else {
+			InvalidValue = 1;
+		}
+    } else if (MATCH("UMeter", "cardtest")) {
+		pconfig->cardtest = atoi(value);
+    } else if (MATCH("UMeter", "manifest")) {
+		pconfig->manifest = atoi(value);
+    } else if (strcmp(section, "Trigger") == 0) {
+		if(strcmp(name,"enabled") == 0) {
+			x = atoi(value);
+			if(UMETER_TRIGGER || !x) {
+				pconfig->trigger.enabled = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"sensor") == 0) {
+			x = atoi(value);
+			if(x >= 1 && x <= 4) {
+				pconfig->trigger.sensor = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"edge") == 0) {
+			if(strcmp(value,"rising") == 0) {
+				pconfig->trigger.edge = TRIGGER_RISING;
+			} else if(strcmp(value,"falling") == 0) {
+				pconfig->trigger.edge = TRIGGER_FALLING;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"level") == 0) {
+			// in millivolts until the trigger sensor's ADC is known,
+			// a negative value would wrap around
+			y = atof(value);
+			if(y >= 0 && y <= TRIGGER_VOLTS_MAX) {
+				pconfig->trigger.level = y * 1000 + 0.5;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"hysteresis") == 0) {
+			y = atof(value);
+			if(y >= 0 && y <= TRIGGER_VOLTS_MAX) {
+				pconfig->trigger.hysteresis = y * 1000 + 0.5;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"pre") == 0) {
+			x = atoi(value);
+			if(x < TRIGGER_RING_SIZE) {
+				pconfig->trigger.pre = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"post") == 0) {
+			x = atoi(value);
+			if(x < TRIGGER_RING_SIZE) {
+				pconfig->trigger.post = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		}
     } else if (strcmp(section, "Sensor 1") == 0) {
 		sensor_idx = sensor1;
     } else if (strcmp(section, "Sensor 2") == 0) {
@@ -47,8 +144,43 @@ static int ini_handler(void* user,
 			pconfig->sensors[sensor_idx].enabled = atoi(value);
 		} else if(strcmp(name,"raw_output") == 0) {
 			pconfig->sensors[sensor_idx].raw_output = atoi(value);
+		} else if(strcmp(name,"adc") == 0) {
+			if(strcmp(value, "internal") == 0) {
+				pconfig->sensors[sensor_idx].adc = ADC_INTERNAL;
+			} else if(strncmp(value, "mcp3208:", 8) == 0 && value[8] >= '0' &&
+			          value[8] < '0' + MCP3208_CHANNELS && !value[9]) {
+				pconfig->sensors[sensor_idx].adc = ADC_MCP3208 + value[8] - '0';
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"interval") == 0) {
+			x = atoi(value);
+			if(x == 0 || (x >= SAMPLING_MIN && x <= SAMPLING_MAX)) {
+				pconfig->sensors[sensor_idx].interval = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"window") == 0) {
+			x = atoi(value);
+			if(x >= 1 && x <= STATS_WINDOW_MAX) {
+				pconfig->sensors[sensor_idx].window = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
+		} else if(strcmp(name,"stats") == 0) {
+			x = stats_parse(value);
+			if(x) {
+				pconfig->sensors[sensor_idx].stats = x;
+			}
+			else {
+				InvalidValue = 1;
+			}
 		} else if(strcmp(name,"units") == 0) {
-			pconfig->sensors[sensor_idx].units = strdup(value);
+			strncpy(pconfig->sensors[sensor_idx].units, value, sizeof(pconfig->sensors[sensor_idx].units) - 1);
+			pconfig->sensors[sensor_idx].units[sizeof(pconfig->sensors[sensor_idx].units) - 1] = '\0';
 		} else if(strcmp(name,"offset") == 0) {
 			pconfig->sensors[sensor_idx].offset = atof(value);
 		} else if(strcmp(name,"slope") == 0) {
@@ -59,6 +191,12 @@ static int ini_handler(void* user,
 			else {
 				InvalidValue = 1;
 			}
+		} else if(strcmp(name,"table") == 0) {
+			// compiled for the sensor's ADC once the whole file is parsed
+			if(!table_parse(&pconfig->sensors[sensor_idx], value)) {
+				pconfig->sensors[sensor_idx].table = 0;
+				InvalidValue = 1;
+			}
 		}
 	}
 // 	if(0) {
@@ -71,34 +209,136 @@ static int ini_handler(void* user,
     return 1;
 }
 
-const umeter_config const* get_umeter_ini(struct fat_fs_struct* fs, struct fat_dir_struct* dir)
+// CRC16 and size of a whole file, read sequentially from its start
+static uint16_t ini_file_crc(struct fat_file_struct* fd, uint32_t* size)
+{
+	uint8_t buff[32];
+	uint16_t crc = 0xFFFF;
+	intptr_t n, i;
+
+	*size = 0;
+	while((n = fat_read_file(fd, buff, sizeof(buff))) > 0) {
+		for(i = 0; i < n; i++) {
+			crc = _crc16_update(crc, buff[i]);
+		}
+		*size += n;
+	}
+	return crc;
+}
+
+const umeter_config* get_umeter_ini(struct fat_fs_struct* fs, struct fat_dir_struct* dir)
 {
 	static int populated = 0;
 	int err;
+	uint8_t j;
+	sensor const* s;
+	int32_t offset;
+	uint32_t ini_size;
+	uint16_t ini_crc;
+	struct fat_file_struct* fd;
 	if(!populated) {
 		const sensor sensor_defaults = {
 			1,		// enabled
 			1,		// raw_output
+			ADC_INTERNAL,	// adc
+			0,		// interval, follow sampling_interval
+			1,		// window, every sample is written
+			STATS_MEAN,	// stats
 			"n/a",	// units, won't be used
 			0.0, 	// offset, won't be used
-			1.0		// slope, won't be used
+			1.0,	// slope, won't be used
+			0,		// table
+			0,		// table_first
+			0		// table_decimals
+		};
+
+		const trigger_config trigger_defaults = {
+			0,				// enabled
+			1,				// sensor
+			TRIGGER_RISING,	// edge
+			0,				// adc, of the sensor
+			1000,			// level, 1V in millivolts until converted to codes
+			20,				// hysteresis
+			32,				// pre
+			95				// post
 		};
 
 		const umeter_config umeter_defaults = {
 			1000, // sampling_interval
-			{sensor_defaults, sensor_defaults, sensor_defaults, sensor_defaults}
+			FORMAT_TEXT, // format
+			LOG_LEVEL_DEFAULT, // verbosity
+			8, // sync_blocks, 4 KiB
+			0, // cardtest
+			0, // manifest
+			{sensor_defaults, sensor_defaults, sensor_defaults, sensor_defaults},
+			trigger_defaults
 		};
 		umeter = umeter_defaults;
-		err = ini_parse("umeter.ini", ini_handler, &umeter, fs, dir);
+
+		fd = open_file_in_dir(fs, dir, INI_FILE);
+		if (!fd) {
+			printf_P(PSTR("Can't load/parse '" INI_FILE "'\r\n"));
+			return 0;
+		}
+
+		// an unchanged INI is not parsed again, its compiled form is in EEPROM
+		ini_crc = ini_file_crc(fd, &ini_size);
+		if(ini_cache_load(&umeter, ini_size, ini_crc)) {
+			fat_close_file(fd);
+			printf_P(PSTR("Loaded cached '" INI_FILE "': \r\n"));
+			print_config();
+			populated = 1;
+			return &umeter;
+		}
+
+		offset = 0;
+		if(!fat_seek_file(fd, &offset, FAT_SEEK_SET)) {
+			fat_close_file(fd);
+			printf_P(PSTR("Can't load/parse '" INI_FILE "'\r\n"));
+			return 0;
+		}
+		table_reset();
+		err = ini_parse_file(fd, ini_handler, &umeter);
+		fat_close_file(fd);
 		if (err < 0) {
-			printf_P(PSTR("Can't load/parse 'umeter.ini'\r\n"));
+			printf_P(PSTR("Can't load/parse '" INI_FILE "'\r\n"));
 			return 0;
 		}
 		if (err > 0) {
 			printf_P(PSTR("Bad config file (first error on line %d)\r\n"), err);
 			return 0;
 		}
-		printf_P(PSTR("Loaded 'umeter.ini': \r\n"));
+		// the whole burst has to fit into the ring
+		if(umeter.trigger.pre + 1 + umeter.trigger.post > TRIGGER_RING_SIZE) {
+			umeter.trigger.post = TRIGGER_RING_SIZE - 1 - umeter.trigger.pre;
+			printf_P(PSTR("ini_handler: pre + post too large for the ring, post=%d\r\n"), umeter.trigger.post);
+		}
+		// tables are for calibrated values, delta records keep the codes
+		for(j = 0; j < 4; j++) {
+			if(umeter.format != FORMAT_TEXT || umeter.sensors[j].raw_output) {
+				umeter.sensors[j].table = 0;
+			}
+			if(umeter.sensors[j].table) {
+				table_build(j, &umeter.sensors[j]);
+			}
+			// the sum of squared codes has to fit in 32 bits
+			if(umeter.sensors[j].window > STATS_WINDOW_LIMIT(sensor_bits(&umeter.sensors[j]))) {
+				umeter.sensors[j].window = STATS_WINDOW_LIMIT(sensor_bits(&umeter.sensors[j]));
+				printf_P(PSTR("ini_handler: window too large for sensor %d, window=%u\r\n"), j+1,
+						umeter.sensors[j].window);
+			}
+		}
+		// the trigger works on codes of its sensor's ADC
+		s = &umeter.sensors[umeter.trigger.sensor - 1];
+		umeter.trigger.adc = s->adc;
+		umeter.trigger.level = sensor_volts2code(s, umeter.trigger.level / 1000.0);
+		umeter.trigger.hysteresis = sensor_volts2code(s, umeter.trigger.hysteresis / 1000.0);
+		if(UMETER_TRIGGER && umeter.trigger.enabled && !trigger_can_arm(&umeter.trigger)) {
+			printf_P(PSTR("Bad config file (trigger level and hysteresis leave no room to arm)\r\n"));
+			return 0;
+		}
+		ini_cache_store(&umeter, ini_size, ini_crc);
+		printf_P(PSTR("Loaded '" INI_FILE "': \r\n"));
 		print_config();
 		populated = 1;
 	}
@@ -108,14 +348,19 @@ const umeter_config const* get_umeter_ini(struct fat_fs_struct* fs, struct fat_d
 void print_config(void)
 {
 	int i;
-	printf_P(PSTR("UMETER CONFIG\r\nsampling_interval=%d\r\n"), umeter.sampling_interval);
+	printf_P(PSTR("UMETER CONFIG\r\nsampling_interval=%d, format=%d, verbosity=%d, sync_blocks=%u, cardtest=%d, manifest=%d\r\n"),
+			umeter.sampling_interval, umeter.format, umeter.verbosity, umeter.sync_blocks, umeter.cardtest,
+			umeter.manifest);
 	for(i=0; i<4; i++) {
 		sensor s = umeter.sensors[i];
 		char offset[8];
 		float2str(s.offset, offset);
 		char slope[8];
 		float2str(s.slope, slope);
-		printf_P(PSTR("Sensor %d: enabled=%d, raw_output=%d, units=%s, offset=%s, slope=%s\r\n"),
-				i+1, s.enabled, s.raw_output, s.units, offset, slope);
+		printf_P(PSTR("Sensor %d: enabled=%d, raw_output=%d, interval=%u, window=%u, stats=%X, units=%s, offset=%s, slope=%s, table=%d, adc=%d\r\n"),
+				i+1, s.enabled, s.raw_output, s.interval, s.window, s.stats, s.units, offset, slope, s.table, s.adc);
 	}
+	printf_P(PSTR("Trigger: enabled=%d, sensor=%d, edge=%d, level=%d, hysteresis=%d, pre=%d, post=%d\r\n"),
+			umeter.trigger.enabled, umeter.trigger.sensor, umeter.trigger.edge, umeter.trigger.level,
+			umeter.trigger.hysteresis, umeter.trigger.pre, umeter.trigger.post);
 }
@@ -2,11 +2,17 @@
 #define __UMETER_INI_H__
 
 #include "lib/FatSD/fat.h"
+#include "lib/Inputs/umeter_trigger.h"
+#include "lib/Debug/umeter_log.h"
 #include <limits.h>
 
 #define SAMPLING_MAX INT_MAX
 #define SAMPLING_MIN 100
 
+#define SYNC_BLOCKS_MAX 2048
+
+#define INI_FILE "umeter.ini"
+
 typedef struct
 {
 	// if the sensor measurement should be written to the SD card
@@ -15,16 +21,47 @@ typedef struct
 	// if the sensor measurement should be a raw voltage
 	uint8_t raw_output;
 
+	// ADC converting the sensor, ADC_INTERNAL or ADC_MCP3208 + channel
+	uint8_t adc;
+
+	// sampling interval in ms, 0 to follow the global 'sampling_interval'
+	unsigned int interval;
+
+	// number of samples aggregated into one record, see umeter_stats.h
+	unsigned int window;
+	uint8_t stats;		// STATS_* mask of the values written per window
+
 	// only will be used if 'raw_output' is false
-	char* units;		// string representing the units converted to
+	char units[8];		// string representing the units converted to
 	float offset;		// calibration linear offset value
 	float slope;		// calibration scaler/slope value
+	uint8_t table;		// points of a calibration curve used instead, see umeter_table.h
+	uint8_t table_first;	// of those points in EEPROM
+	uint8_t table_decimals;	// of the fixed point table values
 } sensor;
 
+enum
+{
+	ADC_INTERNAL=0,	// the 10 bit ADC of the ATmega, on the sensor's own pin
+	ADC_MCP3208		// 12 bit, channels 0-7 follow, see umeter_mcp3208.h
+};
+
+enum
+{
+	FORMAT_TEXT=0,	// calibrated values as text in umeter.txt
+	FORMAT_DELTA	// delta compressed ADC codes in umeter.dlt, see umeter_delta.h
+};
+
 typedef struct
 {
 	unsigned int sampling_interval;
+	uint8_t format;
+	uint8_t verbosity;		// serial log level, see umeter_log.h
+	unsigned int sync_blocks;	// blocks appended to umeter.txt between commits of its size
+	uint8_t cardtest;		// benchmark the card at power up, see umeter_cardtest.h
+	uint8_t manifest;		// list the records of umeter.txt in umeter.man, see umeter_manifest.h
 	sensor sensors[4];
+	trigger_config trigger;
 } umeter_config;
 
 enum
@@ -32,11 +69,6 @@ enum
 	sensor1=0, sensor2, sensor3, sensor4
 } sensor_indeces;
 
-static int ini_handler(void* user,
-					   const char* section,
-					   const char* name,
-					   const char* value);
-
 umeter_config const* get_umeter_ini(struct fat_fs_struct* fs, struct fat_dir_struct* dir);
 
 void print_config(void);
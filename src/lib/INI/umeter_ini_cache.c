@@ -0,0 +1,70 @@
+#include "umeter_ini_cache.h"
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+// Compiled config cache.
+//
+// The umeter_config parsed from umeter.ini is kept in EEPROM together with the
+// size and CRC of the INI it came from. As long as umeter.ini is unchanged the
+// next boot copies the struct back instead of running the parser.
+
+typedef struct
+{
+	uint8_t version;		// INI_CACHE_VERSION, 0xFF when erased or invalidated
+	uint16_t length;		// sizeof(umeter_config)
+	uint32_t ini_size;		// size of umeter.ini the config was parsed from
+	uint16_t ini_crc;		// CRC16 of umeter.ini
+	uint16_t crc;			// CRC16 of the cached config itself
+} ini_cache_header;
+
+static ini_cache_header EEMEM cache_header;
+static umeter_config EEMEM cache_config;
+
+static uint16_t config_crc(umeter_config const* config)
+{
+	const uint8_t* p = (const uint8_t*)config;
+	uint16_t crc = 0xFFFF;
+	uint16_t i;
+	for(i = 0; i < sizeof(*config); i++) {
+		crc = _crc16_update(crc, p[i]);
+	}
+	return crc;
+}
+
+// Fill 'config' from the cache if it was compiled from an INI file with the
+// given size and CRC. Returns 1 on a hit, 0 if the INI has to be parsed.
+uint8_t ini_cache_load(umeter_config* config, uint32_t ini_size, uint16_t ini_crc)
+{
+	ini_cache_header hdr;
+	umeter_config cached;
+
+	eeprom_read_block(&hdr, &cache_header, sizeof(hdr));
+	if(hdr.version != INI_CACHE_VERSION || hdr.length != sizeof(umeter_config) ||
+	   hdr.ini_size != ini_size || hdr.ini_crc != ini_crc) {
+		return 0;
+	}
+	eeprom_read_block(&cached, &cache_config, sizeof(cached));
+	if(config_crc(&cached) != hdr.crc) {
+		return 0;
+	}
+	*config = cached;
+	return 1;
+}
+
+void ini_cache_store(umeter_config const* config, uint32_t ini_size, uint16_t ini_crc)
+{
+	ini_cache_header hdr;
+
+	// invalidate first so that a reset halfway through leaves no stale hit
+	eeprom_write_byte(&cache_header.version, 0xFF);
+	eeprom_write_block(config, &cache_config, sizeof(*config));
+
+	hdr.version = 0xFF;
+	hdr.length = sizeof(umeter_config);
+	hdr.ini_size = ini_size;
+	hdr.ini_crc = ini_crc;
+	hdr.crc = config_crc(config);
+	eeprom_write_block(&hdr, &cache_header, sizeof(hdr));
+	eeprom_write_byte(&cache_header.version, INI_CACHE_VERSION);
+}
@@ -0,0 +1,14 @@
+#ifndef __UMETER_INI_CACHE_H__
+#define __UMETER_INI_CACHE_H__
+
+#include <stdint.h>
+
+#include "umeter_ini.h"
+
+// bump whenever the meaning of umeter_config changes without its size changing
+#define INI_CACHE_VERSION	4
+
+uint8_t ini_cache_load(umeter_config* config, uint32_t ini_size, uint16_t ini_crc);
+void ini_cache_store(umeter_config const* config, uint32_t ini_size, uint16_t ini_crc);
+
+#endif
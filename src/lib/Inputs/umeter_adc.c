@@ -1,5 +1,8 @@
 #include "umeter_adc.h"
 
+#include <stdio.h>
+#include "lib/Debug/umeter_prof.h"
+
 void adc_init(void)
 {
 	ADMUX  |=	(1 << REFS1) | (1 << REFS0); // internal 2.56V reference
@@ -17,6 +20,8 @@ void adc_init(void)
 
 unsigned int adc_conversion(void)
 {
+	PROF_SCOPE(PROF_ADC_CONVERSION);
+
 	ADCSRA |= (1 << ADSC) | (1 << ADIF); // start conversion
 	while(!(ADCSRA & (1 << ADIF))) {
 		;    // wait until ADIF (conversion done bit) is set
@@ -47,6 +52,19 @@ void select_sensor(int i)
 	}
 }
 
+// inverse of the conversion done when logging, clamped to the ADC range
+unsigned int volts2adc(float v)
+{
+	v = v / ADC_VOLTS_PER_CODE;
+	if(v <= 0) {
+		return 0;
+	}
+	if(v >= 1023) {
+		return 1023;
+	}
+	return (unsigned int)(v + 0.5);
+}
+
 int float2str(float f, char* buff)
 {
 	int left = (int)f;		// integer section
@@ -18,10 +18,14 @@
 #define SENSOR4		PF0	//ADC0
 #define SMUX4		0x0
 
+// volts per ADC code: 2.56V reference behind a 1:2 voltage divider
+#define ADC_VOLTS_PER_CODE	(2.56 / 1023 * 2)
+
 void adc_init(void);
 unsigned int adc_conversion(void);
 void select_sensor(int i);
 void select_adc(unsigned char mux);
 int float2str(float f, char* buff);
+unsigned int volts2adc(float v);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "umeter_delta.h"
+
+// Delta compression of the logged ADC codes.
+//
+// Slowly changing signals differ by a few codes from one sample to the next,
+// so instead of a text value per sample only the difference is stored, zigzag
+// mapped to an unsigned number and written as a varint: a change within +-63
+// codes takes a single byte. Every 512 byte block starts with the absolute
+// codes it is relative to, so blocks can be decoded on their own and a torn
+// write never affects more than one block.
+
+static uint16_t last[4];		// last code written for each sensor
+static uint8_t fresh = 1;		// no block written since power-up
+
+static uint8_t put_varint(uint8_t* p, uint16_t v)
+{
+	uint8_t n = 0;
+	while(v >= 0x80) {
+		p[n++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+// Append a record with the codes of the sensors in 'mask' to 'fd', which has
+// to be positioned at the end of the file. Returns 1 on success.
+uint8_t delta_write_record(struct fat_file_struct* fd, uint8_t mask, uint16_t const* codes)
+{
+	uint8_t rec[DELTA_RECORD_MAX];
+	uint8_t j, n = 0;
+	int16_t d;
+	int32_t file_pos = 0;
+	uint16_t used;
+	delta_header hdr;
+
+	if(!fat_seek_file(fd, &file_pos, FAT_SEEK_CUR)) {
+		return 0;
+	}
+	used = file_pos % DELTA_BLOCK_SIZE;
+
+	// start a new block after power-up and whenever the record doesn't fit
+	if(fresh || used == 0 || used + DELTA_RECORD_MAX > DELTA_BLOCK_SIZE) {
+		if(used && !write_zero_to_file(fd, DELTA_BLOCK_SIZE - used)) {
+			return 0;
+		}
+		hdr.magic[0] = 'U';
+		hdr.magic[1] = 'D';
+		hdr.version = DELTA_VERSION;
+		hdr.reserved = 0;
+		hdr.seq = (file_pos + DELTA_BLOCK_SIZE - 1) / DELTA_BLOCK_SIZE;
+		for(j = 0; j < 4; j++) {
+			hdr.base[j] = last[j];
+		}
+		if(fat_write_file(fd, (const uint8_t*)&hdr, sizeof(hdr)) != sizeof(hdr)) {
+			return 0;
+		}
+		fresh = 0;
+	}
+
+	rec[n++] = mask;
+	for(j = 0; j < 4; j++) {
+		if(!(mask & (1 << j))) {
+			continue;
+		}
+		d = codes[j] - last[j];
+		n += put_varint(&rec[n], (uint16_t)((d << 1) ^ (d >> 15)));
+	}
+	if(fat_write_file(fd, rec, n) != n) {
+		// the block may now hold a partial record, don't append to it
+		fresh = 1;
+		return 0;
+	}
+	for(j = 0; j < 4; j++) {
+		if(mask & (1 << j)) {
+			last[j] = codes[j];
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef __UMETER_DELTA_H__
+#define __UMETER_DELTA_H__
+
+#include <stdint.h>
+
+#include "lib/FatSD/fat.h"
+
+// format=delta, enabled by building with DELTA = 1 in the makefile.
+#ifndef UMETER_DELTA
+#define UMETER_DELTA 0
+#endif
+
+#define DELTA_FILE			"umeter.dlt"
+#define DELTA_BLOCK_SIZE	512
+#define DELTA_VERSION		1
+
+// largest record: mask byte plus a two byte varint for each of the 4 sensors
+#define DELTA_RECORD_MAX	9
+
+// Header at the start of every block of umeter.dlt. It is followed by records
+// of one mask byte (bit 0 = Sensor 1) and, for every bit set, the zigzag
+// varint coded difference between the sensor's ADC code and its previous one.
+// The first record of a block is relative to 'base'. A mask of 0 ends the
+// block, the rest of it is zero.
+typedef struct
+{
+	char magic[2];			// "UD"
+	uint8_t version;		// DELTA_VERSION
+	uint8_t reserved;
+	uint32_t seq;			// block index in the file
+	uint16_t base[4];		// last code of each sensor before this block
+} delta_header;
+
+uint8_t delta_write_record(struct fat_file_struct* fd, uint8_t mask, uint16_t const* codes);
+
+#endif
@@ -0,0 +1,42 @@
+#include "umeter_mcp3208.h"
+
+#include "lib/FatSD/umeter_spi.h"
+#include "lib/Debug/umeter_prof.h"
+
+// External 12 bit ADC.
+//
+// An MCP3208 (or the 4 channel MCP3204) shares the SPI bus with the card,
+// see umeter_spi.c. A conversion is one transaction of three bytes in mode
+// 0,0 at F_CPU/8, 2MHz being the fastest the part takes at 5V: start bit,
+// single ended, the channel, then the 12 bit result clocked in MSB first.
+// The sample is taken during the second byte, so there is no mux settling
+// to wait for like with the internal ADC.
+
+#define MCP3208_SPCR	((1 << SPE) | (1 << MSTR) | (1 << SPR0))	// mode 0, F_CPU/8 with SPI2X
+
+// Deselect the converter. Has to run before the card is initialized, a
+// floating chip select could have it drive MISO.
+void mcp3208_init(void)
+{
+	MCP3208_CS_PRT |= (1 << MCP3208_CS);
+	MCP3208_CS_DDR |= (1 << MCP3208_CS);
+}
+
+// Convert 'channel' (0-7). Returns 0 if the bus isn't free, which it always
+// is outside of sd_raw.
+uint16_t mcp3208_conversion(uint8_t channel)
+{
+	uint16_t code;
+	PROF_SCOPE(PROF_ADC_CONVERSION);
+
+	if(!spi_acquire(MCP3208_SPCR)) {
+		return 0;
+	}
+	MCP3208_CS_PRT &= ~(1 << MCP3208_CS);
+	spi_transfer(0x06 | (channel >> 2));	// start, single ended, D2
+	code = (spi_transfer(channel << 6) & 0x0f) << 8;	// D1, D0; null bit, B11-B8
+	code |= spi_transfer(0xff);
+	MCP3208_CS_PRT |= (1 << MCP3208_CS);
+	spi_release();
+	return code;
+}
@@ -0,0 +1,24 @@
+#ifndef __UMETER_MCP3208_H__
+#define __UMETER_MCP3208_H__
+
+#include <avr/io.h>
+
+// MCP3208 on the SPI bus of the card, chip select on PB4
+#define MCP3208_CS_DDR		DDRB
+#define MCP3208_CS_PRT		PORTB
+#define MCP3208_CS			PB4
+
+#define MCP3208_CHANNELS	8
+#define MCP3208_BITS		12
+
+// volts per code: 2.048V reference behind the same 1:2 divider as the ADC
+#define MCP3208_VOLTS_PER_CODE	(2.048 / 4096 * 2)
+
+// nominal time between two samples of a trigger burst: 24 SPI clocks at
+// F_CPU/8 plus the byte handling
+#define MCP3208_SAMPLE_US	16
+
+void mcp3208_init(void);
+uint16_t mcp3208_conversion(uint8_t channel);
+
+#endif
@@ -0,0 +1,86 @@
+#include "umeter_sched.h"
+
+#include <util/delay.h>
+
+#include "lib/Timer/umeter_clock.h"
+
+// Multi-rate sampling scheduler.
+//
+// Every enabled sensor has its own sampling interval (see sched_interval()).
+// Instead of waking up at the gcd of all intervals, the scheduler walks the
+// combined timeline: each call to sched_next() jumps straight to the next
+// point in time at which at least one sensor is due and reports which ones.
+// The due points are deadlines on the millisecond clock, so the time the
+// samples take doesn't add up to drift: sched_wait() only waits for what is
+// left of a step, and not at all when a sample ran late, until the timeline
+// has caught up.
+
+static unsigned int period[4];		// sampling interval of each sensor in ms, 0 if disabled
+static unsigned int remaining[4];	// ms until each sensor is due again
+static uint32_t deadline;			// clock_ms() of the last due point
+
+unsigned int sched_interval(umeter_config const* umeter, uint8_t j)
+{
+	// a sensor without an interval of its own follows the global one
+	if(umeter->sensors[j].interval) {
+		return umeter->sensors[j].interval;
+	}
+	return umeter->sampling_interval;
+}
+
+void sched_init(umeter_config const* umeter)
+{
+	uint8_t j;
+	for(j = 0; j < 4; j++) {
+		if(umeter->sensors[j].enabled) {
+			period[j] = sched_interval(umeter, j);
+		}
+		else {
+			period[j] = 0;
+		}
+		remaining[j] = period[j];
+	}
+	deadline = clock_ms();
+}
+
+// Advance to the next due point of the timeline. '*delay' receives the time
+// in ms to wait from the previous due point, the return value is the mask of
+// sensors to sample once it has passed (0 if no sensor is enabled).
+uint8_t sched_next(unsigned int* delay)
+{
+	uint8_t j, mask = 0;
+	unsigned int step = 0;
+
+	// the nearest deadline decides how long to sleep
+	for(j = 0; j < 4; j++) {
+		if(period[j] && (!step || remaining[j] < step)) {
+			step = remaining[j];
+		}
+	}
+	*delay = step;
+	if(!step) {
+		return 0;
+	}
+
+	for(j = 0; j < 4; j++) {
+		if(!period[j]) {
+			continue;
+		}
+		remaining[j] -= step;
+		if(!remaining[j]) {
+			mask |= SCHED_CHANNEL(j);
+			remaining[j] = period[j];
+		}
+	}
+	return mask;
+}
+
+// Wait until 'delay' ms from sched_next() have passed since the previous due
+// point, which may already be the case.
+void sched_wait(unsigned int delay)
+{
+	deadline += delay;
+	while((int32_t)(deadline - clock_ms()) > 0) {
+		_delay_ms(1);
+	}
+}
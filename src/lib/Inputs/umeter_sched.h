@@ -0,0 +1,17 @@
+#ifndef __UMETER_SCHED_H__
+#define __UMETER_SCHED_H__
+
+#include <stdint.h>
+
+#include "lib/INI/umeter_ini.h"
+
+// bit j of a channel mask is set when sensor j+1 is sampled
+#define SCHED_CHANNEL(j)	(1 << (j))
+#define SCHED_ALL_CHANNELS	0x0F
+
+void sched_init(umeter_config const* umeter);
+unsigned int sched_interval(umeter_config const* umeter, uint8_t j);
+uint8_t sched_next(unsigned int* delay);
+void sched_wait(unsigned int delay);
+
+#endif
@@ -0,0 +1,48 @@
+#include "umeter_sensor.h"
+
+#include "umeter_adc.h"
+#include "umeter_mcp3208.h"
+
+// Sensor inputs.
+//
+// A sensor is converted either by the internal 10 bit ADC, on its own pin,
+// or by a channel of the external MCP3208 (adc=mcp3208:N in umeter.ini).
+// Everything downstream works on the codes of that ADC and converts them to
+// volts with the factor returned here.
+
+// Convert sensor j, configured by 's'. Returns its ADC code.
+uint16_t sensor_conversion(uint8_t j, sensor const* s)
+{
+	if(s->adc != ADC_INTERNAL) {
+		return mcp3208_conversion(s->adc - ADC_MCP3208);
+	}
+	select_sensor(j+1);
+	return adc_conversion();
+}
+
+// Resolution of the codes of sensor 's'.
+uint8_t sensor_bits(sensor const* s)
+{
+	return s->adc != ADC_INTERNAL ? MCP3208_BITS : 10;
+}
+
+// Input voltage per code of sensor 's'.
+float sensor_volts_per_code(sensor const* s)
+{
+	return s->adc != ADC_INTERNAL ? MCP3208_VOLTS_PER_CODE : ADC_VOLTS_PER_CODE;
+}
+
+// Code of sensor 's' at 'v' volts, clamped to its range.
+unsigned int sensor_volts2code(sensor const* s, float v)
+{
+	unsigned int max = (1 << sensor_bits(s)) - 1;
+
+	v = v / sensor_volts_per_code(s);
+	if(v <= 0) {
+		return 0;
+	}
+	if(v >= max) {
+		return max;
+	}
+	return (unsigned int)(v + 0.5);
+}
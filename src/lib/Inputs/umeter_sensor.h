@@ -0,0 +1,13 @@
+#ifndef __UMETER_SENSOR_H__
+#define __UMETER_SENSOR_H__
+
+#include <stdint.h>
+
+#include "lib/INI/umeter_ini.h"
+
+uint16_t sensor_conversion(uint8_t j, sensor const* s);
+uint8_t sensor_bits(sensor const* s);
+float sensor_volts_per_code(sensor const* s);
+unsigned int sensor_volts2code(sensor const* s, float v);
+
+#endif
@@ -0,0 +1,168 @@
+#include "umeter_stats.h"
+
+#include <string.h>
+#include <math.h>
+
+#include "umeter_adc.h"
+#include "umeter_table.h"
+#include "umeter_sensor.h"
+
+// Per-sensor window aggregation.
+//
+// Raw ADC codes are accumulated in integer arithmetic while a window fills up.
+// Once it is complete, the selected statistics are computed and calibrated in
+// one go: with y = a*x + b being the calibration of a code x,
+//   min/max(y)  = a*min/max(x) + b (swapped when a < 0)
+//   mean(y)     = a*mean(x) + b
+//   mean(y^2)   = a^2*mean(x^2) + 2ab*mean(x) + b^2
+// so no floating point work is done per sample.
+//
+// Sensors calibrated with a table (see umeter_table.h) accumulate their
+// fixed point values from the table instead, only the squares for the RMS
+// are summed in floating point since they don't fit 32 bits.
+
+typedef struct
+{
+	uint16_t count;
+	int16_t min;
+	int16_t max;
+	int32_t sum;
+	union {
+		uint32_t codes;		// of the codes
+		float values;		// of the table values
+	} sumsq;
+} stats_acc;
+
+static stats_acc acc[4];
+
+// Parse a comma separated list of "min", "max", "mean" and "rms".
+// Returns the STATS_* mask or 0 if the list contains anything else.
+uint8_t stats_parse(const char* value)
+{
+	uint8_t mask = 0;
+	uint8_t len;
+	while(*value) {
+		len = strcspn(value, ",");
+		if(len == 3 && strncmp(value, "min", 3) == 0) {
+			mask |= STATS_MIN;
+		} else if(len == 3 && strncmp(value, "max", 3) == 0) {
+			mask |= STATS_MAX;
+		} else if(len == 4 && strncmp(value, "mean", 4) == 0) {
+			mask |= STATS_MEAN;
+		} else if(len == 3 && strncmp(value, "rms", 3) == 0) {
+			mask |= STATS_RMS;
+		}
+		else {
+			return 0;
+		}
+		value += len;
+		if(*value == ',') {
+			value++;
+		}
+	}
+	return mask;
+}
+
+// Add a sample of sensor j, configured by 's'. Returns 1 once its window
+// is complete.
+uint8_t stats_add(uint8_t j, uint16_t code, sensor const* s)
+{
+	stats_acc* a = &acc[j];
+	int16_t v = code;
+
+	if(s->table) {
+		v = table_lookup(j, s, code);
+	}
+	if(!a->count) { // first sample of a window
+		a->min = v;
+		a->max = v;
+		a->sum = 0;
+		a->sumsq.codes = 0;	// also 0.0 as a float
+	}
+	if(v < a->min) {
+		a->min = v;
+	}
+	if(v > a->max) {
+		a->max = v;
+	}
+	a->sum += v;
+	if(!s->table) {
+		a->sumsq.codes += (uint32_t)code * code;
+	} else if(s->stats & STATS_RMS) {
+		a->sumsq.values += (float)v * v;
+	}
+	return ++a->count >= s->window;
+}
+
+// Compute the statistics selected for sensor j, calibrated according to 's',
+// into 'out' and start a new window. Returns the number of values stored.
+uint8_t stats_get(uint8_t j, sensor const* s, float* out)
+{
+	stats_acc* acc_j = &acc[j];
+	uint8_t n = 0, d;
+	float a, b, mean, ms, lo, hi;
+
+	if(!acc_j->count) {
+		return 0;
+	}
+
+	// v_in = ADC_value * Vref / (2^bits)-1 * volt div. scaler
+	a = sensor_volts_per_code(s);
+	b = 0;
+	if(s->table) {
+		// fixed point values with 'table_decimals' decimals
+		for(a = 1, d = 0; d < s->table_decimals; d++) {
+			a /= 10;
+		}
+	}
+	else if(!s->raw_output) {
+		a /= s->slope;
+		b = -s->offset / s->slope;
+	}
+
+	lo = a * acc_j->min + b;
+	hi = a * acc_j->max + b;
+	if(a < 0) {
+		mean = lo;
+		lo = hi;
+		hi = mean;
+	}
+	mean = (float)acc_j->sum / acc_j->count;
+
+	if(s->stats & STATS_MIN) {
+		out[n++] = lo;
+	}
+	if(s->stats & STATS_MAX) {
+		out[n++] = hi;
+	}
+	if(s->stats & STATS_MEAN) {
+		out[n++] = a * mean + b;
+	}
+	if(s->stats & STATS_RMS) {
+		if(s->table) {
+			ms = a * a * (acc_j->sumsq.values / acc_j->count);
+		}
+		else {
+			ms = a * a * ((float)acc_j->sumsq.codes / acc_j->count) + 2 * a * b * mean + b * b;
+		}
+		out[n++] = ms > 0 ? sqrt(ms) : 0;
+	}
+
+	acc_j->count = 0;
+	return n;
+}
+
+// Mean of the window of sensor j as a rounded ADC code, for output formats
+// that leave calibration to the host. Starts a new window.
+uint16_t stats_get_code(uint8_t j)
+{
+	stats_acc* acc_j = &acc[j];
+	uint16_t code;
+
+	if(!acc_j->count) {
+		return 0;
+	}
+	code = (acc_j->sum + acc_j->count / 2) / acc_j->count;
+	acc_j->count = 0;
+	return code;
+}
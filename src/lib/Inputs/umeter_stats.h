@@ -0,0 +1,24 @@
+#ifndef __UMETER_STATS_H__
+#define __UMETER_STATS_H__
+
+#include <stdint.h>
+
+#include "lib/INI/umeter_ini.h"
+
+// statistics emitted per window, in this order
+#define STATS_MIN	0x01
+#define STATS_MAX	0x02
+#define STATS_MEAN	0x04
+#define STATS_RMS	0x08
+
+// largest window for which the sum of squared 10 bit codes fits in 32 bits
+#define STATS_WINDOW_MAX	4096U
+// the same for codes of 'bits' bits
+#define STATS_WINDOW_LIMIT(bits)	(STATS_WINDOW_MAX >> (2 * ((bits) - 10)))
+
+uint8_t stats_parse(const char* value);
+uint8_t stats_add(uint8_t j, uint16_t code, sensor const* s);
+uint8_t stats_get(uint8_t j, sensor const* s, float* out);
+uint16_t stats_get_code(uint8_t j);
+
+#endif
@@ -0,0 +1,183 @@
+#include "umeter_table.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#include "umeter_sensor.h"
+
+// Calibration tables.
+//
+// A sensor with a nonlinear response (a thermistor, say) is calibrated with
+// a curve instead of offset and slope:
+//   table=volts:value,volts:value,...
+// with the volts rising, linear between the points and flat beyond the first
+// and the last. The points are kept in EEPROM, rounded to mV and to as many
+// decimals (up to 3) as fit into 16 bits, so CONFIG.TXT can list them. Once
+// umeter.ini is parsed, and so the ADC of the sensor is known, the rounded
+// points are compiled into a table of the values at every TABLE_SEGMENTS-th
+// of the ADC's codes (16 codes of the internal ADC, 64 of the MCP3208). The
+// tables live in EEPROM next to the compiled config (see umeter_ini_cache.c),
+// so they are only written when umeter.ini changes. A sample is converted
+// with two table reads and an integer interpolation.
+//
+// The four 65 entry tables take 520 bytes of the 1 KB EEPROM and the caches
+// about 400, so the points of all curves share TABLE_POINTS_MAX slots of 4
+// bytes.
+
+typedef struct
+{
+	uint16_t mv;		// volts of the point in mV
+	int16_t value;		// with the decimals of the sensor's table
+} table_point;
+
+static int16_t EEMEM tables[4][TABLE_ENTRIES];
+static table_point EEMEM points[TABLE_POINTS_MAX];
+static uint8_t points_used;
+
+// Free the points of all curves, before umeter.ini is parsed.
+void table_reset(void)
+{
+	points_used = 0;
+}
+
+// Parse 'value' into points of the curve of 's', stored with
+// 's->table_decimals' decimals, and set 's->table' to their number. Returns
+// 0 if 'value' isn't a valid curve or its points don't fit. The ADC doesn't
+// matter yet, see table_build().
+uint8_t table_parse(sensor* s, const char* value)
+{
+	uint8_t* decimals = &s->table_decimals;
+	uint16_t x[TABLE_POINTS_MAX];
+	float y[TABLE_POINTS_MAX];
+	float v, max = 0, scale = 1000;
+	uint8_t n = 0, i;
+	table_point p;
+	char* end;
+
+	// volts:value pairs separated by commas
+	while(*value) {
+		if(points_used + n == TABLE_POINTS_MAX) {
+			return 0;
+		}
+		v = strtod(value, &end);
+		if(end == value || *end != ':' || v < 0 || v * 1000 >= 65535.5) {
+			return 0;
+		}
+		x[n] = v * 1000 + 0.5;
+		value = end + 1;
+		y[n] = strtod(value, &end);
+		if(end == value || (*end && *end != ',') || (n && x[n] <= x[n-1])) {
+			return 0;
+		}
+		value = *end ? end + 1 : end;
+		n++;
+	}
+	if(n < 2) {
+		return 0;
+	}
+
+	// the table holds values between the points, so these bound it
+	for(i = 0; i < n; i++) {
+		if(fabs(y[i]) > max) {
+			max = fabs(y[i]);
+		}
+	}
+	for(*decimals = 3; *decimals && max * scale > INT16_MAX; (*decimals)--) {
+		scale /= 10;
+	}
+	if(max * scale > INT16_MAX) {
+		return 0;
+	}
+
+	for(i = 0; i < n; i++) {
+		v = y[i] * scale;
+		p.mv = x[i];
+		p.value = v < 0 ? v - 0.5 : v + 0.5;
+		eeprom_update_block(&p, &points[points_used + i], sizeof(p));
+	}
+	s->table = n;
+	s->table_first = points_used;
+	points_used += n;
+	return 1;
+}
+
+// Compile the curve of 's' into the table of sensor j for the ADC set in
+// 's', once umeter.ini is parsed.
+void table_build(uint8_t j, sensor const* s)
+{
+	uint8_t shift = sensor_bits(s) - TABLE_SEGMENT_BITS;
+	float mv_per_code = sensor_volts_per_code(s) * 1000;
+	float v;
+	table_point a, b;
+	uint8_t i = 1, k;
+
+	eeprom_read_block(&a, &points[s->table_first], sizeof(a));
+	eeprom_read_block(&b, &points[s->table_first + 1], sizeof(b));
+	for(k = 0; k < TABLE_ENTRIES; k++) {
+		v = (float)((uint16_t)k << shift) * mv_per_code;
+		// a and b enclose v, but before the first and beyond the last point
+		while(i + 1 < s->table && b.mv < v) {
+			a = b;
+			eeprom_read_block(&b, &points[s->table_first + ++i], sizeof(b));
+		}
+		if(v <= a.mv) {
+			v = a.value;
+		}
+		else if(v >= b.mv) {
+			v = b.value;
+		}
+		else {
+			v = a.value + (float)(b.value - a.value) * (v - a.mv) / (b.mv - a.mv);
+		}
+		eeprom_update_word((uint16_t*)&tables[j][k], (int16_t)(v < 0 ? v - 0.5 : v + 0.5));
+	}
+}
+
+// Point i of the curve of 's' as "volts:value" into 'str', as in umeter.ini.
+// 'str' has to hold 15 characters and the terminating zero.
+void table_point_str(sensor const* s, uint8_t i, char* str)
+{
+	table_point p;
+	uint16_t a, d = 1;
+	uint8_t decimals = s->table_decimals;
+
+	eeprom_read_block(&p, &points[s->table_first + i], sizeof(p));
+	str += sprintf_P(str, PSTR("%u.%03u:%s"), p.mv / 1000, p.mv % 1000, p.value < 0 ? "-" : "");
+	a = p.value < 0 ? -p.value : p.value;
+	while(decimals--) {
+		d *= 10;
+	}
+	if(d == 1) {
+		sprintf_P(str, PSTR("%u"), a);
+	}
+	else {
+		sprintf_P(str, PSTR("%u.%0*u"), a / d, s->table_decimals, a % d);
+	}
+}
+
+// Value of 'code' on the table of sensor j, with the decimals of
+// table_parse().
+int16_t table_lookup(uint8_t j, sensor const* s, uint16_t code)
+{
+	uint8_t shift = sensor_bits(s) - TABLE_SEGMENT_BITS;
+	uint8_t k = code >> shift;
+	int16_t lo = eeprom_read_word((const uint16_t*)&tables[j][k]);
+	int16_t hi = eeprom_read_word((const uint16_t*)&tables[j][k+1]);
+
+	return lo + (int16_t)(((int32_t)(hi - lo) * (code & ((1 << shift) - 1))) >> shift);
+}
+
+// Value of 'code' on the table of sensor j as a float.
+float table_value(uint8_t j, sensor const* s, uint16_t code)
+{
+	float v = table_lookup(j, s, code);
+	uint8_t decimals = s->table_decimals;
+
+	while(decimals--) {
+		v /= 10;
+	}
+	return v;
+}
@@ -0,0 +1,22 @@
+#ifndef __UMETER_TABLE_H__
+#define __UMETER_TABLE_H__
+
+#include <stdint.h>
+
+#include "lib/INI/umeter_ini.h"
+
+// calibration table of a sensor: its value at every 1/TABLE_SEGMENTS of the
+// range of its ADC, 16 codes of the internal one
+#define TABLE_SEGMENT_BITS	6
+#define TABLE_SEGMENTS		(1 << TABLE_SEGMENT_BITS)
+#define TABLE_ENTRIES		(TABLE_SEGMENTS + 1)
+#define TABLE_POINTS_MAX	16		// points of all the curves in umeter.ini together
+
+void table_reset(void);
+uint8_t table_parse(sensor* s, const char* value);
+void table_build(uint8_t j, sensor const* s);
+void table_point_str(sensor const* s, uint8_t i, char* str);
+int16_t table_lookup(uint8_t j, sensor const* s, uint16_t code);
+float table_value(uint8_t j, sensor const* s, uint16_t code);
+
+#endif
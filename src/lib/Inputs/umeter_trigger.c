@@ -0,0 +1,152 @@
+#include "umeter_trigger.h"
+
+#include <string.h>
+
+#include "umeter_adc.h"
+#include "umeter_mcp3208.h"
+#include "lib/INI/umeter_ini.h"
+
+// Triggered burst capture.
+//
+// The trigger sensor is converted back to back into a ring of TRIGGER_RING_SIZE
+// samples. Once the signal has crossed the level on the configured edge (after
+// having been at least 'hysteresis' codes on the other side of it), 'post' more
+// samples are taken and the burst is handed to trigger_write_burst(), which
+// appends it to the capture file as one whole block. A sensor on the MCP3208
+// is converted the same way over SPI, about six times as fast; the card isn't
+// touched until the burst is complete.
+
+// Highest code of the trigger sensor's ADC.
+static uint16_t trigger_full_scale(trigger_config const* cfg)
+{
+	return (1 << (cfg->adc != ADC_INTERNAL ? MCP3208_BITS : 10)) - 1;
+}
+
+// If a signal can get 'hysteresis' codes to the other side of the level, so
+// that the trigger arms at all.
+uint8_t trigger_can_arm(trigger_config const* cfg)
+{
+	if(cfg->edge == TRIGGER_FALLING) {
+		return (uint32_t)cfg->level + cfg->hysteresis < trigger_full_scale(cfg);
+	}
+	return cfg->level > cfg->hysteresis;
+}
+
+// Sample the configured sensor until a trigger fires and the post-trigger
+// samples are in. Returns the ring index of the oldest sample of the burst and
+// fills in 'hdr' (except for the sequence number).
+uint8_t trigger_capture(trigger_config const* cfg, uint16_t* ring, trigger_header* hdr)
+{
+	uint8_t head = 0;
+	uint8_t armed = 0;
+	uint16_t x, filled = 0, remaining = cfg->post;
+	int32_t rearm;
+
+	// kept within reach of the ADC's codes, or the trigger would never arm
+	if(cfg->edge == TRIGGER_FALLING) {
+		rearm = (int32_t)cfg->level + cfg->hysteresis;
+		if(rearm > trigger_full_scale(cfg) - 1) {
+			rearm = trigger_full_scale(cfg) - 1;
+		}
+	}
+	else {
+		rearm = (int32_t)cfg->level - cfg->hysteresis;
+		if(rearm < 1) {
+			rearm = 1;
+		}
+	}
+
+	if(cfg->adc == ADC_INTERNAL) {
+		select_sensor(cfg->sensor);
+		adc_conversion(); // the first conversion after switching the mux is discarded
+	}
+
+	for(;;) {
+		if(cfg->adc != ADC_INTERNAL) {
+			x = mcp3208_conversion(cfg->adc - ADC_MCP3208);
+		}
+		else {
+			x = adc_conversion();
+		}
+		ring[head++ & TRIGGER_RING_MASK] = x;
+		if(filled <= cfg->pre) {
+			filled++;
+		}
+
+		if(armed == 2) { // triggered, collect the post-trigger samples
+			if(!--remaining) {
+				break;
+			}
+			continue;
+		}
+
+		if(cfg->edge == TRIGGER_FALLING) {
+			if((int32_t)x > rearm) {
+				armed = 1;
+			}
+			else if(armed && x <= cfg->level && filled > cfg->pre) {
+				armed = 2;
+			}
+		}
+		else {
+			if((int32_t)x < rearm) {
+				armed = 1;
+			}
+			else if(armed && x >= cfg->level && filled > cfg->pre) {
+				armed = 2;
+			}
+		}
+
+		if(armed == 2 && !remaining) {
+			break;
+		}
+	}
+
+	hdr->magic[0] = 'T';
+	hdr->magic[1] = 'B';
+	hdr->version = TRIGGER_VERSION;
+	hdr->sensor = cfg->sensor;
+	hdr->pre = cfg->pre;
+	hdr->post = cfg->post;
+	hdr->level = cfg->level;
+	hdr->edge = cfg->edge;
+	hdr->sample_us = cfg->adc != ADC_INTERNAL ? MCP3208_SAMPLE_US : TRIGGER_SAMPLE_US;
+
+	return (head - (cfg->pre + 1 + cfg->post)) & TRIGGER_RING_MASK;
+}
+
+// Append a burst to 'fd' as one block. The file is padded to the next block
+// boundary first in case an earlier burst was cut short. Returns 1 on success.
+uint8_t trigger_write_burst(struct fat_file_struct* fd, uint16_t const* ring, uint8_t start, trigger_header* hdr)
+{
+	uint16_t n, count;
+	int32_t file_pos = 0;
+
+	if(!fat_seek_file(fd, &file_pos, FAT_SEEK_END)) {
+		return 0;
+	}
+	n = (TRIGGER_BLOCK_SIZE - (file_pos % TRIGGER_BLOCK_SIZE)) % TRIGGER_BLOCK_SIZE;
+	if(!write_zero_to_file(fd, n)) {
+		return 0;
+	}
+	hdr->seq = (file_pos + n) / TRIGGER_BLOCK_SIZE;
+
+	if(fat_write_file(fd, (const uint8_t*)hdr, sizeof(*hdr)) != sizeof(*hdr)) {
+		return 0;
+	}
+
+	// samples in order, unwrapping the ring if needed
+	count = hdr->pre + 1 + hdr->post;
+	n = TRIGGER_RING_SIZE - start;
+	if(n > count) {
+		n = count;
+	}
+	if(fat_write_file(fd, (const uint8_t*)&ring[start], n * 2) != n * 2) {
+		return 0;
+	}
+	if(count > n && fat_write_file(fd, (const uint8_t*)ring, (count - n) * 2) != (count - n) * 2) {
+		return 0;
+	}
+
+	return write_zero_to_file(fd, TRIGGER_BLOCK_SIZE - sizeof(*hdr) - count * 2);
+}
@@ -0,0 +1,69 @@
+#ifndef __UMETER_TRIGGER_H__
+#define __UMETER_TRIGGER_H__
+
+#include <stdint.h>
+
+#include "lib/FatSD/fat.h"
+
+// Burst capture, enabled by building with TRIGGER = 1 in the makefile.
+#ifndef UMETER_TRIGGER
+#define UMETER_TRIGGER 0
+#endif
+
+// samples held in RAM while waiting for a trigger, must be a power of 2
+#define TRIGGER_RING_SIZE	128
+#define TRIGGER_RING_MASK	(TRIGGER_RING_SIZE - 1)
+
+// every burst takes exactly one block of the capture file
+#define TRIGGER_BLOCK_SIZE	512
+
+// nominal time between two samples: 13 ADC clocks at F_CPU/128
+#define TRIGGER_SAMPLE_US	((13UL * 128 * 1000000) / F_CPU)
+
+// level and hysteresis in umeter.ini are parsed into 16 bits of mV
+#define TRIGGER_VOLTS_MAX	65.535
+
+#define TRIGGER_FILE		"trigger.bin"
+
+enum
+{
+	TRIGGER_RISING = 0,
+	TRIGGER_FALLING
+};
+
+typedef struct
+{
+	uint8_t enabled;		// capture bursts instead of logging to umeter.txt
+	uint8_t sensor;			// sensor (1-4) watched and captured
+	uint8_t adc;			// ADC of that sensor, copied from its config
+	uint8_t edge;			// TRIGGER_RISING or TRIGGER_FALLING
+	unsigned int level;		// threshold in codes of the sensor's ADC
+	unsigned int hysteresis;	// distance in codes to re-arm the trigger
+	unsigned int pre;		// samples kept from before the trigger sample
+	unsigned int post;		// samples taken after the trigger sample
+} trigger_config;
+
+// Header at the start of every burst block in trigger.bin. It is followed by
+// pre + 1 + post little endian 16 bit codes of the sensor's ADC, oldest first,
+// 10 bits for the internal one and 12 for the MCP3208, with the trigger
+// sample at index 'pre'. The rest of the block is zero.
+typedef struct
+{
+	char magic[2];			// "TB"
+	uint8_t version;		// TRIGGER_VERSION
+	uint8_t sensor;
+	uint32_t seq;			// burst number, equal to the block index in the file
+	uint16_t pre;
+	uint16_t post;
+	uint16_t level;
+	uint8_t edge;
+	uint8_t sample_us;		// TRIGGER_SAMPLE_US or MCP3208_SAMPLE_US
+} trigger_header;
+
+#define TRIGGER_VERSION		1
+
+uint8_t trigger_can_arm(trigger_config const* cfg);
+uint8_t trigger_capture(trigger_config const* cfg, uint16_t* ring, trigger_header* hdr);
+uint8_t trigger_write_burst(struct fat_file_struct* fd, uint16_t const* ring, uint8_t start, trigger_header* hdr);
+
+#endif
@@ -37,6 +37,7 @@
  
 #define  INCLUDE_FROM_SCSI_C
 #include "SCSI.h"
+#include <string.h>
 
 /** Structure to hold the SCSI response data to a SCSI INQUIRY command. This gives information about the device's
  *  features and capabilities.
@@ -122,6 +123,20 @@ bool SCSI_DecodeSCSICommand(void)
 			//printf("READ_10\r\n");
 			SCSI_Command_ReadWrite_10(DATA_READ);
 			break;
+		case SCSI_CMD_MODE_SENSE_6:
+			SCSI_Command_Mode_Sense(false);
+			break;
+		case SCSI_CMD_MODE_SENSE_10:
+			SCSI_Command_Mode_Sense(true);
+			break;
+		case SCSI_CMD_READ_FORMAT_CAPACITIES:
+			SCSI_Command_Read_Format_Capacities();
+			break;
+		case SCSI_CMD_SYNCHRONIZE_CACHE_10:
+		case SCSI_CMD_START_STOP_UNIT:
+			/* Both leave the cached block on the card, before the host relies on it or ejects the medium */
+			SCSI_Command_Synchronize_Cache();
+			break;
 		case SCSI_CMD_TEST_UNIT_READY:
 		case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
 		case SCSI_CMD_VERIFY_10:
@@ -136,6 +151,11 @@ bool SCSI_DecodeSCSICommand(void)
 			break;
 	}
 	
+	#if UMETER_STATUS_LUN
+	if (SenseData.SenseKey != SCSI_SENSE_KEY_GOOD)
+	  StatusCounters.FailedCommands++;
+	#endif
+
 	return (SenseData.SenseKey == SCSI_SENSE_KEY_GOOD);
 }
 
@@ -206,8 +226,8 @@ static void SCSI_Command_Read_Capacity_10(void)
 {
 	uint32_t NbBlocks;
 	
-	/* Get the number of blocks in the SD device */
-	NbBlocks = SDCardManager_GetNbBlocks();
+	/* Get the number of blocks in the SD device or the status volume */
+	NbBlocks = LUN_MEDIA_BLOCKS;
 	
 	/* Send the total number of logical blocks in the current LUN */
 	Endpoint_Write_DWord_BE(NbBlocks - 1);
@@ -290,17 +310,168 @@ static void SCSI_Command_ReadWrite_10(const bool IsDataRead)
 		return;
 	}
 
-	#if (TOTAL_LUNS > 1)
-	/* Adjust the given block address to the real media address based on the selected LUN */
-	BlockAddress += ((uint32_t)CommandBlock.LUN * LUN_MEDIA_BLOCKS);
+	#if UMETER_STATUS_LUN
+	/* The status volume is generated on the fly and can't be written */
+	if (IS_STATUS_LUN())
+	{
+		if (IsDataRead == DATA_WRITE)
+		{
+			SCSI_SET_SENSE(SCSI_SENSE_KEY_DATA_PROTECT,
+			               SCSI_ASENSE_WRITE_PROTECTED,
+			               SCSI_ASENSEQ_NO_QUALIFIER);
+
+			return;
+		}
+
+		StatusDisk_ReadBlocks(BlockAddress, TotalBlocks);
+		CommandBlock.DataTransferLength -= ((uint32_t)TotalBlocks * VIRTUAL_MEMORY_BLOCK_SIZE);
+		return;
+	}
+
+	if (IsDataRead == DATA_READ)
+	  StatusCounters.BlocksRead += TotalBlocks;
+	else
+	  StatusCounters.BlocksWritten += TotalBlocks;
 	#endif
 	
 	/* Determine if the packet is a READ (10) or WRITE (10) command, call appropriate function */
 	if (IsDataRead == DATA_READ)
-	  SDCardManager_ReadBlocks(BlockAddress, TotalBlocks);
-	else
-	  SDCardManager_WriteBlocks(BlockAddress, TotalBlocks);
+	{
+		if (!(SDCardManager_ReadBlocks(BlockAddress, TotalBlocks)))
+		{
+			/* The card failed, update SENSE key with a read error and return command fail */
+			SCSI_SET_SENSE(SCSI_SENSE_KEY_MEDIUM_ERROR,
+			               SCSI_ASENSE_UNRECOVERED_READ_ERROR,
+			               SCSI_ASENSEQ_NO_QUALIFIER);
+
+			return;
+		}
+	}
+	else if (!(SDCardManager_WriteBlocks(BlockAddress, TotalBlocks)))
+	{
+		/* The card failed, update SENSE key with a write error and return command fail; the rest of the data has
+		 * been discarded, so the data stage is complete and the endpoint isn't stalled */
+		SCSI_SET_SENSE(SCSI_SENSE_KEY_MEDIUM_ERROR,
+		               SCSI_ASENSE_WRITE_ERROR,
+		               SCSI_ASENSEQ_NO_QUALIFIER);
+
+		CommandBlock.DataTransferLength -= ((uint32_t)TotalBlocks * VIRTUAL_MEMORY_BLOCK_SIZE);
+		return;
+	}
 
 	/* Update the bytes transferred counter and succeed the command */
 	CommandBlock.DataTransferLength -= ((uint32_t)TotalBlocks * VIRTUAL_MEMORY_BLOCK_SIZE);
 }
+
+/** Sends the first BytesTransferred bytes of a command response, limited to the allocation length given by the host,
+ *  and updates the bytes transferred counter.
+ *
+ *  \param[in] Data              Response to send
+ *  \param[in] DataLength        Size of the complete response
+ *  \param[in] AllocationLength  Number of bytes the host has room for
+ */
+static void SCSI_Write_Response(const void* Data, uint16_t DataLength, uint16_t AllocationLength)
+{
+	uint16_t BytesTransferred = (AllocationLength < DataLength)? AllocationLength : DataLength;
+
+	Endpoint_Write_Stream_LE(Data, BytesTransferred, StreamCallback_AbortOnMassStoreReset);
+
+	/* Check if the current command is being aborted by the host */
+	if (IsMassStoreReset)
+	  return;
+
+	/* Finalize the stream transfer to send the last packet */
+	Endpoint_ClearIN();
+
+	/* Succeed the command and update the bytes transferred counter */
+	CommandBlock.DataTransferLength -= BytesTransferred;
+}
+
+/** Command processing for an issued SCSI MODE SENSE (6) or MODE SENSE (10) command. Only the caching mode page is
+ *  supported, which tells the host that writes are cached (write-back) so that it issues SYNCHRONIZE CACHE when it
+ *  needs the data on the medium. No block descriptors are returned, only the status volume is write protected.
+ *
+ *  \param[in] IsModeSense10  Indicates if the command is a MODE SENSE (10) command rather than MODE SENSE (6)
+ */
+static void SCSI_Command_Mode_Sense(const bool IsModeSense10)
+{
+	uint8_t  PageCode    = (CommandBlock.SCSICommandData[2] & 0x3F);
+	uint8_t  PageControl = (CommandBlock.SCSICommandData[2] >> 6);
+	uint8_t  HeaderLength = (IsModeSense10)? 8 : 4;
+	uint16_t AllocationLength;
+	uint8_t  Response[8 + 20];
+	uint8_t* Page = &Response[HeaderLength];
+
+	if (IsModeSense10)
+	  AllocationLength = (((uint16_t)CommandBlock.SCSICommandData[7] << 8) | CommandBlock.SCSICommandData[8]);
+	else
+	  AllocationLength = CommandBlock.SCSICommandData[4];
+
+	/* Only the caching page exists, saved values are not supported */
+	if (((PageCode != MODE_PAGE_CACHING) && (PageCode != MODE_PAGE_ALL)) || (PageControl == MODE_PAGE_CONTROL_SAVED))
+	{
+		SCSI_SET_SENSE(SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+		               SCSI_ASENSE_INVALID_FIELD_IN_CDB,
+		               SCSI_ASENSEQ_NO_QUALIFIER);
+
+		return;
+	}
+
+	memset(Response, 0, sizeof(Response));
+
+	/* Caching mode page, nothing in it can be changed by the host */
+	Page[0] = MODE_PAGE_CACHING;
+	Page[1] = 18;
+	if (PageControl != MODE_PAGE_CONTROL_CHANGEABLE)
+	  Page[2] = MODE_CACHING_WCE;
+
+	/* Mode parameter header, the mode data length doesn't count itself */
+	if (IsModeSense10)
+	  Response[1] = (HeaderLength + 20 - 2);
+	else
+	  Response[0] = (HeaderLength + 20 - 1);
+
+	/* Device specific parameter, the status volume is write protected */
+	if (IS_STATUS_LUN())
+	  Response[IsModeSense10 ? 3 : 2] = MODE_DEVICE_SPECIFIC_WP;
+
+	SCSI_Write_Response(Response, (HeaderLength + 20), AllocationLength);
+}
+
+/** Command processing for an issued SCSI READ FORMAT CAPACITIES command. This command returns the capacity of the
+ *  formatted medium, the same as READ CAPACITY (10). Windows hosts issue it before anything else.
+ */
+static void SCSI_Command_Read_Format_Capacities(void)
+{
+	uint16_t AllocationLength = (((uint16_t)CommandBlock.SCSICommandData[7] << 8) | CommandBlock.SCSICommandData[8]);
+	uint32_t NbBlocks         = LUN_MEDIA_BLOCKS;
+	uint8_t  Response[12]     =
+		{
+			0, 0, 0, 8,                                   /* Capacity list header, one descriptor */
+			(NbBlocks >> 24), (NbBlocks >> 16), (NbBlocks >> 8), NbBlocks,
+			FORMAT_DESCRIPTOR_FORMATTED,
+			0, (VIRTUAL_MEMORY_BLOCK_SIZE >> 8), (VIRTUAL_MEMORY_BLOCK_SIZE & 0xFF)
+		};
+
+	SCSI_Write_Response(Response, sizeof(Response), AllocationLength);
+}
+
+/** Command processing for an issued SCSI SYNCHRONIZE CACHE (10) or START STOP UNIT command. Writes from the host are
+ *  held back in the SD write buffer (see SDCardManager_Flush()), which is written to the card here. The block range
+ *  of SYNCHRONIZE CACHE is ignored, there is never more than one cached block. Nothing is cached for the status volume.
+ */
+static void SCSI_Command_Synchronize_Cache(void)
+{
+	if (!(IS_STATUS_LUN()) && !(SDCardManager_Flush()))
+	{
+		/* Update SENSE key with a write error and return command fail */
+		SCSI_SET_SENSE(SCSI_SENSE_KEY_MEDIUM_ERROR,
+		               SCSI_ASENSE_WRITE_ERROR,
+		               SCSI_ASENSEQ_NO_QUALIFIER);
+
+		return;
+	}
+
+	/* Succeed the command and update the bytes transferred counter */
+	CommandBlock.DataTransferLength = 0;
+}
@@ -68,6 +68,27 @@
 		/** Macro for the SCSI_Command_ReadWrite_10() function, to indicate that data is to be written to the storage medium. */
 		#define DATA_WRITE          false
 
+		/** Page code of the caching mode page, returned by SCSI_Command_Mode_Sense(). */
+		#define MODE_PAGE_CACHING   0x08
+
+		/** Page code requesting all mode pages in a MODE SENSE command. */
+		#define MODE_PAGE_ALL       0x3F
+
+		/** Page control value of a MODE SENSE command requesting the changeable values mask. */
+		#define MODE_PAGE_CONTROL_CHANGEABLE  1
+
+		/** Page control value of a MODE SENSE command requesting the saved values. */
+		#define MODE_PAGE_CONTROL_SAVED       3
+
+		/** Write protect bit in the device specific parameter of the mode parameter header. */
+		#define MODE_DEVICE_SPECIFIC_WP  (1 << 7)
+
+		/** Write Cache Enable bit in the third byte of the caching mode page. */
+		#define MODE_CACHING_WCE    (1 << 2)
+
+		/** Descriptor type of a READ FORMAT CAPACITIES response, indicating formatted media. */
+		#define FORMAT_DESCRIPTOR_FORMATTED  0x02
+
 		/** Value for the DeviceType entry in the SCSI_Inquiry_Response_t enum, indicating a Block Media device. */
 		#define DEVICE_TYPE_BLOCK   0x00
 		
@@ -144,6 +165,10 @@
 			static void SCSI_Command_Read_Capacity_10(void);
 			static void SCSI_Command_Send_Diagnostic(void);
 			static void SCSI_Command_ReadWrite_10(const bool IsDataRead);
+			static void SCSI_Write_Response(const void* Data, uint16_t DataLength, uint16_t AllocationLength);
+			static void SCSI_Command_Mode_Sense(const bool IsModeSense10);
+			static void SCSI_Command_Read_Format_Capacities(void);
+			static void SCSI_Command_Synchronize_Cache(void);
 		#endif
 		
 #endif
@@ -52,6 +52,9 @@
 		#define SCSI_CMD_VERIFY_10                             0x2F
 		#define SCSI_CMD_MODE_SENSE_6                          0x1A
 		#define SCSI_CMD_MODE_SENSE_10                         0x5A
+		#define SCSI_CMD_READ_FORMAT_CAPACITIES                0x23
+		#define SCSI_CMD_START_STOP_UNIT                       0x1B
+		#define SCSI_CMD_SYNCHRONIZE_CACHE_10                  0x35
 
 		#define SCSI_SENSE_KEY_GOOD                            0x00
 		#define SCSI_SENSE_KEY_RECOVERED_ERROR                 0x01
@@ -76,6 +79,8 @@
 		#define SCSI_ASENSE_INVALID_COMMAND                    0x20
 		#define SCSI_ASENSE_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE 0x21
 		#define SCSI_ASENSE_MEDIUM_NOT_PRESENT                 0x3A
+		#define SCSI_ASENSE_WRITE_ERROR                        0x0C
+		#define SCSI_ASENSE_UNRECOVERED_READ_ERROR             0x11
 
 		#define SCSI_ASENSEQ_NO_QUALIFIER                      0x00
 		#define SCSI_ASENSEQ_FORMAT_COMMAND_FAILED             0x01
@@ -0,0 +1,417 @@
+/** \file
+ *
+ *  Read-only status volume, the second Logical Unit of the device when it is built with STATUS_LUN = 1. The volume
+ *  is a small FAT12 image which only exists as the code below: every block is generated when the host reads it, so
+ *  the sensors are sampled right when STATUS.TXT is read and nothing on this LUN touches the SD card.
+ *
+ *  Layout, one block per cluster:
+ *    block 0      boot sector
+ *    block 1, 2   FAT and its copy
+ *    block 3      root directory (16 entries)
+ *    block 4      STATUS.TXT, cluster 2
+ *    block 5-7    CONFIG.TXT, clusters 3 to 5
+ *    block 8-63   free, read as zeroes
+ *
+ *  The size of both files is fixed in the directory, their text is padded with blanks to it. Hosts cache what they
+ *  have read, a fresh STATUS.TXT may need the volume to be ejected and mounted again.
+ */
+
+#define  INCLUDE_FROM_STATUSDISK_C
+#include "StatusDisk.h"
+
+#include "lib/INI/umeter_ini.h"
+#include "lib/Inputs/umeter_adc.h"
+#include "lib/Inputs/umeter_stats.h"
+#include "lib/Inputs/umeter_table.h"
+#include "lib/Inputs/umeter_sensor.h"
+#include "lib/Timer/umeter_clock.h"
+#include "lib/FatSD/sd_raw.h"
+
+/** Boot sector up to the end of the extended BIOS parameter block, the rest is zero but for the signature. */
+static const uint8_t BootSector[] PROGMEM =
+	{
+		0xEB, 0x3C, 0x90,                             /* Jump over the parameter block */
+		'U', 'M', 'E', 'T', 'E', 'R', ' ', ' ',       /* OEM name */
+		0x00, 0x02,                                   /* Bytes per sector */
+		1,                                            /* Sectors per cluster */
+		1, 0,                                         /* Reserved sectors, just this one */
+		2,                                            /* Number of FATs */
+		16, 0,                                        /* Root directory entries */
+		STATUS_DISK_BLOCKS, 0,                        /* Total sectors */
+		0xF8,                                         /* Media descriptor, fixed disk */
+		1, 0,                                         /* Sectors per FAT */
+		32, 0,                                        /* Sectors per track */
+		2, 0,                                         /* Heads */
+		0, 0, 0, 0,                                   /* Hidden sectors */
+		0, 0, 0, 0,                                   /* Total sectors, 32 bit */
+		0x80,                                         /* Drive number */
+		0,
+		0x29,                                         /* Extended boot signature */
+		'U', 'M', 'S', 'T',                           /* Volume serial number */
+		'U', 'M', 'E', 'T', 'E', 'R', ' ', 'S', 'T', 'A', 'T',
+		'F', 'A', 'T', '1', '2', ' ', ' ', ' ',
+	};
+
+/** Start of the FAT: the media descriptor entries, then STATUS.TXT in cluster 2 and CONFIG.TXT in clusters 3 -> 4 -> 5,
+ *  packed as 12 bit entries (0xFF8, 0xFFF, 0xFFF, 0x004, 0x005, 0xFFF).
+ */
+static const uint8_t FileAllocationTable[] PROGMEM =
+	{
+		0xF8, 0xFF, 0xFF, 0xFF, 0x4F, 0x00, 0x05, 0xF0, 0xFF,
+	};
+
+/** Entries of the root directory, the remaining ones are unused (zero). */
+static const StatusDisk_DirEntry_t RootDirectory[] PROGMEM =
+	{
+		{ .Name = "UMETER STAT", .Attributes = FAT_ATTRIBUTE_VOLUME, .Date = STATUS_FILE_DATE },
+		{ .Name = "STATUS  TXT", .Attributes = FAT_ATTRIBUTE_READONLY, .Date = STATUS_FILE_DATE,
+		  .Cluster = 2, .Size = STATUS_FILE_SIZE },
+		{ .Name = "CONFIG  TXT", .Attributes = FAT_ATTRIBUTE_READONLY, .Date = STATUS_FILE_DATE,
+		  .Cluster = 2 + (STATUS_BLOCK_CONFIG - STATUS_BLOCK_STATUS), .Size = CONFIG_FILE_SIZE },
+	};
+
+/** Names of the STATS_* flags, in the order of their bits and as umeter.ini spells them. */
+static const char StatsNames[][5] PROGMEM = { "min", "max", "mean", "rms" };
+
+/** Counters reported in STATUS.TXT, updated by the SCSI layer. */
+StatusDisk_Counters_t StatusCounters;
+
+/** Configuration and card size, read by StatusDisk_Init() before the host owns the card. */
+static const umeter_config* Config;
+static uint32_t CardMiB;
+static uint32_t CardFreeMiB;
+static bool     CardFreeKnown;
+
+/** Window of the generated file that goes out in the current block, see StatusDisk_WriteText(). */
+static uint16_t TextPos;
+static uint16_t WindowStart;
+static uint16_t WindowEnd;
+static uint16_t BlockBytes;
+
+/** One line of generated text. */
+static char Line[64];
+
+/** Reads everything the status volume shows about the card: the configuration and the free space. This reads the
+ *  card, so it has to run before the host gets access to it, but it never scans a FAT32 (see
+ *  SDCardManager_GetFreeKiB()) so the device enumerates without delay.
+ */
+void StatusDisk_Init(void)
+{
+	Config        = SDCardManager_GetConfig();
+	CardMiB       = SDCardManager_GetNbBlocks() / 2048;
+	CardFreeKnown = SDCardManager_GetFreeKiB(&CardFreeMiB);
+	CardFreeMiB  /= 1024;
+}
+
+/** Writes one byte of the current block to the selected data IN endpoint, sending full endpoint banks to the host.
+ *
+ *  \param[in] Byte  Next byte of the block
+ *
+ *  \return Boolean false if the transfer has to be given up, true otherwise
+ */
+static bool StatusDisk_WriteByte(const uint8_t Byte)
+{
+	/* Give up once the host has aborted the command */
+	if (IsMassStoreReset)
+	  return false;
+
+	/* Check if the endpoint is currently full */
+	if (!(Endpoint_IsReadWriteAllowed()))
+	{
+		/* Clear the endpoint bank to send its contents to the host */
+		Endpoint_ClearIN();
+
+		/* Wait until the endpoint is ready for more data */
+		if (Endpoint_WaitUntilReady())
+		  return false;
+	}
+
+	Endpoint_Write_Byte(Byte);
+	BlockBytes++;
+
+	return true;
+}
+
+/** Writes a table from program memory to the start of the current block.
+ *
+ *  \param[in] Table   Table in program memory
+ *  \param[in] Length  Size of the table in bytes
+ */
+static void StatusDisk_WriteTable(const uint8_t* Table, uint16_t Length)
+{
+	while (Length--)
+	{
+		if (!(StatusDisk_WriteByte(pgm_read_byte(Table++))))
+		  return;
+	}
+}
+
+/** Appends text to the file being generated. Only the part that falls into the block being read is sent.
+ *
+ *  \param[in] Text  Text to append
+ */
+static void StatusDisk_Put(const char* Text)
+{
+	while (*Text)
+	{
+		if ((TextPos >= WindowStart) && (TextPos < WindowEnd))
+		  StatusDisk_WriteByte(*Text);
+
+		TextPos++;
+		Text++;
+	}
+}
+
+/** Sends one block of a generated file. The whole text is generated up to the end of the block, as the length of the
+ *  lines before it isn't known; text past the file size is cut off and the file is padded with blanks.
+ *
+ *  \param[in] Generate  Function generating the text of the file with StatusDisk_Put()
+ *  \param[in] Offset    Offset of the block in the file
+ *  \param[in] Size      File size
+ */
+static void StatusDisk_WriteText(void (*Generate)(void), uint16_t Offset, uint16_t Size)
+{
+	TextPos     = 0;
+	WindowStart = Offset;
+	WindowEnd   = ((Size - Offset) < VIRTUAL_MEMORY_BLOCK_SIZE) ? Size : (Offset + VIRTUAL_MEMORY_BLOCK_SIZE);
+
+	Generate();
+
+	if (TextPos < WindowStart)
+	  TextPos = WindowStart;
+
+	/* Pad the file with blanks, ending it with a line break */
+	while (TextPos < WindowEnd)
+	{
+		StatusDisk_WriteByte((TextPos == (Size - 1)) ? '\n' : ' ');
+		TextPos++;
+	}
+}
+
+/** Generates STATUS.TXT: uptime, the current sensor readings, the card and the counters, including card failures. */
+static void StatusDisk_StatusText(void)
+{
+	uint32_t Seconds = clock_ms() / 1000;
+	struct sd_raw_errors Errors;
+	char     Value[12];
+	char     Volts[12];
+	uint16_t Code;
+	uint8_t  j;
+
+	snprintf_P(Line, sizeof(Line), PSTR("UMeter status\r\n\r\nuptime: %lud %02u:%02u:%02u\r\n"),
+	           (unsigned long)(Seconds / 86400), (uint16_t)((Seconds / 3600) % 24),
+	           (uint16_t)((Seconds / 60) % 60), (uint16_t)(Seconds % 60));
+	StatusDisk_Put(Line);
+
+	if (CardMiB && CardFreeKnown)
+	  snprintf_P(Line, sizeof(Line), PSTR("card: %lu MiB, %lu MiB free at power up\r\n\r\n"),
+	             (unsigned long)CardMiB, (unsigned long)CardFreeMiB);
+	else if (CardMiB)
+	  snprintf_P(Line, sizeof(Line), PSTR("card: %lu MiB\r\n\r\n"), (unsigned long)CardMiB);
+	else
+	  snprintf_P(Line, sizeof(Line), PSTR("card: not found\r\n\r\n"));
+	StatusDisk_Put(Line);
+
+	for (j = 0; j < 4; j++)
+	{
+		if (Config && !(Config->sensors[j].enabled))
+		{
+			snprintf_P(Line, sizeof(Line), PSTR("sensor %u: disabled\r\n"), (j + 1));
+			StatusDisk_Put(Line);
+			continue;
+		}
+
+		if (Config)
+		{
+			Code = sensor_conversion(j, &Config->sensors[j]);
+			float2str(Code * sensor_volts_per_code(&Config->sensors[j]), Volts);
+		}
+		else
+		{
+			select_sensor(j + 1);
+			Code = adc_conversion();
+			float2str(Code * ADC_VOLTS_PER_CODE, Volts);
+		}
+		StatusCounters.Samples++;
+
+		if (Config && !(Config->sensors[j].raw_output))
+		{
+			if (Config->sensors[j].table)
+			  float2str(table_value(j, &Config->sensors[j], Code), Value);
+			else
+			  float2str((Code * sensor_volts_per_code(&Config->sensors[j]) - Config->sensors[j].offset) /
+			            Config->sensors[j].slope, Value);
+			snprintf_P(Line, sizeof(Line), PSTR("sensor %u: %s%s (%sV, code %u)\r\n"), (j + 1), Value, Config->sensors[j].units,
+			           Volts, Code);
+		}
+		else
+		{
+			snprintf_P(Line, sizeof(Line), PSTR("sensor %u: %sV (code %u)\r\n"), (j + 1), Volts, Code);
+		}
+		StatusDisk_Put(Line);
+	}
+
+	snprintf_P(Line, sizeof(Line), PSTR("\r\nsamples: %lu\r\nlog events lost: %lu\r\n"),
+	           (unsigned long)StatusCounters.Samples, (unsigned long)log_lost());
+	StatusDisk_Put(Line);
+	snprintf_P(Line, sizeof(Line), PSTR("blocks read: %lu\r\nblocks written: %lu\r\n"),
+	           (unsigned long)StatusCounters.BlocksRead, (unsigned long)StatusCounters.BlocksWritten);
+	StatusDisk_Put(Line);
+	snprintf_P(Line, sizeof(Line), PSTR("failed commands: %u\r\n"), StatusCounters.FailedCommands);
+	StatusDisk_Put(Line);
+
+	sd_raw_get_errors(&Errors);
+	snprintf_P(Line, sizeof(Line), PSTR("card errors: cmd %u, timeout %u, data %u, init %u\r\n"),
+	           Errors.command, Errors.timeout, Errors.data, Errors.init);
+	StatusDisk_Put(Line);
+}
+
+/** Generates CONFIG.TXT: the configuration in effect, in the format of umeter.ini. */
+static void StatusDisk_ConfigText(void)
+{
+	char    Value[12];
+	uint8_t j, k;
+
+	if (!(Config))
+	{
+		StatusDisk_Put("; no valid umeter.ini on the card\r\n");
+		return;
+	}
+
+	StatusDisk_Put("; in effect since power up\r\n\r\n[UMeter]\r\n");
+	strcpy_P(Value, (Config->format == FORMAT_DELTA) ? PSTR("delta") : PSTR("text"));
+	snprintf_P(Line, sizeof(Line), PSTR("sampling_interval=%u\r\nformat=%s\r\nverbosity=%u\r\n"),
+	           Config->sampling_interval, Value, Config->verbosity);
+	StatusDisk_Put(Line);
+	snprintf_P(Line, sizeof(Line), PSTR("sync_blocks=%u\r\ncardtest=%u\r\nmanifest=%u\r\n"),
+	           Config->sync_blocks, Config->cardtest, Config->manifest);
+	StatusDisk_Put(Line);
+
+	for (j = 0; j < 4; j++)
+	{
+		const sensor* Sensor = &Config->sensors[j];
+
+		snprintf_P(Line, sizeof(Line), PSTR("\r\n[Sensor %u]\r\nenabled=%u\r\n"), (j + 1), Sensor->enabled);
+		StatusDisk_Put(Line);
+		if (!(Sensor->enabled))
+		  continue;
+
+		snprintf_P(Line, sizeof(Line), PSTR("raw_output=%u\r\ninterval=%u\r\nwindow=%u\r\nstats="), Sensor->raw_output,
+		           Sensor->interval, Sensor->window);
+		StatusDisk_Put(Line);
+		for (k = 0; k < 4; k++)
+		{
+			if (!(Sensor->stats & (1 << k)))
+			  continue;
+
+			strcpy_P(Line, StatsNames[k]);
+			StatusDisk_Put(Line);
+			if (Sensor->stats >> (k + 1))
+			  StatusDisk_Put(",");
+		}
+		StatusDisk_Put("\r\n");
+		if (Sensor->adc != ADC_INTERNAL)
+		{
+			snprintf_P(Line, sizeof(Line), PSTR("adc=mcp3208:%u\r\n"), Sensor->adc - ADC_MCP3208);
+			StatusDisk_Put(Line);
+		}
+
+		if (Sensor->raw_output)
+		  continue;
+
+		if (Sensor->table)
+		{
+			StatusDisk_Put("table=");
+			for (k = 0; k < Sensor->table; k++)
+			{
+				table_point_str(Sensor, k, Line);
+				StatusDisk_Put(Line);
+				if (k + 1 < Sensor->table)
+				  StatusDisk_Put(",");
+			}
+			snprintf_P(Line, sizeof(Line), PSTR("\r\nunits=%s\r\n"), Sensor->units);
+			StatusDisk_Put(Line);
+			continue;
+		}
+
+		float2str(Sensor->offset, Value);
+		snprintf_P(Line, sizeof(Line), PSTR("offset=%s\r\n"), Value);
+		StatusDisk_Put(Line);
+		float2str(Sensor->slope, Value);
+		snprintf_P(Line, sizeof(Line), PSTR("slope=%s\r\nunits=%s\r\n"), Value, Sensor->units);
+		StatusDisk_Put(Line);
+	}
+
+	snprintf_P(Line, sizeof(Line), PSTR("\r\n[Trigger]\r\nenabled=%u\r\n"), Config->trigger.enabled);
+	StatusDisk_Put(Line);
+	if (!(Config->trigger.enabled))
+	  return;
+
+	strcpy_P(Value, (Config->trigger.edge == TRIGGER_FALLING) ? PSTR("falling") : PSTR("rising"));
+	snprintf_P(Line, sizeof(Line), PSTR("sensor=%u\r\nedge=%s\r\n"), Config->trigger.sensor, Value);
+	StatusDisk_Put(Line);
+	float2str(Config->trigger.level * sensor_volts_per_code(&Config->sensors[Config->trigger.sensor - 1]), Value);
+	snprintf_P(Line, sizeof(Line), PSTR("level=%s\r\n"), Value);
+	StatusDisk_Put(Line);
+	float2str(Config->trigger.hysteresis * sensor_volts_per_code(&Config->sensors[Config->trigger.sensor - 1]), Value);
+	snprintf_P(Line, sizeof(Line), PSTR("hysteresis=%s\r\npre=%u\r\npost=%u\r\n"), Value, Config->trigger.pre, Config->trigger.post);
+	StatusDisk_Put(Line);
+}
+
+/** Reads blocks of the status volume into the pre-selected data IN endpoint, generating each of them.
+ *
+ *  \param[in] BlockAddress  Data block starting address for the read sequence
+ *  \param[in] TotalBlocks   Number of blocks of data to read
+ */
+void StatusDisk_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks)
+{
+	/* Wait until endpoint is ready before continuing */
+	if (Endpoint_WaitUntilReady())
+	  return;
+
+	while (TotalBlocks)
+	{
+		BlockBytes = 0;
+
+		if (BlockAddress == STATUS_BLOCK_BOOT)
+		  StatusDisk_WriteTable(BootSector, sizeof(BootSector));
+		else if ((BlockAddress == STATUS_BLOCK_FAT) || (BlockAddress == (STATUS_BLOCK_FAT + 1)))
+		  StatusDisk_WriteTable(FileAllocationTable, sizeof(FileAllocationTable));
+		else if (BlockAddress == STATUS_BLOCK_ROOT)
+		  StatusDisk_WriteTable((const uint8_t*)RootDirectory, sizeof(RootDirectory));
+		else if (BlockAddress == STATUS_BLOCK_STATUS)
+		  StatusDisk_WriteText(StatusDisk_StatusText, 0, STATUS_FILE_SIZE);
+		else if ((BlockAddress >= STATUS_BLOCK_CONFIG) &&
+		         (BlockAddress < (STATUS_BLOCK_CONFIG + CONFIG_FILE_SIZE / VIRTUAL_MEMORY_BLOCK_SIZE)))
+		  StatusDisk_WriteText(StatusDisk_ConfigText, ((BlockAddress - STATUS_BLOCK_CONFIG) * VIRTUAL_MEMORY_BLOCK_SIZE),
+		                       CONFIG_FILE_SIZE);
+
+		/* Fill the rest of the block with zeroes, ending the boot sector with its signature */
+		while (BlockBytes < VIRTUAL_MEMORY_BLOCK_SIZE)
+		{
+			uint8_t Byte = 0x00;
+
+			if (BlockAddress == STATUS_BLOCK_BOOT)
+			{
+				if (BlockBytes == (VIRTUAL_MEMORY_BLOCK_SIZE - 2))
+				  Byte = 0x55;
+				else if (BlockBytes == (VIRTUAL_MEMORY_BLOCK_SIZE - 1))
+				  Byte = 0xAA;
+			}
+
+			if (!(StatusDisk_WriteByte(Byte)))
+			  return;
+		}
+
+		/* Check if the current command is being aborted by the host */
+		if (IsMassStoreReset)
+		  return;
+
+		BlockAddress++;
+		TotalBlocks--;
+	}
+
+	/* If the endpoint is full, send its contents to the host */
+	if (!(Endpoint_IsReadWriteAllowed()))
+	  Endpoint_ClearIN();
+}
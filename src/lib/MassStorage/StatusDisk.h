@@ -0,0 +1,92 @@
+/** \file
+ *
+ *  Header file for StatusDisk.c.
+ */
+
+#ifndef _STATUS_DISK_H_
+#define _STATUS_DISK_H_
+
+	/* Includes: */
+		#include <avr/io.h>
+		#include <avr/pgmspace.h>
+		#include <stdio.h>
+
+		#include <LUFA/Common/Common.h>
+		#include <LUFA/Drivers/USB/USB.h>
+
+		#include "UMeter.h"
+		#include "lib/FatSD/SDCardManager.h"
+
+	/* Macros: */
+		/** Total number of blocks of the status volume. */
+		#define STATUS_DISK_BLOCKS         64
+
+		/** Block holding the boot sector and BIOS parameter block of the status volume. */
+		#define STATUS_BLOCK_BOOT          0
+
+		/** Block holding the FAT of the status volume, the copy follows it. */
+		#define STATUS_BLOCK_FAT           1
+
+		/** Block holding the root directory of the status volume. */
+		#define STATUS_BLOCK_ROOT          3
+
+		/** First block of STATUS.TXT, cluster 2 of the status volume. */
+		#define STATUS_BLOCK_STATUS        4
+
+		/** First block of CONFIG.TXT, clusters 3 to 5 of the status volume. */
+		#define STATUS_BLOCK_CONFIG        5
+
+		/** Size of STATUS.TXT in the directory, the generated text is padded to it. */
+		#define STATUS_FILE_SIZE           512
+
+		/** Size of CONFIG.TXT in the directory, the generated text is padded to it. */
+		#define CONFIG_FILE_SIZE           1536
+
+		/** Date of both files, 2010-01-01, as the device has no real time clock. */
+		#define STATUS_FILE_DATE           (((2010 - 1980) << 9) | (1 << 5) | 1)
+
+		/** Attribute of a FAT directory entry marking a read-only file. */
+		#define FAT_ATTRIBUTE_READONLY     0x01
+
+		/** Attribute of a FAT directory entry holding the volume label. */
+		#define FAT_ATTRIBUTE_VOLUME       0x08
+
+	/* Type Defines: */
+		/** Type define for a FAT directory entry, as stored in the root directory block of the status volume. */
+		typedef struct
+		{
+			char     Name[11];
+			uint8_t  Attributes;
+			uint8_t  _RESERVED1[10];
+			uint16_t Time;
+			uint16_t Date;
+			uint16_t Cluster;
+			uint32_t Size;
+		} StatusDisk_DirEntry_t;
+
+		/** Type define for the counters reported in STATUS.TXT. */
+		typedef struct
+		{
+			uint32_t BlocksRead; /**< Blocks of the SD card read by the host */
+			uint32_t BlocksWritten; /**< Blocks of the SD card written by the host */
+			uint32_t Samples; /**< Sensor conversions taken for STATUS.TXT */
+			uint16_t FailedCommands; /**< SCSI commands that failed, on either LUN */
+		} StatusDisk_Counters_t;
+
+	/* Global Variables: */
+		extern StatusDisk_Counters_t StatusCounters;
+
+	/* Function Prototypes: */
+		void StatusDisk_Init(void);
+		void StatusDisk_ReadBlocks(uint32_t BlockAddress, uint16_t TotalBlocks);
+
+		#if defined(INCLUDE_FROM_STATUSDISK_C)
+			static bool StatusDisk_WriteByte(const uint8_t Byte);
+			static void StatusDisk_WriteTable(const uint8_t* Table, uint16_t Length);
+			static void StatusDisk_Put(const char* Text);
+			static void StatusDisk_WriteText(void (*Generate)(void), uint16_t Offset, uint16_t Size);
+			static void StatusDisk_StatusText(void);
+			static void StatusDisk_ConfigText(void);
+		#endif
+
+#endif
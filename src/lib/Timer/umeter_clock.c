@@ -0,0 +1,30 @@
+#include "umeter_clock.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+static volatile uint32_t ms;
+
+ISR(TIMER0_COMPA_vect)
+{
+	ms++;
+}
+
+void clock_init(void)
+{
+	TCCR0A = (1 << WGM01);					// CTC, TOP = OCR0A
+	TCCR0B = (1 << CS01) | (1 << CS00);		// clk/64
+	OCR0A = F_CPU / 64 / 1000 - 1;			// 1 kHz
+	TIMSK0 |= (1 << OCIE0A);
+}
+
+uint32_t clock_ms(void)
+{
+	uint32_t now;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = ms;
+	}
+	return now;
+}
@@ -0,0 +1,12 @@
+#ifndef __UMETER_CLOCK_H__
+#define __UMETER_CLOCK_H__
+
+#include <stdint.h>
+
+// Millisecond tick on Timer0, counting once interrupts are enabled. Wraps
+// after 49 days, compare times by difference.
+
+void clock_init(void);
+uint32_t clock_ms(void);
+
+#endif
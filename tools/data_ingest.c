@@ -0,0 +1,937 @@
+/*
+ * data_ingest: convert UMeter logs to CSV or to one binary array per column,
+ * fast enough for months of records at a time.
+ *
+ * usage: data_ingest [-c umeter.ini] [-f csv|columns] [-j jobs] [-o dir] file...
+ *        data_ingest [-c umeter.ini] [-f csv|columns] [-j jobs] [-o dir]
+ *                    -i card.img [name...]
+ *
+ * Every file is a text log (umeter.txt) or a delta log (umeter.dlt), told
+ * apart by the header of the first block. Files are mapped instead of read
+ * and converted by up to -j threads at once, one file each, so a pile of
+ * logs copied off the card over the weeks converts on all cores.
+ *
+ * -c ini       the config the logs were written with. In a text log it gives
+ *              the values per sensor (its stats), one otherwise; in a delta
+ *              log it converts the ADC codes like the logger would (see
+ *              delta_decode), raw codes otherwise.
+ * -f csv       (default) <dir>/<file>.csv, a row per record: record number,
+ *              channel mask, then a column per sensor and stat which is empty
+ *              if the sensor has no value in the record
+ * -f columns   <dir>/<file>.<column>.f64 with the values of one column as
+ *              little-endian doubles, and <dir>/<file>.sN.u32 with the record
+ *              numbers of sensor N's values
+ * -j jobs      files converted at once, default the number of cores
+ * -o dir       output directory, default the current one; "-o -" writes CSV
+ *              to stdout, one file after the other
+ * -i image     read the files from the root directory of a card image through
+ *              the firmware's own FAT code; the names default to umeter.txt
+ *              and umeter.dlt, whichever exist
+ *
+ * Records are numbered from 0 in each file. A text line which doesn't parse
+ * (an old log written with other stats, a cut off last line) is skipped and
+ * counted, so is a block of a delta log without a valid header.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ini.h"
+
+/* the FAT code is built with -fpack-struct like the firmware */
+#pragma pack(push, 1)
+#include "partition.h"
+#include "fat.h"
+#pragma pack(pop)
+
+#define BLOCK_SIZE		512
+#define HEADER_SIZE		16
+#define VERSION			1
+
+// keep in sync with ADC_VOLTS_PER_CODE in src/lib/Inputs/umeter_adc.h and
+// MCP3208_VOLTS_PER_CODE in src/lib/Inputs/umeter_mcp3208.h
+#define VOLTS_PER_CODE		(2.56 / 1023 * 2)
+#define MCP3208_VOLTS_PER_CODE	(2.048 / 4096 * 2)
+
+// keep in sync with STATS_* in src/lib/Inputs/umeter_stats.h, in the order
+// the values are written
+#define STATS_COUNT		4
+#define STATS_MEAN		0x04
+
+#define MAX_VALUES		(4 * STATS_COUNT)
+#define CSV_BUFFER		(1 << 20)
+#define COLUMN_BUFFER	8192
+
+static const char* stat_names[STATS_COUNT] = {"min", "max", "mean", "rms"};
+
+typedef struct
+{
+	int stats;
+	int raw_output;
+	double offset;
+	double slope;
+	double volts_per_code;		// of the sensor's ADC, for delta logs
+} sensor_config;
+
+static sensor_config sensors[4] = {
+	{STATS_MEAN, 1, 0.0, 1.0, VOLTS_PER_CODE}, {STATS_MEAN, 1, 0.0, 1.0, VOLTS_PER_CODE},
+	{STATS_MEAN, 1, 0.0, 1.0, VOLTS_PER_CODE}, {STATS_MEAN, 1, 0.0, 1.0, VOLTS_PER_CODE}
+};
+static int calibrate = 0;
+
+enum
+{
+	OUTPUT_CSV = 0,
+	OUTPUT_COLUMNS
+};
+
+static int output = OUTPUT_CSV;
+static const char* out_dir = ".";
+
+typedef struct
+{
+	const char* name;		// as given, for messages
+	const char* base;		// file name the output is named after
+	const uint8_t* data;
+	size_t size;
+	int mapped;				// data is mapped, malloc()ed when read from an image
+	int required;			// named on the command line
+	// results
+	unsigned long records;
+	unsigned long bad;
+	int failed;
+} input_file;
+
+static input_file* files;
+static int file_count;
+static int next_file = 0;
+
+static pthread_mutex_t stdout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Values are kept in thousandths: the text log has three decimals and the
+ * delta log is printed with as many, so every output is exact. */
+
+typedef struct
+{
+	FILE* values;
+	double buf[COLUMN_BUFFER];
+	int n;
+} column;
+
+typedef struct
+{
+	input_file* in;
+	int delta;
+	int decimals;			// 0 for raw ADC codes
+	int count[4];			// values per sensor in a record
+	// csv
+	FILE* csv;
+	char* buf;
+	size_t len;
+	// columns
+	column columns[MAX_VALUES];
+	FILE* records[4];
+	uint32_t rec_buf[4][COLUMN_BUFFER];
+	int rec_n[4];
+} sink;
+
+static int popcount(int x)
+{
+	int n = 0;
+	for(; x; x &= x - 1) {
+		n++;
+	}
+	return n;
+}
+
+static int ini_handler(void* user, const char* section, const char* name, const char* value)
+{
+	int i, j, mask = 0;
+	const char* p;
+	size_t len;
+	(void) user;
+	if(sscanf(section, "Sensor %d", &j) != 1 || j < 1 || j > 4) {
+		return 1;
+	}
+	j--;
+	if(strcmp(name, "raw_output") == 0) {
+		sensors[j].raw_output = atoi(value);
+	} else if(strcmp(name, "offset") == 0) {
+		sensors[j].offset = atof(value);
+	} else if(strcmp(name, "slope") == 0 && atof(value) != 0) {
+		sensors[j].slope = atof(value);
+	} else if(strcmp(name, "adc") == 0) {
+		sensors[j].volts_per_code = strncmp(value, "mcp3208:", 8) == 0 ? MCP3208_VOLTS_PER_CODE : VOLTS_PER_CODE;
+	} else if(strcmp(name, "stats") == 0) {
+		// like stats_parse(), the logger keeps its default on anything else
+		for(p = value; *p; p += len + (p[len] == ',')) {
+			len = strcspn(p, ",");
+			for(i = 0; i < STATS_COUNT; i++) {
+				if(len == strlen(stat_names[i]) && strncmp(p, stat_names[i], len) == 0) {
+					mask |= 1 << i;
+					break;
+				}
+			}
+			if(i == STATS_COUNT) {
+				return 1;
+			}
+		}
+		if(mask) {
+			sensors[j].stats = mask;
+		}
+	}
+	return 1;
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static int is_delta(const input_file* in)
+{
+	return in->size >= HEADER_SIZE && in->data[0] == 'U' && in->data[1] == 'D' &&
+		in->data[2] == VERSION;
+}
+
+/* output */
+
+static FILE* open_output(const input_file* in, const char* suffix)
+{
+	char path[1024];
+	FILE* f;
+
+	snprintf(path, sizeof(path), "%s/%s.%s", out_dir, in->base, suffix);
+	f = fopen(path, "wb");
+	if(!f) {
+		perror(path);
+	}
+	return f;
+}
+
+static void csv_flush(sink* s)
+{
+	if(s->len && s->csv && fwrite(s->buf, 1, s->len, s->csv) != s->len) {
+		s->in->failed = 1;
+	}
+	s->len = 0;
+}
+
+// Append 'v' thousandths with 'decimals' (3 or 0) decimals.
+static char* format_milli(char* p, int64_t v, int decimals)
+{
+	char digits[24];
+	uint64_t u;
+	int n = 0;
+
+	if(v < 0) {
+		*p++ = '-';
+		u = -(uint64_t)v;
+	}
+	else {
+		u = v;
+	}
+	if(!decimals) {
+		u /= 1000;
+	}
+	do {
+		digits[n++] = '0' + u % 10;
+		u /= 10;
+	} while(u || (decimals && n < 4));
+	while(n > 0) {
+		*p++ = digits[--n];
+		if(decimals && n == 3) {
+			*p++ = '.';
+		}
+	}
+	return p;
+}
+
+static void column_put(sink* s, column* c, double v)
+{
+	c->buf[c->n++] = v;
+	if(c->n == COLUMN_BUFFER) {
+		if(c->values && fwrite(c->buf, sizeof(double), c->n, c->values) != (size_t)c->n) {
+			s->in->failed = 1;
+		}
+		c->n = 0;
+	}
+}
+
+static void records_put(sink* s, int j, uint32_t record)
+{
+	s->rec_buf[j][s->rec_n[j]++] = record;
+	if(s->rec_n[j] == COLUMN_BUFFER) {
+		if(s->records[j] &&
+			fwrite(s->rec_buf[j], sizeof(uint32_t), s->rec_n[j], s->records[j]) != (size_t)s->rec_n[j]) {
+			s->in->failed = 1;
+		}
+		s->rec_n[j] = 0;
+	}
+}
+
+// Name of value 'k' of sensor 'j', "s1_mean" or "s1" for a delta log.
+static void column_name(const sink* s, int j, int k, char* name, size_t size)
+{
+	int i;
+
+	if(s->delta) {
+		snprintf(name, size, "s%d", j + 1);
+		return;
+	}
+	for(i = 0; i < STATS_COUNT; i++) {
+		if((sensors[j].stats & (1 << i)) && k-- == 0) {
+			break;
+		}
+	}
+	snprintf(name, size, "s%d_%s", j + 1, stat_names[i]);
+}
+
+static int sink_open(sink* s, input_file* in, int delta)
+{
+	char name[32];
+	int j, k, c = 0;
+
+	memset(s, 0, sizeof(*s));
+	s->in = in;
+	s->delta = delta;
+	s->decimals = !delta || calibrate ? 3 : 0;
+	for(j = 0; j < 4; j++) {
+		s->count[j] = delta ? 1 : popcount(sensors[j].stats);
+	}
+
+	if(output == OUTPUT_CSV) {
+		s->buf = malloc(CSV_BUFFER);
+		if(!s->buf) {
+			return 0;
+		}
+		if(strcmp(out_dir, "-") == 0) {
+			pthread_mutex_lock(&stdout_lock);
+			s->csv = stdout;
+		}
+		else if(!(s->csv = open_output(in, "csv"))) {
+			return 0;
+		}
+		s->len = sprintf(s->buf, "record,mask");
+		for(j = 0; j < 4; j++) {
+			for(k = 0; k < s->count[j]; k++) {
+				column_name(s, j, k, name, sizeof(name));
+				s->len += sprintf(s->buf + s->len, ",%s", name);
+			}
+		}
+		s->buf[s->len++] = '\n';
+		return 1;
+	}
+
+	for(j = 0; j < 4; j++) {
+		snprintf(name, sizeof(name), "s%d.u32", j + 1);
+		if(!(s->records[j] = open_output(in, name))) {
+			return 0;
+		}
+		for(k = 0; k < s->count[j]; k++, c++) {
+			column_name(s, j, k, name, sizeof(name) - 4);
+			strcat(name, ".f64");
+			if(!(s->columns[c].values = open_output(in, name))) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// One record, 'v' holds the values of the sensors in 'mask' one after the
+// other.
+static void sink_record(sink* s, uint32_t record, uint8_t mask, const int64_t* v)
+{
+	char* p;
+	int j, k, c = 0;
+
+	if(output == OUTPUT_CSV) {
+		if(s->len > CSV_BUFFER - 512) {
+			csv_flush(s);
+		}
+		p = s->buf + s->len;
+		p = format_milli(p, record * 1000LL, 0);
+		*p++ = ',';
+		*p++ = "0123456789ABCDEF"[mask & 0xF];
+		for(j = 0; j < 4; j++) {
+			for(k = 0; k < s->count[j]; k++) {
+				*p++ = ',';
+				if(mask & (1 << j)) {
+					p = format_milli(p, *v++, s->decimals);
+				}
+			}
+		}
+		*p++ = '\n';
+		s->len = p - s->buf;
+		return;
+	}
+
+	for(j = 0; j < 4; j++) {
+		if(!(mask & (1 << j))) {
+			c += s->count[j];
+			continue;
+		}
+		records_put(s, j, record);
+		for(k = 0; k < s->count[j]; k++, c++) {
+			column_put(s, &s->columns[c], *v++ / 1000.0);
+		}
+	}
+}
+
+static void sink_close(sink* s)
+{
+	int j, c;
+
+	if(output == OUTPUT_CSV) {
+		csv_flush(s);
+		if(s->csv == stdout) {
+			fflush(stdout);
+			pthread_mutex_unlock(&stdout_lock);
+		}
+		else if(s->csv && fclose(s->csv) != 0) {
+			s->in->failed = 1;
+		}
+		free(s->buf);
+		return;
+	}
+	for(c = 0; c < MAX_VALUES; c++) {
+		if(!s->columns[c].values) {
+			continue;
+		}
+		if(fwrite(s->columns[c].buf, sizeof(double), s->columns[c].n, s->columns[c].values) !=
+			(size_t)s->columns[c].n || fclose(s->columns[c].values) != 0) {
+			s->in->failed = 1;
+		}
+	}
+	for(j = 0; j < 4; j++) {
+		if(!s->records[j]) {
+			continue;
+		}
+		if(fwrite(s->rec_buf[j], sizeof(uint32_t), s->rec_n[j], s->records[j]) !=
+			(size_t)s->rec_n[j] || fclose(s->records[j]) != 0) {
+			s->in->failed = 1;
+		}
+	}
+}
+
+/* text logs */
+
+// Parse a value written by float2str(): "%d.%03d " of the integer part and
+// of the thousandths left over, both with the sign of the value, so -0.5 is
+// "0.-500" and -1.25 is "-1.-250". Returns the position after the space or
+// NULL.
+static const uint8_t* parse_value(const uint8_t* p, const uint8_t* end, int64_t* v)
+{
+	int64_t left = 0;
+	int32_t right = 0;
+	uint32_t w;
+	int neg = 0;
+
+	if(p < end && *p == '-') {
+		neg = 1;
+		p++;
+	}
+	if(p >= end || (uint8_t)(*p - '0') > 9) {
+		return NULL;
+	}
+	do {
+		left = left * 10 + (*p++ - '0');
+	} while(p < end && (uint8_t)(*p - '0') <= 9);
+	if(neg) {
+		left = -left;
+	}
+	if(p >= end || *p++ != '.') {
+		return NULL;
+	}
+
+	// almost always three digits and the space: check and convert the four
+	// bytes at once
+	if(end - p >= 4) {
+		memcpy(&w, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		w = __builtin_bswap32(w);
+#endif
+		if((w & 0xFFF0F0F0) == 0x20303030 && ((w + 0x00060606) & 0x00F0F0F0) == 0x00303030) {
+			*v = left * 1000 + (w & 0xF) * 100 + ((w >> 8) & 0xF) * 10 + ((w >> 16) & 0xF);
+			return p + 4;
+		}
+	}
+
+	// negative or wider than three digits (a value beyond the range of int)
+	neg = 0;
+	if(p < end && *p == '-') {
+		neg = 1;
+		p++;
+	}
+	if(p >= end || (uint8_t)(*p - '0') > 9) {
+		return NULL;
+	}
+	do {
+		right = right * 10 + (*p++ - '0');
+	} while(p < end && (uint8_t)(*p - '0') <= 9 && right < 100000000);
+	if(p >= end || *p != ' ') {
+		return NULL;
+	}
+	*v = left * 1000 + (neg ? -right : right);
+	return p + 1;
+}
+
+// Parse the record starting at 'p' into 'mask' and 'v'. Returns the start of
+// the next line or NULL if the record is broken.
+static const uint8_t* parse_record(const sink* s, const uint8_t* p, const uint8_t* end,
+	uint8_t* mask, int64_t* v)
+{
+	int j, k;
+
+	if(end - p >= 2 && p[1] == ' ' && (uint8_t)(p[0] - '1') <= 8) {
+		*mask = p[0] - '0';
+	}
+	else if(end - p >= 2 && p[1] == ' ' && (uint8_t)(p[0] - 'A') <= 5) {
+		*mask = p[0] - 'A' + 10;
+	}
+	else {
+		return NULL;
+	}
+	p += 2;
+	for(j = 0; j < 4; j++) {
+		if(!(*mask & (1 << j))) {
+			continue;
+		}
+		for(k = 0; k < s->count[j]; k++) {
+			if(!(p = parse_value(p, end, v++))) {
+				return NULL;
+			}
+		}
+	}
+	if(p >= end || *p != '\n') {
+		return NULL;
+	}
+	return p + 1;
+}
+
+static void convert_text(sink* s)
+{
+	const uint8_t* p = s->in->data;
+	const uint8_t* end = p + s->in->size;
+	const uint8_t* next;
+	int64_t v[MAX_VALUES];
+	uint8_t mask;
+
+	while(p < end) {
+		next = parse_record(s, p, end, &mask, v);
+		if(next) {
+			sink_record(s, s->in->records++, mask, v);
+			p = next;
+			continue;
+		}
+		// skip to the next line, a cut off line at the end is dropped
+		s->in->bad++;
+		next = memchr(p, '\n', end - p);
+		p = next ? next + 1 : end;
+	}
+}
+
+/* delta logs, see src/lib/Inputs/umeter_delta.h */
+
+static int64_t delta_value(const sink* s, int j, uint16_t code)
+{
+	double v;
+
+	if(!calibrate) {
+		return code * 1000LL;
+	}
+	v = code * sensors[j].volts_per_code;
+	if(!sensors[j].raw_output) {
+		v = (v - sensors[j].offset) / sensors[j].slope;
+	}
+	return llround(v * 1000);
+}
+
+// Returns 0 if the block isn't a valid delta block.
+static int convert_block(sink* s, const uint8_t* block)
+{
+	uint16_t last[4];
+	int64_t v[4];
+	const uint8_t* p = block + HEADER_SIZE;
+	const uint8_t* end = block + BLOCK_SIZE;
+	uint16_t d;
+	uint8_t mask;
+	int j, n, shift;
+
+	if(block[0] != 'U' || block[1] != 'D' || block[2] != VERSION) {
+		return 0;
+	}
+	for(j = 0; j < 4; j++) {
+		last[j] = get16(block + 8 + 2 * j);
+	}
+
+	while(p < end && (mask = *p++) != 0) {
+		for(j = 0, n = 0; j < 4; j++) {
+			if(!(mask & (1 << j))) {
+				continue;
+			}
+			d = 0;
+			shift = 0;
+			do {
+				if(p >= end) {
+					return 0;
+				}
+				d |= (*p & 0x7F) << shift;
+				shift += 7;
+			} while(*p++ & 0x80);
+			last[j] += (int16_t)((d >> 1) ^ -(d & 1));
+			v[n++] = delta_value(s, j, last[j]);
+		}
+		sink_record(s, s->in->records++, mask, v);
+	}
+	return 1;
+}
+
+static void convert_delta(sink* s)
+{
+	uint8_t block[BLOCK_SIZE];
+	size_t i;
+
+	for(i = 0; i < s->in->size; i += BLOCK_SIZE) {
+		if(s->in->size - i >= BLOCK_SIZE) {
+			if(!convert_block(s, s->in->data + i)) {
+				s->in->bad++;
+			}
+			continue;
+		}
+		// a trailing partial block is still decoded, the zero fill ends it
+		memset(block, 0, sizeof(block));
+		memcpy(block, s->in->data + i, s->in->size - i);
+		if(!convert_block(s, block)) {
+			s->in->bad++;
+		}
+	}
+}
+
+static void* worker(void* arg)
+{
+	input_file* in;
+	sink* s;
+	int i;
+	(void) arg;
+
+	s = malloc(sizeof(*s));
+	if(!s) {
+		return NULL;
+	}
+	while((i = __sync_fetch_and_add(&next_file, 1)) < file_count) {
+		in = &files[i];
+		if(!in->data) {
+			continue;
+		}
+		if(sink_open(s, in, is_delta(in))) {
+			if(is_delta(in)) {
+				convert_delta(s);
+			}
+			else {
+				convert_text(s);
+			}
+		}
+		else {
+			in->failed = 1;
+		}
+		sink_close(s);
+	}
+	free(s);
+	return NULL;
+}
+
+/* input */
+
+static int map_file(input_file* in)
+{
+	struct stat st;
+	void* p;
+	int fd;
+
+	fd = open(in->name, O_RDONLY);
+	if(fd < 0 || fstat(fd, &st) != 0) {
+		perror(in->name);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return 0;
+	}
+	in->size = st.st_size;
+	if(in->size == 0) {
+		// nothing to map, an empty output all the same
+		in->data = (const uint8_t*) "";
+		close(fd);
+		return 1;
+	}
+	p = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		perror(in->name);
+		return 0;
+	}
+	madvise(p, in->size, MADV_SEQUENTIAL);
+	in->data = p;
+	in->mapped = 1;
+	return 1;
+}
+
+static int image_fd = -1;
+
+static uint8_t image_read(offset_t offset, uint8_t* buffer, uintptr_t length)
+{
+	return pread(image_fd, buffer, length, offset) == (ssize_t) length;
+}
+
+static uint8_t image_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interval,
+	uintptr_t length, device_read_callback_t callback, void* p)
+{
+	if(!buffer || interval == 0 || length < interval || !callback) {
+		return 0;
+	}
+	while(length >= interval) {
+		if(!image_read(offset, buffer, interval)) {
+			return 0;
+		}
+		if(!callback(buffer, offset, p)) {
+			break;
+		}
+		offset += interval;
+		length -= interval;
+	}
+	return 1;
+}
+
+// the image is only read
+static uint8_t image_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
+{
+	return 0;
+}
+
+static uint8_t image_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length,
+	device_write_callback_t callback, void* p)
+{
+	return 0;
+}
+
+static uint8_t image_erase(offset_t start, offset_t end)
+{
+	return 0;
+}
+
+// Read the files from the image into memory. The FAT code has a single file
+// handle and isn't thread safe, so this is done before the threads start.
+static int read_image(const char* image, int count)
+{
+	struct partition_struct* partition;
+	struct fat_fs_struct* fs;
+	struct fat_dir_entry_struct entry;
+	struct fat_file_struct* fd;
+	char path[64];
+	uint8_t* data;
+	intptr_t n;
+	size_t len;
+	int i, found = 0;
+
+	image_fd = open(image, O_RDONLY);
+	if(image_fd < 0) {
+		perror(image);
+		return 0;
+	}
+	partition = partition_open(image_read, image_read_interval, image_write,
+		image_write_interval, image_erase, image_erase, 0);
+	if(!partition) {
+		// no MBR, a "superfloppy"
+		partition = partition_open(image_read, image_read_interval, image_write,
+			image_write_interval, image_erase, image_erase, -1);
+	}
+	fs = partition ? fat_open(partition) : NULL;
+	if(!fs) {
+		fprintf(stderr, "%s: no FAT file system\n", image);
+		return 0;
+	}
+
+	for(i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "/%s", files[i].name);
+		if(!fat_get_dir_entry_of_path(fs, path, &entry)) {
+			if(!files[i].required) {
+				continue;
+			}
+			fprintf(stderr, "%s: no %s\n", image, files[i].name);
+			return 0;
+		}
+		fd = fat_open_file(fs, &entry);
+		data = malloc(entry.file_size + 1);
+		if(!fd || !data) {
+			fprintf(stderr, "%s: can't open %s\n", image, files[i].name);
+			return 0;
+		}
+		for(len = 0; len < entry.file_size; len += n) {
+			n = fat_read_file(fd, data + len, entry.file_size - len);
+			if(n <= 0) {
+				break;
+			}
+		}
+		fat_close_file(fd);
+		if(len < entry.file_size) {
+			fprintf(stderr, "%s: %s: read error\n", image, files[i].name);
+			return 0;
+		}
+		files[i].data = data;
+		files[i].size = len;
+		found++;
+	}
+	fat_close(fs);
+	partition_close(partition);
+	close(image_fd);
+	if(!found) {
+		fprintf(stderr, "%s: no logs\n", image);
+	}
+	return found;
+}
+
+int main(int argc, char* argv[])
+{
+	static const char* default_names[] = {"umeter.txt", "umeter.dlt"};
+	const char* image = NULL;
+	pthread_t* threads;
+	const char* p;
+	int jobs = 0;
+	int opt, i, err, status = 0;
+
+	while((opt = getopt(argc, argv, "c:f:j:o:i:")) != -1) {
+		switch(opt) {
+		case 'c':
+			err = ini_parse(optarg, ini_handler, NULL);
+			if(err) {
+				fprintf(stderr, "%s: can't parse (error %d)\n", optarg, err);
+				return 1;
+			}
+			calibrate = 1;
+			break;
+		case 'f':
+			if(strcmp(optarg, "csv") == 0) {
+				output = OUTPUT_CSV;
+			} else if(strcmp(optarg, "columns") == 0) {
+				output = OUTPUT_COLUMNS;
+			} else {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'o':
+			out_dir = optarg;
+			break;
+		case 'i':
+			image = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c umeter.ini] [-f csv|columns] [-j jobs] [-o dir] file...\n"
+				"       %s [-c umeter.ini] [-f csv|columns] [-j jobs] [-o dir] -i card.img [name...]\n",
+				argv[0], argv[0]);
+			return 2;
+		}
+	}
+	if(optind == argc && !image) {
+		fprintf(stderr, "%s: no files\n", argv[0]);
+		return 2;
+	}
+	if(strcmp(out_dir, "-") == 0 && output != OUTPUT_CSV) {
+		fprintf(stderr, "%s: only CSV goes to stdout\n", argv[0]);
+		return 2;
+	}
+
+	if(optind == argc) {
+		file_count = 2;
+		files = calloc(file_count, sizeof(*files));
+		for(i = 0; i < file_count; i++) {
+			files[i].name = default_names[i];
+		}
+	}
+	else {
+		file_count = argc - optind;
+		files = calloc(file_count, sizeof(*files));
+		for(i = 0; i < file_count; i++) {
+			files[i].name = argv[optind + i];
+			files[i].required = 1;
+		}
+	}
+	for(i = 0; i < file_count; i++) {
+		p = strrchr(files[i].name, '/');
+		files[i].base = p ? p + 1 : files[i].name;
+	}
+
+	if(image) {
+		if(!read_image(image, file_count)) {
+			return 1;
+		}
+	}
+	else {
+		for(i = 0; i < file_count; i++) {
+			if(!map_file(&files[i])) {
+				status = 1;
+			}
+		}
+	}
+
+	if(jobs <= 0) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(jobs > file_count) {
+		jobs = file_count;
+	}
+	if(jobs < 1) {
+		jobs = 1;
+	}
+	threads = malloc(jobs * sizeof(*threads));
+	for(i = 0; i < jobs; i++) {
+		if(pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+			break;
+		}
+	}
+	if(i == 0) {
+		// no threads, do it here
+		worker(NULL);
+	}
+	while(i > 0) {
+		pthread_join(threads[--i], NULL);
+	}
+	free(threads);
+
+	for(i = 0; i < file_count; i++) {
+		if(!files[i].data) {
+			continue;
+		}
+		fprintf(stderr, "%s: %lu records (%s)", files[i].name, files[i].records,
+			is_delta(&files[i]) ? "delta" : "text");
+		if(files[i].bad) {
+			fprintf(stderr, ", %lu %s skipped", files[i].bad,
+				is_delta(&files[i]) ? "blocks" : "lines");
+		}
+		if(files[i].failed) {
+			fprintf(stderr, ", writing the output failed");
+			status = 1;
+		}
+		fprintf(stderr, "\n");
+		if(files[i].mapped) {
+			munmap((void*) files[i].data, files[i].size);
+		}
+		else if(image) {
+			free((void*) files[i].data);
+		}
+	}
+	free(files);
+	return status;
+}
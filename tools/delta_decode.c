@@ -0,0 +1,174 @@
+/*
+ * delta_decode: convert a delta compressed UMeter log (umeter.dlt) back to
+ * the text format of umeter.txt.
+ *
+ * usage: delta_decode umeter.dlt [umeter.ini]
+ *
+ * Without a config file the raw ADC codes are printed. With one, every value
+ * is converted the way the logger would have: volts for raw_output sensors,
+ * (volts - offset) / slope otherwise, with the volts per code of the ADC
+ * the sensor is on. The conversion is done in single precision and printed
+ * like float2str() does, so with window=1 the output matches the umeter.txt
+ * the logger would have written byte for byte.
+ *
+ * See src/lib/Inputs/umeter_delta.h for the file layout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ini.h"
+
+#define BLOCK_SIZE		512
+#define HEADER_SIZE		16
+#define VERSION			1
+
+// keep in sync with ADC_VOLTS_PER_CODE in src/lib/Inputs/umeter_adc.h and
+// MCP3208_VOLTS_PER_CODE in src/lib/Inputs/umeter_mcp3208.h
+#define VOLTS_PER_CODE		(2.56 / 1023 * 2)
+#define MCP3208_VOLTS_PER_CODE	(2.048 / 4096 * 2)
+
+typedef struct
+{
+	int raw_output;
+	double offset;
+	double slope;
+	double volts_per_code;
+} calibration;
+
+static calibration cal[4] = {
+	{1, 0.0, 1.0, VOLTS_PER_CODE}, {1, 0.0, 1.0, VOLTS_PER_CODE},
+	{1, 0.0, 1.0, VOLTS_PER_CODE}, {1, 0.0, 1.0, VOLTS_PER_CODE}
+};
+
+static int ini_handler(void* user, const char* section, const char* name, const char* value)
+{
+	int j;
+	(void) user;
+	if(sscanf(section, "Sensor %d", &j) != 1 || j < 1 || j > 4) {
+		return 1;
+	}
+	j--;
+	if(strcmp(name, "raw_output") == 0) {
+		cal[j].raw_output = atoi(value);
+	} else if(strcmp(name, "offset") == 0) {
+		cal[j].offset = atof(value);
+	} else if(strcmp(name, "slope") == 0 && atof(value) != 0) {
+		cal[j].slope = atof(value);
+	} else if(strcmp(name, "adc") == 0) {
+		cal[j].volts_per_code = strncmp(value, "mcp3208:", 8) == 0 ? MCP3208_VOLTS_PER_CODE : VOLTS_PER_CODE;
+	}
+	return 1;
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+// Print the value of 'code' of sensor j like stats_get() and float2str() in
+// the firmware compute and format it.
+static void print_value(FILE* out, int j, uint16_t code)
+{
+	float a = cal[j].volts_per_code, b = 0, v;
+	int left, right;
+
+	if(!cal[j].raw_output) {
+		a /= (float) cal[j].slope;
+		b = -(float) cal[j].offset / (float) cal[j].slope;
+	}
+	v = a * (float) code + b;
+	left = (int) v;
+	right = (v - left) * 1000;
+	fprintf(out, "%d.%03d ", left, right);
+}
+
+// Decode one block, returns 0 if it is not a valid delta block.
+static int decode_block(const uint8_t* block, int calibrate, FILE* out)
+{
+	uint16_t last[4];
+	const uint8_t* p = block + HEADER_SIZE;
+	const uint8_t* end = block + BLOCK_SIZE;
+	uint16_t v;
+	uint8_t mask;
+	int j, shift;
+
+	if(block[0] != 'U' || block[1] != 'D' || block[2] != VERSION) {
+		return 0;
+	}
+	for(j = 0; j < 4; j++) {
+		last[j] = get16(block + 8 + 2 * j);
+	}
+
+	while(p < end && (mask = *p++) != 0) {
+		fprintf(out, "%X ", mask);
+		for(j = 0; j < 4; j++) {
+			if(!(mask & (1 << j))) {
+				continue;
+			}
+			v = 0;
+			shift = 0;
+			do {
+				if(p >= end) {
+					fprintf(stderr, "block %u: truncated record\n", get32(block + 4));
+					return 0;
+				}
+				v |= (*p & 0x7F) << shift;
+				shift += 7;
+			} while(*p++ & 0x80);
+			last[j] += (int16_t)((v >> 1) ^ -(v & 1));
+
+			if(!calibrate) {
+				fprintf(out, "%u ", last[j]);
+			}
+			else {
+				print_value(out, j, last[j]);
+			}
+		}
+		fprintf(out, "\n");
+	}
+	return 1;
+}
+
+int main(int argc, char* argv[])
+{
+	uint8_t block[BLOCK_SIZE];
+	FILE* in;
+	unsigned long n = 0;
+	int err;
+
+	if(argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s umeter.dlt [umeter.ini]\n", argv[0]);
+		return 2;
+	}
+	if(argc == 3) {
+		err = ini_parse(argv[2], ini_handler, NULL);
+		if(err) {
+			fprintf(stderr, "%s: can't parse (error %d)\n", argv[2], err);
+			return 1;
+		}
+	}
+	in = fopen(argv[1], "rb");
+	if(!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	// a trailing partial block is still decoded, the zero fill ends it
+	memset(block, 0, sizeof(block));
+	while(fread(block, 1, sizeof(block), in) > 0) {
+		if(!decode_block(block, argc == 3, stdout)) {
+			fprintf(stderr, "block %lu: skipped, not a delta block\n", n);
+		}
+		memset(block, 0, sizeof(block));
+		n++;
+	}
+	fclose(in);
+	return 0;
+}
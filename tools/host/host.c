@@ -0,0 +1,125 @@
+/*
+ * Virtual clock, timing defaults and the AVR registers of the host build.
+ */
+
+#include <stdlib.h>
+
+#define HOST_DEFINE_REGISTERS
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "host.h"
+
+/* ATmega32U4 at 16 MHz, SPI at f_OSC / 2, a typical class 4 SDHC card */
+host_timing host_time = {
+	.spi_byte		= 1250,		/* 8 clocks plus the polling loop */
+	.ep_byte		= 250,		/* UEDATX access plus loop overhead */
+	.usb_packet		= 53000,	/* 19 bulk packets per 1 ms frame */
+	.usb_turnaround	= 100000,	/* host stack latency from CSW to the next CBW */
+	.card_command	= 2500,		/* 2 bytes NCR */
+	.card_read		= 300000,
+	.card_busy		= 800000,
+	.card_busy_multi	= 100000,	/* sequential blocks, pre-erased by ACMD23 */
+	.card_erase		= 2000000,
+	.adc_conversion	= 104000,
+};
+
+host_counters host_count;
+host_time_t host_now;
+
+/* Timer0 compare interrupt of the millisecond clock (umeter_clock.c) */
+void TIMER0_COMPA_vect(void);
+
+/* Deliver the clock ticks due since the last call, also those of time the
+ * harness skipped by setting host_now. Ticks before clock_init() are lost. */
+void host_advance(host_time_t ns)
+{
+	static host_time_t tick;
+
+	host_now += ns;
+	if(!(TIMSK0 & (1 << OCIE0A))) {
+		tick = host_now;
+		return;
+	}
+	for(; host_now - tick >= 1000000; tick += 1000000) {
+		TIMER0_COMPA_vect();
+	}
+}
+
+void host_delay_us(uint32_t us)
+{
+	host_advance((host_time_t) us * 1000);
+}
+
+uint16_t (*host_adc_input)(uint8_t mux);
+
+/* ADC in single conversion mode: a started conversion is done by the time
+ * the firmware looks at it again */
+volatile uint8_t* host_adc_status(void)
+{
+	static volatile uint8_t adcsra;
+	uint16_t code;
+
+	if(adcsra & (1 << ADSC)) {
+		code = host_adc_input ? host_adc_input(ADMUX & 0x1f) : 0;
+		ADCL = code & 0xff;
+		ADCH = (code >> 8) & 0x03;
+		adcsra = (adcsra & ~(1 << ADSC)) | (1 << ADIF);
+		host_advance(host_time.adc_conversion);
+	}
+	return &adcsra;
+}
+
+uint16_t (*host_mcp3208_input)(uint8_t channel);
+
+/* MCP3208 in mode 0,0, clocked in whole bytes: start bit and channel in the
+ * first two, the code from the end of the second on */
+static uint8_t mcp3208_exchange(uint8_t mosi, uint8_t selected)
+{
+	static uint8_t pos, channel;
+	static uint16_t code;
+
+	if(!selected) {
+		pos = 0;
+		return 0xff;
+	}
+	switch(pos++) {
+	case 0:
+		channel = (mosi & 0x01) << 2;
+		return 0xff;
+	case 1:
+		channel |= mosi >> 6;
+		code = host_mcp3208_input ? host_mcp3208_input(channel) & 0x0fff : 0;
+		return code >> 8;
+	case 2:
+		return code & 0xff;
+	}
+	return 0xff;
+}
+
+/* SPI master: the card is selected while PB0 is low, the MCP3208 while PB4
+ * is; both at once would garble the bus */
+volatile uint8_t* host_spi_status(void)
+{
+	static volatile uint8_t spsr;
+	uint8_t card = !(PORTB & (1 << PORTB0));
+	uint8_t adc = (DDRB & (1 << DDB4)) && !(PORTB & (1 << PORTB4));
+
+	if(!(spsr & (1 << SPIF))) {
+		if(card && adc) {
+			fprintf(stderr, "SPI bus: card and MCP3208 selected at once\n");
+			abort();
+		}
+		if(adc) {
+			SPDR = mcp3208_exchange(SPDR, 1);
+		}
+		else {
+			mcp3208_exchange(SPDR, 0);
+			SPDR = host_card_exchange(SPDR, card);
+		}
+		spsr |= (1 << SPIF);
+		host_count.spi_bytes++;
+		host_advance(host_time.spi_byte);
+	}
+	return &spsr;
+}
@@ -0,0 +1,80 @@
+/*
+ * Shared state of the host build of the mass storage path: a virtual clock,
+ * the timing model and the counters the harness reports.
+ *
+ * All times are in nanoseconds of simulated device time. The firmware code
+ * itself runs at host speed; only SPI transfers, endpoint accesses, USB
+ * packets and the latencies of the card model advance the clock.
+ */
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint64_t host_time_t;
+
+typedef struct
+{
+	/* device side */
+	host_time_t spi_byte;		/* one SPI transfer including the polling loop */
+	host_time_t ep_byte;		/* one endpoint FIFO access by the firmware */
+
+	/* USB full speed bulk endpoint, 64 byte packets */
+	host_time_t usb_packet;		/* bus time of one packet */
+	host_time_t usb_turnaround;	/* host delay between CSW and the next CBW */
+
+	/* card model */
+	host_time_t card_command;	/* command to R1 response (NCR) */
+	host_time_t card_read;		/* command to read data token (access time) */
+	host_time_t card_busy;		/* programming time after a written block */
+	host_time_t card_busy_multi;	/* the same within a multiple block write */
+	host_time_t card_erase;		/* busy time after an erase command */
+
+	/* ADC */
+	host_time_t adc_conversion;	/* one conversion, 13 ADC clocks at f_OSC / 128 */
+} host_timing;
+
+typedef struct
+{
+	uint64_t spi_bytes;
+	uint64_t ep_bytes;
+	uint64_t usb_packets_out;
+	uint64_t usb_packets_in;
+	uint64_t card_commands;
+	uint64_t card_blocks_read;
+	uint64_t card_blocks_written;
+	uint64_t card_multi_blocks;	/* blocks written within a multiple block write */
+	uint64_t card_busy_polls;	/* SPI transfers answered with busy */
+	uint64_t stalls;
+} host_counters;
+
+extern host_timing host_time;
+extern host_counters host_count;
+extern host_time_t host_now;
+
+void host_advance(host_time_t ns);
+
+/* ADC input: the code a conversion of the input 'mux' (ADMUX MUX4:0) yields,
+ * 0 for all of them if not set */
+extern uint16_t (*host_adc_input)(uint8_t mux);
+
+/* MCP3208 on the SPI bus, selected by PB4: the 12 bit code a conversion of
+ * 'channel' yields, 0 if not set */
+extern uint16_t (*host_mcp3208_input)(uint8_t channel);
+
+/* card model, host_card.c */
+int host_card_open(const char* image, uint32_t blocks);
+void host_card_close(void);
+uint32_t host_card_blocks(void);
+int host_card_settled(void);
+uint8_t host_card_exchange(uint8_t mosi, uint8_t selected);
+void host_card_disconnect(host_time_t duration);
+
+/* USB model, host_usb.c */
+void host_usb_reset(void);
+void host_usb_queue_out(const uint8_t* data, uint32_t length);
+uint32_t host_usb_take_in(uint8_t* data, uint32_t max);
+host_time_t host_usb_idle_time(void);
+
+#endif
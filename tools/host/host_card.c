@@ -0,0 +1,417 @@
+/*
+ * File backed SD card model, one SPI byte at a time through
+ * host_card_exchange(), which host.c connects to SPDR/SPSR next to the
+ * MCP3208 model.
+ *
+ * Implements the SPI mode subset sd_raw uses: SDHC initialization (CMD0,
+ * CMD8, ACMD41, CMD58, CMD16), CID/CSD, SCR (ACMD51, erased blocks read as
+ * zeros), status, SD status (ACMD13, 4 MiB allocation units), single block
+ * read and write, multiple block write (CMD25, with ACMD23 accepted as a
+ * hint) and erase (CMD32, CMD33, CMD38). Blocks are addressed by block
+ * number (CCS set), the capacity is that of the image file rounded down to
+ * whole 512 KiB units.
+ *
+ * Timing follows host_time: R1 responses arrive card_command after the
+ * command, data tokens card_read after it, and after every written block the
+ * card holds MISO low (busy) for card_busy, or card_busy_multi within a
+ * multiple block write, and for card_erase after an erase command, whatever
+ * the number of blocks. The busy period runs on the virtual clock, so
+ * whatever the firmware does meanwhile hides it.
+ *
+ * host_card_disconnect() takes the card away for a while, like a bad contact
+ * or a brown out: it answers nothing, then comes back in idle state and has
+ * to be initialized again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "host.h"
+
+#define R1_IDLE			0x01
+#define R1_ILLEGAL		0x04
+#define R1_ERASE_SEQ	0x10
+#define R1_ADDRESS		0x20
+
+#define INIT_POLLS		3		/* ACMD41 calls until the card leaves idle state */
+#define AU_SIZE			9		/* SD status AU_SIZE, 4 MiB */
+
+enum
+{
+	STATE_COMMAND,		/* collecting a command */
+	STATE_WRITE_TOKEN,	/* CMD24 accepted, waiting for the start token */
+	STATE_MULTI_TOKEN,	/* CMD25 accepted, waiting for a start or stop token */
+	STATE_WRITE_DATA	/* receiving block and crc */
+};
+
+static int fd = -1;
+static uint32_t blocks;
+
+static uint8_t state;
+static uint8_t command[6];
+static uint8_t command_length;
+static uint8_t idle;
+static uint8_t app_command;
+static uint8_t init_polls;
+
+/* queued response; bytes from 'gate' on are held back until 'gate_time' */
+static uint8_t response[4 + 1 + 512 + 2];
+static uint16_t response_length;
+static uint16_t response_pos;
+static uint16_t gate;
+static host_time_t gate_time;
+static host_time_t r1_time;
+
+static uint8_t block[512 + 2];
+static uint16_t block_pos;
+static uint32_t block_address;
+static uint8_t multi;
+static host_time_t busy_until;
+static host_time_t gone_until;
+
+/* blocks tagged by CMD32 and CMD33 */
+static uint32_t erase_start;
+static uint32_t erase_end;
+
+int host_card_open(const char* image, uint32_t size_blocks)
+{
+	struct stat st;
+
+	fd = open(image, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		perror(image);
+		return 0;
+	}
+	if(fstat(fd, &st) < 0) {
+		perror(image);
+		return 0;
+	}
+	if(size_blocks && (uint64_t) st.st_size < (uint64_t) size_blocks * 512) {
+		if(ftruncate(fd, (off_t) size_blocks * 512) < 0) {
+			perror(image);
+			return 0;
+		}
+		st.st_size = (off_t) size_blocks * 512;
+	}
+	blocks = (st.st_size / 512) & ~1023UL;
+	if(!blocks) {
+		fprintf(stderr, "%s: image smaller than 512 KiB\n", image);
+		return 0;
+	}
+
+	state = STATE_COMMAND;
+	command_length = 0;
+	response_length = response_pos = 0;
+	idle = 1;
+	busy_until = gone_until = 0;
+	erase_start = erase_end = UINT32_MAX;
+	return 1;
+}
+
+void host_card_close(void)
+{
+	if(fd >= 0) {
+		close(fd);
+	}
+	fd = -1;
+}
+
+uint32_t host_card_blocks(void)
+{
+	return blocks;
+}
+
+/* Whether everything written is on the card: no write command is open and
+ * the card isn't busy programming. */
+int host_card_settled(void)
+{
+	return state == STATE_COMMAND && host_now >= busy_until;
+}
+
+void host_card_disconnect(host_time_t duration)
+{
+	/* whatever was going on is lost, blocks not completely received too */
+	state = STATE_COMMAND;
+	command_length = 0;
+	response_length = response_pos = 0;
+	app_command = 0;
+	idle = 1;
+	busy_until = 0;
+	erase_start = erase_end = UINT32_MAX;
+	gone_until = host_now + duration;
+}
+
+static void respond(uint8_t r1)
+{
+	response[0] = r1 | (idle ? R1_IDLE : 0);
+	response_length = 1;
+	response_pos = 0;
+	gate = 1;
+	gate_time = 0;
+	r1_time = host_now + host_time.card_command;
+}
+
+/* append a data block (start token, data, crc) after the access time */
+static void respond_data(const uint8_t* data, uint16_t length)
+{
+	gate = response_length;
+	gate_time = host_now + host_time.card_read;
+	response[response_length++] = 0xfe;
+	memcpy(&response[response_length], data, length);
+	response_length += length;
+	response[response_length++] = 0xff;
+	response[response_length++] = 0xff;
+}
+
+static void card_csd(uint8_t* csd)
+{
+	uint32_t c_size = blocks / 1024 - 1;
+	static const uint8_t csd_v2[16] = {
+		0x40, 0x0e, 0x00, 0x32, 0x5b, 0x59, 0x00, 0x00,
+		0x00, 0x00, 0x7f, 0x80, 0x0a, 0x40, 0x00, 0x01
+	};
+
+	memcpy(csd, csd_v2, 16);
+	csd[7] = (c_size >> 16) & 0x3f;
+	csd[8] = c_size >> 8;
+	csd[9] = c_size;
+}
+
+static void card_erase(uint32_t first, uint32_t last)
+{
+	static const uint8_t zero[512];
+
+	for(; first <= last; first++) {
+		if(pwrite(fd, zero, 512, (off_t) first * 512) != 512) {
+			perror("card image");
+			return;
+		}
+	}
+}
+
+static void card_command(void)
+{
+	uint8_t index = command[0] & 0x3f;
+	uint32_t arg = ((uint32_t) command[1] << 24) | ((uint32_t) command[2] << 16) |
+				   ((uint32_t) command[3] << 8) | command[4];
+	uint8_t app = app_command;
+	uint8_t data[64];
+
+	host_count.card_commands++;
+	app_command = 0;
+
+	switch(index) {
+	case 0:		/* GO_IDLE_STATE */
+		idle = 1;
+		init_polls = INIT_POLLS;
+		respond(0);
+		break;
+	case 8:		/* SEND_IF_COND */
+		respond(0);
+		response[response_length++] = 0x00;
+		response[response_length++] = 0x00;
+		response[response_length++] = (arg >> 8) & 0x0f;
+		response[response_length++] = arg & 0xff;
+		break;
+	case 55:	/* APP_CMD */
+		app_command = 1;
+		respond(0);
+		break;
+	case 41:	/* SD_SEND_OP_COND */
+		if(!app) {
+			respond(R1_ILLEGAL);
+			break;
+		}
+		if(init_polls && !--init_polls) {
+			idle = 0;
+		}
+		respond(0);
+		break;
+	case 58:	/* READ_OCR, power up done and CCS set */
+		respond(0);
+		response[response_length++] = 0xc0;
+		response[response_length++] = 0xff;
+		response[response_length++] = 0x80;
+		response[response_length++] = 0x00;
+		break;
+	case 16:	/* SET_BLOCKLEN */
+		respond(arg == 512 ? 0 : 0x40);
+		break;
+	case 9:		/* SEND_CSD */
+		respond(0);
+		card_csd(data);
+		respond_data(data, 16);
+		break;
+	case 10:	/* SEND_CID */
+		respond(0);
+		memcpy(data, "\x03SDHOSTC\x10\x12\x34\x56\x78\x01\x4a\x01", 16);
+		respond_data(data, 16);
+		break;
+	case 13:	/* SEND_STATUS, SD_STATUS */
+		respond(0);
+		response[response_length++] = 0x00;
+		if(app) {
+			memset(data, 0, 64);
+			data[10] = AU_SIZE << 4;
+			respond_data(data, 64);
+		}
+		break;
+	case 51:	/* SEND_SCR, SD 2.0 with 1 and 4 bit bus, erased blocks read as zeros */
+		if(!app) {
+			respond(R1_ILLEGAL);
+			break;
+		}
+		respond(0);
+		memcpy(data, "\x02\x25\x80\x00\x00\x00\x00\x00", 8);
+		respond_data(data, 8);
+		break;
+	case 23:	/* SET_WR_BLK_ERASE_COUNT */
+		respond(app ? 0 : R1_ILLEGAL);
+		break;
+	case 17:	/* READ_SINGLE_BLOCK */
+		if(arg >= blocks) {
+			respond(R1_ADDRESS);
+			break;
+		}
+		respond(0);
+		if(pread(fd, block, 512, (off_t) arg * 512) != 512) {
+			memset(block, 0, 512);
+		}
+		respond_data(block, 512);
+		host_count.card_blocks_read++;
+		break;
+	case 24:	/* WRITE_BLOCK */
+		if(arg >= blocks) {
+			respond(R1_ADDRESS);
+			break;
+		}
+		respond(0);
+		block_address = arg;
+		multi = 0;
+		state = STATE_WRITE_TOKEN;
+		break;
+	case 25:	/* WRITE_MULTIPLE_BLOCK */
+		if(arg >= blocks) {
+			respond(R1_ADDRESS);
+			break;
+		}
+		respond(0);
+		block_address = arg;
+		multi = 1;
+		state = STATE_MULTI_TOKEN;
+		break;
+	case 32:	/* ERASE_WR_BLK_START_ADDR */
+	case 33:	/* ERASE_WR_BLK_END_ADDR */
+		if(arg >= blocks) {
+			respond(R1_ADDRESS);
+			break;
+		}
+		respond(0);
+		if(index == 32) {
+			erase_start = arg;
+		}
+		else {
+			erase_end = arg;
+		}
+		break;
+	case 38:	/* ERASE */
+		if(erase_start >= blocks || erase_end >= blocks || erase_start > erase_end) {
+			respond(R1_ERASE_SEQ);
+			break;
+		}
+		respond(0);
+		card_erase(erase_start, erase_end);
+		erase_start = erase_end = UINT32_MAX;
+		/* R1b, busy from the byte after the response */
+		busy_until = r1_time + host_time.spi_byte + host_time.card_erase;
+		break;
+	default:
+		respond(R1_ILLEGAL);
+		break;
+	}
+}
+
+uint8_t host_card_exchange(uint8_t mosi, uint8_t selected)
+{
+	if(!selected || host_now < gone_until) {
+		return 0xff;
+	}
+
+	/* programming a block, MISO stays low */
+	if(host_now < busy_until && response_pos >= response_length) {
+		host_count.card_busy_polls++;
+		return 0x00;
+	}
+
+	/* answer still going out */
+	if(response_pos < response_length) {
+		if(host_now < r1_time || (response_pos >= gate && host_now < gate_time)) {
+			return 0xff;
+		}
+		return response[response_pos++];
+	}
+
+	switch(state) {
+	case STATE_WRITE_TOKEN:
+		if(mosi == 0xfe) {
+			state = STATE_WRITE_DATA;
+			block_pos = 0;
+		}
+		return 0xff;
+	case STATE_MULTI_TOKEN:
+		if(mosi == 0xfc) {
+			state = STATE_WRITE_DATA;
+			block_pos = 0;
+		}
+		else if(mosi == 0xfd) {
+			/* stop transmission, busy from the next byte on */
+			state = STATE_COMMAND;
+			busy_until = host_now + host_time.spi_byte + host_time.card_busy_multi;
+		}
+		return 0xff;
+	case STATE_WRITE_DATA:
+		block[block_pos++] = mosi;
+		if(block_pos == sizeof(block)) {
+			/* past the end of the card, refuse the block */
+			response[0] = (block_address < blocks) ? 0x05 : 0x0d;
+			if(block_address < blocks) {
+				if(pwrite(fd, block, 512, (off_t) block_address * 512) != 512) {
+					perror("card image");
+				}
+				host_count.card_blocks_written++;
+			}
+			/* data accepted, then busy */
+			response_length = 1;
+			response_pos = 0;
+			gate = 1;
+			r1_time = host_now;
+			if(multi) {
+				host_count.card_multi_blocks++;
+				state = STATE_MULTI_TOKEN;
+				block_address++;
+				busy_until = host_now + host_time.spi_byte + host_time.card_busy_multi;
+			}
+			else {
+				state = STATE_COMMAND;
+				busy_until = host_now + host_time.spi_byte + host_time.card_busy;
+			}
+		}
+		return 0xff;
+	default:
+		break;
+	}
+
+	if(!command_length && (mosi & 0xc0) != 0x40) {
+		return 0xff;
+	}
+	command[command_length++] = mosi;
+	if(command_length == sizeof(command)) {
+		command_length = 0;
+		card_command();
+	}
+	return 0xff;
+}
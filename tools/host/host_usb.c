@@ -0,0 +1,353 @@
+/*
+ * USB side of the host build: the LUFA endpoint API on top of in-memory
+ * FIFOs, with the timing of a full speed bus.
+ *
+ * The harness queues what the host sends (CBWs and OUT data) with
+ * host_usb_queue_out() and collects what the device sent (IN data and CSWs)
+ * with host_usb_take_in(). Packets are 64 bytes and take usb_packet of bus
+ * time each; IN and OUT share the bus. Both endpoints are double banked like
+ * the firmware configures them, so the host can send the next OUT packet while
+ * the device works on the previous one, and the device can fill a bank while
+ * the other one goes out.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <LUFA/Drivers/USB/USB.h>
+
+#include "Descriptors.h"
+#include "host.h"
+
+#define EP_SIZE		MASS_STORAGE_IO_EPSIZE
+
+typedef struct
+{
+	uint32_t offset;
+	uint16_t length;
+	host_time_t queued;	/* when the host had the packet ready */
+} packet;
+
+volatile uint8_t USB_DeviceState = DEVICE_STATE_Configured;
+USB_Request_Header_t USB_ControlRequest;
+
+static uint8_t selected;
+
+/* OUT: queued by the host, read by the device */
+static uint8_t* out_data;
+static uint32_t out_size, out_capacity;
+static packet* out_packets;
+static uint32_t out_count, out_packet_capacity;
+static uint32_t out_next;			/* next packet to load into a bank */
+static int32_t out_current = -1;	/* packet in the bank the firmware reads */
+static uint16_t out_pos;
+static host_time_t out_released[2];	/* when the last two banks were freed */
+
+/* IN: written by the device, collected by the host */
+static uint8_t in_bank[EP_SIZE];
+static uint16_t in_pos;
+static uint8_t* in_data;
+static uint32_t in_size, in_capacity;
+static host_time_t in_done[2];		/* when the last two banks were sent */
+
+static host_time_t bus_free;
+static uint8_t stalled[2];
+
+void host_usb_reset(void)
+{
+	out_size = out_count = out_next = 0;
+	out_current = -1;
+	out_pos = 0;
+	in_pos = 0;
+	in_size = 0;
+	stalled[0] = stalled[1] = 0;
+}
+
+void host_usb_queue_out(const uint8_t* data, uint32_t length)
+{
+	uint32_t n;
+
+	if(out_size + length > out_capacity) {
+		out_capacity = (out_size + length) * 2;
+		out_data = realloc(out_data, out_capacity);
+	}
+	memcpy(out_data + out_size, data, length);
+
+	do {
+		if(out_count == out_packet_capacity) {
+			out_packet_capacity = out_packet_capacity ? out_packet_capacity * 2 : 64;
+			out_packets = realloc(out_packets, out_packet_capacity * sizeof(packet));
+		}
+		n = (length > EP_SIZE) ? EP_SIZE : length;
+		out_packets[out_count].offset = out_size;
+		out_packets[out_count].length = n;
+		out_packets[out_count].queued = host_now;
+		out_count++;
+		out_size += n;
+		length -= n;
+	} while(length);
+}
+
+uint32_t host_usb_take_in(uint8_t* data, uint32_t max)
+{
+	uint32_t n = (in_size < max) ? in_size : max;
+
+	memcpy(data, in_data, n);
+	memmove(in_data, in_data + n, in_size - n);
+	in_size -= n;
+	return n;
+}
+
+host_time_t host_usb_idle_time(void)
+{
+	return (bus_free > host_now) ? bus_free : host_now;
+}
+
+static host_time_t later(host_time_t a, host_time_t b)
+{
+	return (a > b) ? a : b;
+}
+
+static bool is_in(void)
+{
+	return selected == MASS_STORAGE_IN_EPNUM;
+}
+
+/* move the next OUT packet into a bank, waiting for it to cross the bus */
+static bool out_load(void)
+{
+	host_time_t start;
+
+	if(out_current >= 0) {
+		return true;
+	}
+	if(out_next == out_count) {
+		return false;
+	}
+	start = later(later(bus_free, out_released[0]), out_packets[out_next].queued);
+	bus_free = start + host_time.usb_packet;
+	if(host_now < bus_free) {
+		host_advance(bus_free - host_now);
+	}
+	host_count.usb_packets_out++;
+	out_current = out_next++;
+	out_pos = 0;
+	return true;
+}
+
+/* wait for a free IN bank */
+static void in_wait(void)
+{
+	if(host_now < in_done[0]) {
+		host_advance(in_done[0] - host_now);
+	}
+}
+
+void USB_Init(void)
+{
+}
+
+void USB_USBTask(void)
+{
+}
+
+void Endpoint_SelectEndpoint(uint8_t EndpointNumber)
+{
+	selected = EndpointNumber;
+}
+
+bool Endpoint_ConfigureEndpoint(uint8_t Number, uint8_t Type, uint8_t Direction, uint16_t Size, uint8_t Banks)
+{
+	return true;
+}
+
+bool Endpoint_IsReadWriteAllowed(void)
+{
+	if(is_in()) {
+		return in_pos < EP_SIZE;
+	}
+	return out_load() && out_pos < out_packets[out_current].length;
+}
+
+bool Endpoint_IsStalled(void)
+{
+	/* the host clears the halt as soon as it sees it */
+	bool stall = stalled[is_in()];
+
+	stalled[is_in()] = 0;
+	return stall;
+}
+
+void Endpoint_StallTransaction(void)
+{
+	stalled[is_in()] = 1;
+	host_count.stalls++;
+}
+
+void Endpoint_ClearStall(void)
+{
+	stalled[is_in()] = 0;
+}
+
+void Endpoint_ResetDataToggle(void)
+{
+}
+
+void Endpoint_ResetFIFO(uint8_t EndpointNumber)
+{
+	if(EndpointNumber == MASS_STORAGE_IN_EPNUM) {
+		in_pos = 0;
+	}
+	else {
+		out_current = -1;
+		out_next = out_count;
+	}
+}
+
+void Endpoint_ClearIN(void)
+{
+	host_time_t start;
+
+	if(in_size + in_pos > in_capacity) {
+		in_capacity = (in_size + in_pos) * 2 + EP_SIZE;
+		in_data = realloc(in_data, in_capacity);
+	}
+	memcpy(in_data + in_size, in_bank, in_pos);
+	in_size += in_pos;
+	in_pos = 0;
+
+	start = later(bus_free, host_now);
+	bus_free = start + host_time.usb_packet;
+	in_done[0] = in_done[1];
+	in_done[1] = bus_free;
+	host_count.usb_packets_in++;
+}
+
+void Endpoint_ClearOUT(void)
+{
+	if(out_current < 0) {
+		return;
+	}
+	out_released[0] = out_released[1];
+	out_released[1] = host_now;
+	out_current = -1;
+}
+
+void Endpoint_ClearSETUP(void)
+{
+}
+
+void Endpoint_ClearStatusStage(void)
+{
+}
+
+uint8_t Endpoint_WaitUntilReady(void)
+{
+	if(stalled[is_in()]) {
+		return ENDPOINT_READYWAIT_EndpointStalled;
+	}
+	if(is_in()) {
+		in_wait();
+		return ENDPOINT_READYWAIT_NoError;
+	}
+	return out_load() ? ENDPOINT_READYWAIT_NoError : ENDPOINT_READYWAIT_Timeout;
+}
+
+uint8_t Endpoint_Read_Byte(void)
+{
+	host_advance(host_time.ep_byte);
+	host_count.ep_bytes++;
+	if(out_current < 0 || out_pos >= out_packets[out_current].length) {
+		return 0;
+	}
+	return out_data[out_packets[out_current].offset + out_pos++];
+}
+
+void Endpoint_Write_Byte(uint8_t Byte)
+{
+	host_advance(host_time.ep_byte);
+	host_count.ep_bytes++;
+	if(!in_pos) {
+		in_wait();
+	}
+	if(in_pos < EP_SIZE) {
+		in_bank[in_pos++] = Byte;
+	}
+}
+
+void Endpoint_Write_Word_BE(uint16_t Word)
+{
+	Endpoint_Write_Byte(Word >> 8);
+	Endpoint_Write_Byte(Word);
+}
+
+void Endpoint_Write_DWord_BE(uint32_t DWord)
+{
+	Endpoint_Write_Byte(DWord >> 24);
+	Endpoint_Write_Byte(DWord >> 16);
+	Endpoint_Write_Byte(DWord >> 8);
+	Endpoint_Write_Byte(DWord);
+}
+
+uint8_t Endpoint_Read_Stream_LE(void* Buffer, uint16_t Length, StreamCallbackPtr_t Callback)
+{
+	uint8_t* data = Buffer;
+
+	while(Length--) {
+		if(!Endpoint_IsReadWriteAllowed()) {
+			Endpoint_ClearOUT();
+			if(Callback && Callback() == STREAMCALLBACK_Abort) {
+				return 1;
+			}
+			if(Endpoint_WaitUntilReady()) {
+				return 1;
+			}
+		}
+		*data++ = Endpoint_Read_Byte();
+	}
+	return 0;
+}
+
+uint8_t Endpoint_Write_Stream_LE(const void* Buffer, uint16_t Length, StreamCallbackPtr_t Callback)
+{
+	const uint8_t* data = Buffer;
+
+	while(Length--) {
+		if(!Endpoint_IsReadWriteAllowed()) {
+			Endpoint_ClearIN();
+			if(Callback && Callback() == STREAMCALLBACK_Abort) {
+				return 1;
+			}
+		}
+		/* LUFA pads with zeros when Buffer is NULL */
+		Endpoint_Write_Byte(data ? *data++ : 0);
+	}
+	return 0;
+}
+
+uint8_t Endpoint_Write_Stream_BE(const void* Buffer, uint16_t Length, StreamCallbackPtr_t Callback)
+{
+	const uint8_t* data = Buffer;
+
+	while(Length--) {
+		if(!Endpoint_IsReadWriteAllowed()) {
+			Endpoint_ClearIN();
+		}
+		Endpoint_Write_Byte(data[Length]);
+	}
+	return 0;
+}
+
+uint8_t Endpoint_Discard_Stream(uint16_t Length, StreamCallbackPtr_t Callback)
+{
+	while(Length--) {
+		if(!Endpoint_IsReadWriteAllowed()) {
+			Endpoint_ClearOUT();
+			if(Endpoint_WaitUntilReady()) {
+				return 1;
+			}
+		}
+		Endpoint_Read_Byte();
+	}
+	return 0;
+}
@@ -0,0 +1,24 @@
+/* Host build stand-in for the LUFA common header. */
+#ifndef HOST_LUFA_COMMON_H
+#define HOST_LUFA_COMMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <avr/pgmspace.h>
+
+#define MACROS do
+#define MACROE while(0)
+
+#define ATTR_WARN_UNUSED_RESULT __attribute__((warn_unused_result))
+#define ATTR_NON_NULL_PTR_ARG(...) __attribute__((nonnull(__VA_ARGS__)))
+#define ATTR_ALWAYS_INLINE
+#define ATTR_CONST __attribute__((const))
+#define ATTR_NO_RETURN __attribute__((noreturn))
+#define ATTR_PACKED __attribute__((packed))
+
+/* interrupts are delivered by host_advance() once enabled in TIMSK0 */
+#define GlobalInterruptEnable() do { } while(0)
+#define GlobalInterruptDisable() do { } while(0)
+
+#endif
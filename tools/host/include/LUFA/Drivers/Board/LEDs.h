@@ -0,0 +1,15 @@
+/* Host build stand-in for the LUFA board LED driver. */
+#ifndef HOST_LUFA_LEDS_H
+#define HOST_LUFA_LEDS_H
+
+#define LEDS_LED1 (1 << 0)
+#define LEDS_LED2 (1 << 1)
+#define LEDS_LED3 (1 << 2)
+#define LEDS_LED4 (1 << 3)
+#define LEDS_ALL_LEDS (LEDS_LED1 | LEDS_LED2 | LEDS_LED3 | LEDS_LED4)
+#define LEDS_NO_LEDS 0
+
+#define LEDs_Init() do { } while(0)
+#define LEDs_SetAllLEDs(mask) do { (void) (mask); } while(0)
+
+#endif
@@ -0,0 +1,88 @@
+/* Host build stand-in for the LUFA USB driver.
+ *
+ * Only the device-side endpoint API used by the mass storage code is
+ * provided. The endpoint functions are implemented by the host harness
+ * on top of in-memory FIFOs (see tools/host/host_usb.c).
+ */
+#ifndef HOST_LUFA_USB_H
+#define HOST_LUFA_USB_H
+
+#include <LUFA/Common/Common.h>
+
+enum
+{
+    STREAMCALLBACK_Continue = 0,
+    STREAMCALLBACK_Abort    = 1,
+};
+
+enum
+{
+    ENDPOINT_READYWAIT_NoError            = 0,
+    ENDPOINT_READYWAIT_EndpointStalled    = 1,
+    ENDPOINT_READYWAIT_DeviceDisconnected = 2,
+    ENDPOINT_READYWAIT_Timeout            = 3,
+};
+
+enum
+{
+    DEVICE_STATE_Unattached = 0,
+    DEVICE_STATE_Configured = 5,
+};
+
+#define ENDPOINT_DIR_OUT 0
+#define ENDPOINT_DIR_IN 0x80
+#define ENDPOINT_BANK_SINGLE 0
+#define ENDPOINT_BANK_DOUBLE 1
+#define EP_TYPE_BULK 2
+
+#define REQDIR_HOSTTODEVICE (0 << 7)
+#define REQDIR_DEVICETOHOST (1 << 7)
+#define REQTYPE_CLASS (1 << 5)
+#define REQREC_INTERFACE (1 << 0)
+
+typedef uint8_t (*StreamCallbackPtr_t)(void);
+
+typedef struct
+{
+    uint8_t  bmRequestType;
+    uint8_t  bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} USB_Request_Header_t;
+
+typedef struct { uint8_t Size; uint8_t Type; } USB_Descriptor_Header_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Descriptor_Configuration_Header_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Descriptor_Interface_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Descriptor_Endpoint_t;
+
+extern volatile uint8_t USB_DeviceState;
+extern USB_Request_Header_t USB_ControlRequest;
+
+void USB_Init(void);
+void USB_USBTask(void);
+
+void Endpoint_SelectEndpoint(uint8_t EndpointNumber);
+bool Endpoint_ConfigureEndpoint(uint8_t Number, uint8_t Type, uint8_t Direction, uint16_t Size, uint8_t Banks);
+bool Endpoint_IsReadWriteAllowed(void);
+bool Endpoint_IsStalled(void);
+void Endpoint_StallTransaction(void);
+void Endpoint_ClearStall(void);
+void Endpoint_ResetDataToggle(void);
+void Endpoint_ResetFIFO(uint8_t EndpointNumber);
+void Endpoint_ClearIN(void);
+void Endpoint_ClearOUT(void);
+void Endpoint_ClearSETUP(void);
+void Endpoint_ClearStatusStage(void);
+uint8_t Endpoint_WaitUntilReady(void);
+
+uint8_t Endpoint_Read_Byte(void);
+void Endpoint_Write_Byte(uint8_t Byte);
+void Endpoint_Write_DWord_BE(uint32_t DWord);
+void Endpoint_Write_Word_BE(uint16_t Word);
+uint8_t Endpoint_Read_Stream_LE(void* Buffer, uint16_t Length, StreamCallbackPtr_t Callback);
+uint8_t Endpoint_Write_Stream_LE(const void* Buffer, uint16_t Length, StreamCallbackPtr_t Callback);
+uint8_t Endpoint_Write_Stream_BE(const void* Buffer, uint16_t Length, StreamCallbackPtr_t Callback);
+uint8_t Endpoint_Discard_Stream(uint16_t Length, StreamCallbackPtr_t Callback);
+
+#endif
@@ -0,0 +1,7 @@
+/* Host build stand-in for the LUFA version header. */
+#ifndef HOST_LUFA_VERSION_H
+#define HOST_LUFA_VERSION_H
+
+#define LUFA_VERSION_STRING "091223-host"
+
+#endif
@@ -0,0 +1,9 @@
+/* Host build stand-in for <avr/interrupt.h>. */
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void); void vector(void)
+#define sei() do { } while(0)
+#define cli() do { } while(0)
+
+#endif
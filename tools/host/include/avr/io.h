@@ -0,0 +1,127 @@
+/* Host build stand-in for <avr/io.h>: peripheral registers become plain variables. */
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#ifndef __AVR_ATmega32U4__
+#define __AVR_ATmega32U4__ 1
+#endif
+
+/* host.c defines HOST_DEFINE_REGISTERS to get the definitions */
+#ifdef HOST_DEFINE_REGISTERS
+#define HOST_REG8(name)  volatile uint8_t name
+#define HOST_REG16(name) volatile uint16_t name
+#else
+#define HOST_REG8(name)  extern volatile uint8_t name
+#define HOST_REG16(name) extern volatile uint16_t name
+#endif
+
+HOST_REG8(PINB); HOST_REG8(DDRB); HOST_REG8(PORTB);
+HOST_REG8(PINC); HOST_REG8(DDRC); HOST_REG8(PORTC);
+HOST_REG8(PIND); HOST_REG8(DDRD); HOST_REG8(PORTD);
+HOST_REG8(PINE); HOST_REG8(DDRE); HOST_REG8(PORTE);
+HOST_REG8(PINF); HOST_REG8(DDRF); HOST_REG8(PORTF);
+HOST_REG8(MCUSR);
+HOST_REG8(ADMUX); HOST_REG8(ADCSRB);
+HOST_REG8(ADCL); HOST_REG8(ADCH); HOST_REG8(DIDR0);
+
+/* Reading ADCSRA after ADSC was set completes the conversion of the input
+ * selected by ADMUX into ADCL/ADCH (see host.c), like the ADC would. */
+volatile uint8_t* host_adc_status(void);
+#define ADCSRA (*host_adc_status())
+HOST_REG8(SPCR); HOST_REG8(SPDR);
+
+/* Polling SPSR clocks the byte in SPDR out to the simulated card and puts its
+ * answer into SPDR (see host.c), like the SPI hardware would. */
+volatile uint8_t* host_spi_status(void);
+#define SPSR (*host_spi_status())
+HOST_REG8(UCSR1A); HOST_REG8(UCSR1B); HOST_REG8(UCSR1C); HOST_REG8(UDR1);
+HOST_REG16(UBRR1);
+HOST_REG8(TCCR0A); HOST_REG8(TCCR0B); HOST_REG8(OCR0A); HOST_REG8(TIMSK0); HOST_REG8(TIFR0);
+HOST_REG8(TCCR1A); HOST_REG8(TCCR1B); HOST_REG8(TIMSK1); HOST_REG8(TIFR1);
+HOST_REG16(TCNT1);
+HOST_REG8(GPIOR0); HOST_REG8(SREG); HOST_REG8(TCNT0);
+HOST_REG8(EEARL);
+
+/* port pins */
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC6 6
+#define PC7 7
+#define PD3 3
+#define PF0 0
+#define PF1 1
+#define PF4 4
+#define PF5 5
+#define PF6 6
+#define PF7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define PORTB0 0
+#define PORTB4 4
+#define DDD3 3
+
+/* MCUSR */
+#define WDRF 3
+
+/* ADC */
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define MUX5 5
+
+/* SPI */
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define SPI2X 0
+
+/* USART1 */
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define U2X1 1
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define UCSZ11 2
+#define UCSZ10 1
+
+/* timers */
+#define WGM01 1
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define OCIE0A 1
+#define CS10 0
+#define TOIE1 0
+#define TOV1 0
+#define SREG_I 7
+
+#endif
@@ -0,0 +1,27 @@
+/* Host build stand-in for <avr/pgmspace.h>: program memory is ordinary memory. */
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*) (addr))
+#define pgm_read_word(addr) (*(const uint16_t*) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t*) (addr))
+#define pgm_read_ptr(addr) (*(void* const*) (addr))
+#define printf_P printf
+#define fprintf_P fprintf
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vfprintf_P vfprintf
+#define strcmp_P strcmp
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define fputs_P fputs
+
+#endif
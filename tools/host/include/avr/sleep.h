@@ -0,0 +1,7 @@
+/* Host build stand-in for <avr/sleep.h>. */
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define sleep_mode() do { } while(0)
+
+#endif
@@ -0,0 +1,8 @@
+/* Host build stand-in for <avr/wdt.h>. */
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#define wdt_disable() do { } while(0)
+#define wdt_reset() do { } while(0)
+
+#endif
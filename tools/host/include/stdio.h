@@ -0,0 +1,12 @@
+/* Host build stand-in: glibc stdio plus the avr-libc stream setup extensions. */
+#ifndef HOST_STDIO_H
+#define HOST_STDIO_H
+#include_next <stdio.h>
+#define _FDEV_SETUP_READ 1
+#define _FDEV_SETUP_WRITE 2
+#define _FDEV_SETUP_RW 3
+/* the stream is never used, only 'put' is kept referenced */
+#define FDEV_SETUP_STREAM(put, get, rwflag) { ._IO_read_ptr = (char*) (put) }
+#define fdev_setup_stream(stream, put, get, rwflag) do { (void) (put); (void) (get); } while(0)
+#define fdev_get_udata(stream) ((void*) 0)
+#endif
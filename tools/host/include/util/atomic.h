@@ -0,0 +1,9 @@
+/* Host build stand-in for <util/atomic.h>. */
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 0
+#define ATOMIC_BLOCK(type) for(int host_atomic_once = 1; host_atomic_once; host_atomic_once = 0)
+
+#endif
@@ -0,0 +1,12 @@
+/* Host build stand-in for <util/delay.h>: delays advance the host's virtual clock. */
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#include <stdint.h>
+
+void host_delay_us(uint32_t us);
+
+#define _delay_ms(ms) host_delay_us((uint32_t) ((ms) * 1000))
+#define _delay_us(us) host_delay_us((uint32_t) (us))
+
+#endif
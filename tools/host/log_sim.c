@@ -0,0 +1,902 @@
+/*
+ * log_sim: run the data logger on the host for days of simulated time and
+ * check what ends up in umeter.txt.
+ *
+ * usage: log_sim [-i image] [-s MiB] [-c ini] [-d time] [-r time]
+ *                [-a sensor=source ...] [-t name=us ...] [-e file]
+ *                [-w file] [-b file]
+ *
+ * The real UMeter_Init(), sched_next(), sched_wait() and UMeter_Task() with
+ * the umeter.ini parser, the FAT stack and sd_raw run like data_logger_main()
+ * does, against the file backed SD card of host_card.c. The ADC converts
+ * synthetic inputs instead of the sensors, and the delays between samples
+ * only advance the virtual clock, so a week of logging at one sample per
+ * second takes seconds.
+ *
+ * -i image   card image, default log_sim.img
+ * -s MiB     size of the image formatted by -c, default 256
+ * -c ini     format the image with a FAT16 file system holding this file as
+ *            umeter.ini; without -c the image has to hold a file system with
+ *            a umeter.ini already
+ * -d time    simulated time to log, default 1d
+ * -r time    report the card accesses per sample this often, default 1h
+ *            (times take a suffix s, m, h or d, seconds without)
+ * -a n=src   input of sensor n (1-4) in millivolts, on the internal ADC or
+ *            the simulated MCP3208 as umeter.ini says, default const:1000:
+ *              const:mv
+ *              sine:mean,amplitude,period_s
+ *              step:low,high,period_s      high for the second half period
+ *              noise:mean,sigma            gaussian, the same on every run
+ *              csv:file[,column]           one line per sample of the sensor,
+ *                                          column counted from 1, repeated
+ *                                          when the file ends
+ * -t name=us override a timing parameter in microseconds, see host.h:
+ *            spi_byte, card_command, card_read, card_busy, card_busy_multi,
+ *            card_erase, adc_conversion
+ * -e file    with format=delta, copy umeter.dlt from the image to 'file' and
+ *            write what tools/delta_decode has to make of it with the same
+ *            umeter.ini to 'file'.expected; the image has to be new (-c)
+ * -w file    write the blocks written per sample over the whole run to 'file'
+ * -b file    fail if more blocks per sample are written than 'file' says, as
+ *            left by -w of another run (format=delta against format=text)
+ *
+ * Every report line shows the card commands, blocks read and blocks written
+ * per sample since the last one, and the time UMeter_Task() took on average
+ * and at most. These have to stay flat as umeter.txt grows; an append whose
+ * cost grows with the size of the file shows up as a rising column long
+ * before it gets noticeable on the device. log_sim fails if the commands per
+ * sample of the last report are more than half again those of the first, or
+ * if the samples have fallen behind their due points by more than the
+ * longest UMeter_Task() (the time of the tasks mustn't add up to drift).
+ *
+ * The records are also put together from the samples fed to the ADC by a
+ * model of the text format (stats of each window, calibration, float2str();
+ * tables are looked up with the firmware's table_lookup()).
+ * In the end umeter.txt is closed and read back from the image without the
+ * firmware's FAT code, and has to match the model byte for byte. With
+ * format=delta the model holds the window means as delta_decode prints them
+ * instead, which -e leaves for the decoder to be checked against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+
+/* umeter_config is read as laid out by the firmware's -fpack-struct */
+#pragma pack(push, 1)
+#include "UMeter.h"
+#include "lib/FatSD/SDCardManager.h"
+#include "lib/Inputs/umeter_adc.h"
+#include "lib/Inputs/umeter_mcp3208.h"
+#include "lib/Inputs/umeter_sched.h"
+#include "lib/Inputs/umeter_stats.h"
+#include "lib/Inputs/umeter_table.h"
+#include "lib/Inputs/umeter_sensor.h"
+#include "lib/Timer/umeter_clock.h"
+#pragma pack(pop)
+#include "host.h"
+
+#define NS_PER_S	1000000000ULL
+
+enum
+{
+	SOURCE_CONST = 0,
+	SOURCE_SINE,
+	SOURCE_STEP,
+	SOURCE_NOISE,
+	SOURCE_CSV
+};
+
+typedef struct
+{
+	int type;
+	double p[3];
+	double* values;		/* csv */
+	size_t count;
+	size_t size;
+	size_t next;
+	uint64_t seed;		/* noise */
+} source;
+
+/* what the model expects a window of a sensor to hold, as in umeter_stats.c */
+typedef struct
+{
+	uint16_t count;
+	int16_t min;
+	int16_t max;
+	int32_t sum;
+	uint32_t sumsq;
+	float sumsq_values;		/* of a sensor with a table */
+} window;
+
+static source sources[4];
+static uint16_t sampled[4];	/* code of the last conversion of each sensor */
+static window windows[4];
+
+static char* expected;
+static size_t expected_length, expected_size;
+
+/* ADC inputs of sensor 1 to 4 */
+static const uint8_t sensor_mux[4] = { SMUX1, SMUX2, SMUX3, SMUX4 };
+
+static const umeter_config* config;	/* for the ADC of each sensor */
+
+static double parse_time(const char* arg)
+{
+	char* end;
+	double t = strtod(arg, &end);
+
+	switch(*end) {
+	case 'd':
+		t *= 24;
+		/* fall through */
+	case 'h':
+		t *= 60;
+		/* fall through */
+	case 'm':
+		t *= 60;
+		break;
+	}
+	return t;
+}
+
+static int load_csv(source* s, const char* arg)
+{
+	const char* comma = strchr(arg, ',');
+	int column = comma ? atoi(comma + 1) : 1;
+	char path[256], line[512];
+	char* field;
+	FILE* f;
+	int i;
+
+	snprintf(path, sizeof(path), "%.*s", comma ? (int) (comma - arg) : (int) strlen(arg), arg);
+	if(!(f = fopen(path, "r"))) {
+		perror(path);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		if(line[0] == '#') {
+			continue;
+		}
+		field = strtok(line, ", \t\r\n");
+		for(i = 1; field && i < column; i++) {
+			field = strtok(0, ", \t\r\n");
+		}
+		if(!field) {
+			continue;
+		}
+		if(s->count == s->size) {
+			s->size = s->size ? s->size * 2 : 1024;
+			s->values = realloc(s->values, s->size * sizeof(double));
+		}
+		s->values[s->count++] = atof(field);
+	}
+	fclose(f);
+	if(!s->count) {
+		fprintf(stderr, "%s: no values in column %d\n", path, column);
+		return 0;
+	}
+	return 1;
+}
+
+static int set_source(const char* arg)
+{
+	static const char* types[] = { "const:", "sine:", "step:", "noise:", "csv:" };
+	int n = arg[0] - '1';
+	source* s;
+	unsigned i;
+
+	if(n < 0 || n > 3 || arg[1] != '=') {
+		fprintf(stderr, "bad source '%s', expected sensor=source\n", arg);
+		return 0;
+	}
+	s = &sources[n];
+	arg += 2;
+	for(i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if(!strncmp(arg, types[i], strlen(types[i]))) {
+			break;
+		}
+	}
+	if(i == sizeof(types) / sizeof(types[0])) {
+		fprintf(stderr, "unknown source '%s'\n", arg);
+		return 0;
+	}
+	memset(s, 0, sizeof(*s));
+	s->type = i;
+	s->seed = 0x9e3779b97f4a7c15ULL * (n + 1);
+	arg += strlen(types[i]);
+	if(s->type == SOURCE_CSV) {
+		return load_csv(s, arg);
+	}
+	sscanf(arg, "%lf,%lf,%lf", &s->p[0], &s->p[1], &s->p[2]);
+	return 1;
+}
+
+static double uniform(uint64_t* seed)
+{
+	*seed ^= *seed << 13;	/* xorshift64 */
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return ((*seed >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* Input of a sensor in millivolts at the current time. */
+static double source_value(source* s)
+{
+	double t = (double) host_now / NS_PER_S;
+	double v;
+
+	switch(s->type) {
+	case SOURCE_SINE:
+		return s->p[0] + s->p[1] * sin(2 * M_PI * t / s->p[2]);
+	case SOURCE_STEP:
+		return fmod(t, s->p[2]) < s->p[2] / 2 ? s->p[0] : s->p[1];
+	case SOURCE_NOISE:
+		/* Box-Muller */
+		v = sqrt(-2 * log(uniform(&s->seed))) * cos(2 * M_PI * uniform(&s->seed));
+		return s->p[0] + s->p[1] * v;
+	case SOURCE_CSV:
+		v = s->values[s->next];
+		s->next = (s->next + 1) % s->count;
+		return v;
+	}
+	return s->p[0];
+}
+
+static uint16_t adc_input(uint8_t mux)
+{
+	int j;
+
+	for(j = 0; j < 4; j++) {
+		if(sensor_mux[j] == mux) {
+			sampled[j] = volts2adc(source_value(&sources[j]) / 1000);
+			return sampled[j];
+		}
+	}
+	return 0;
+}
+
+/* sensors set to adc=mcp3208:N are converted here */
+static uint16_t mcp3208_input(uint8_t channel)
+{
+	int j;
+
+	for(j = 0; config && j < 4; j++) {
+		if(config->sensors[j].adc == ADC_MCP3208 + channel) {
+			sampled[j] = sensor_volts2code(&config->sensors[j], source_value(&sources[j]) / 1000);
+			return sampled[j];
+		}
+	}
+	return 0;
+}
+
+static void expect(const char* text, size_t n)
+{
+	if(expected_length + n > expected_size) {
+		expected_size = (expected_length + n) * 2;
+		expected = realloc(expected, expected_size);
+	}
+	memcpy(expected + expected_length, text, n);
+	expected_length += n;
+}
+
+/* The values of a complete window of sensor j, as stats_get() computes them. */
+static int model_window(int j, const sensor* s, float* out)
+{
+	window* w = &windows[j];
+	float a, b, mean, ms, lo, hi;
+	int n = 0, d;
+
+	a = sensor_volts_per_code(s);
+	b = 0;
+	if(s->table) {
+		for(a = 1, d = 0; d < s->table_decimals; d++) {
+			a /= 10;
+		}
+	}
+	else if(!s->raw_output) {
+		a /= s->slope;
+		b = -s->offset / s->slope;
+	}
+	lo = a * w->min + b;
+	hi = a * w->max + b;
+	if(a < 0) {
+		mean = lo;
+		lo = hi;
+		hi = mean;
+	}
+	mean = (float) w->sum / w->count;
+	if(s->stats & STATS_MIN) {
+		out[n++] = lo;
+	}
+	if(s->stats & STATS_MAX) {
+		out[n++] = hi;
+	}
+	if(s->stats & STATS_MEAN) {
+		out[n++] = a * mean + b;
+	}
+	if(s->stats & STATS_RMS) {
+		if(s->table) {
+			ms = a * a * (w->sumsq_values / w->count);
+		}
+		else {
+			ms = a * a * ((float) w->sumsq / w->count) + 2 * a * b * mean + b * b;
+		}
+		out[n++] = ms > 0 ? sqrt(ms) : 0;
+	}
+	w->count = 0;
+	return n;
+}
+
+/* The value of a delta record, as delta_decode prints it: the rounded
+ * window mean of stats_get_code(), calibrated and formatted like a
+ * single sample in umeter.txt. */
+static int model_delta(int j, const sensor* s, char* buff)
+{
+	window* w = &windows[j];
+	uint16_t code = (w->sum + w->count / 2) / w->count;
+	float a = sensor_volts_per_code(s), b = 0;
+
+	if(!s->raw_output) {
+		a /= s->slope;
+		b = -s->offset / s->slope;
+	}
+	w->count = 0;
+	return float2str(a * code + b, buff);
+}
+
+/* Put the record UMeter_Task(mask) should have written together. */
+static void model_task(const umeter_config* umeter, uint8_t mask)
+{
+	char buff[16];
+	float out[4];
+	uint8_t ready = 0;
+	int i, j, n;
+
+	for(j = 0; j < 4; j++) {
+		const sensor* s = &umeter->sensors[j];
+		window* w = &windows[j];
+		uint16_t code = sampled[j];
+		int16_t v = s->table ? table_lookup(j, s, code) : code;
+
+		if(!(mask & SCHED_CHANNEL(j)) || !s->enabled) {
+			continue;
+		}
+		if(!w->count) {
+			w->min = w->max = v;
+			w->sum = w->sumsq = 0;
+			w->sumsq_values = 0;
+		}
+		if(v < w->min) {
+			w->min = v;
+		}
+		if(v > w->max) {
+			w->max = v;
+		}
+		w->sum += v;
+		if(!s->table) {
+			w->sumsq += (uint32_t) code * code;
+		}
+		else if(s->stats & STATS_RMS) {
+			w->sumsq_values += (float) v * v;
+		}
+		if(++w->count >= umeter->sensors[j].window) {
+			ready |= SCHED_CHANNEL(j);
+		}
+	}
+	if(!ready) {
+		return;
+	}
+	n = sprintf(buff, "%X ", ready);
+	expect(buff, n);
+	for(j = 0; j < 4; j++) {
+		if(ready & SCHED_CHANNEL(j) && umeter->format == FORMAT_DELTA) {
+			expect(buff, model_delta(j, &umeter->sensors[j], buff));
+		}
+		else if(ready & SCHED_CHANNEL(j)) {
+			n = model_window(j, &umeter->sensors[j], out);
+			for(i = 0; i < n; i++) {
+				expect(buff, float2str(out[i], buff));
+			}
+		}
+	}
+	expect("\n", 1);
+}
+
+static void put16(uint8_t* p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+/* Create a FAT16 superfloppy of 'mib' MiB holding 'ini' as umeter.ini, like
+ * mkfs.vfat -F 16 and mcopy would. */
+static int format_image(const char* image, unsigned long mib, const char* ini)
+{
+	uint32_t total = mib * 2048, clusters, fat_blocks, data_start, cluster_size;
+	uint8_t spc = 1, block[512], *data;
+	size_t length, i;
+	FILE* f;
+	int fd;
+
+	if(!(f = fopen(ini, "rb"))) {
+		perror(ini);
+		return 0;
+	}
+	data = malloc(64 * 1024);
+	length = fread(data, 1, 64 * 1024, f);
+	fclose(f);
+
+	/* the largest clusters FAT16 needs, 32 reserved blocks, 512 root entries */
+	while(total / spc > 65524 && spc < 128) {
+		spc *= 2;
+	}
+	fat_blocks = (total / spc * 2 + 4 + 511) / 512;
+	data_start = 32 + 2 * fat_blocks + 32;
+	clusters = (total - data_start) / spc;
+	cluster_size = spc * 512;
+	if(clusters < 4085 || clusters > 65524 || length > cluster_size) {
+		fprintf(stderr, "%s: %lu MiB can't be formatted FAT16\n", image, mib);
+		free(data);
+		return 0;
+	}
+
+	fd = open(image, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, (off_t) total * 512) < 0) {
+		perror(image);
+		free(data);
+		return 0;
+	}
+
+	/* boot sector */
+	memset(block, 0, sizeof(block));
+	memcpy(block, "\xeb\x3c\x90mkfs.fat", 11);
+	put16(block + 11, 512);
+	block[13] = spc;
+	put16(block + 14, 32);
+	block[16] = 2;
+	put16(block + 17, 512);
+	put16(block + 19, total < 65536 ? total : 0);
+	block[21] = 0xf8;
+	put16(block + 22, fat_blocks);
+	put16(block + 24, 32);
+	put16(block + 26, 64);
+	put32(block + 32, total < 65536 ? 0 : total);
+	block[36] = 0x80;
+	block[38] = 0x29;
+	put32(block + 39, (uint32_t) time(0));	/* serial, new for every format */
+	memcpy(block + 43, "NO NAME    FAT16   ", 19);
+	put16(block + 510, 0xaa55);
+	pwrite(fd, block, 512, 0);
+
+	/* both FATs: media, end of chain, umeter.ini in cluster 2 */
+	memset(block, 0, sizeof(block));
+	put16(block, 0xfff8);
+	put16(block + 2, 0xffff);
+	put16(block + 4, 0xffff);
+	for(i = 0; i < 2; i++) {
+		pwrite(fd, block, 512, (off_t) (32 + i * fat_blocks) * 512);
+	}
+
+	/* root directory entry */
+	memset(block, 0, sizeof(block));
+	memcpy(block, "UMETER  INI", 11);
+	block[11] = 0x20;
+	block[12] = 0x18;	/* shown in lower case */
+	put16(block + 26, 2);
+	put32(block + 28, length);
+	pwrite(fd, block, 512, (off_t) (32 + 2 * fat_blocks) * 512);
+
+	pwrite(fd, data, length, (off_t) data_start * 512);
+	free(data);
+	close(fd);
+	return 1;
+}
+
+/* file system of the image as read back by read_log() */
+static struct
+{
+	int fd;
+	uint8_t fat32;
+	uint32_t spc;			/* blocks per cluster */
+	uint32_t fat;			/* first block of the FAT */
+	uint32_t root;			/* first block of the FAT16 root directory */
+	uint32_t data;			/* first block of cluster 2 */
+} volume;
+
+/* Device offset of a cluster, cluster 0 is the FAT16 root directory. */
+static uint64_t cluster_offset(uint32_t cluster)
+{
+	if(!cluster) {
+		return (uint64_t) volume.root * 512;
+	}
+	return ((uint64_t) volume.data + (uint64_t) (cluster - 2) * volume.spc) * 512;
+}
+
+/* The cluster following 'cluster', 0 at the end of the chain. */
+static uint32_t next_cluster(uint32_t cluster)
+{
+	uint8_t e[4] = { 0 };
+
+	if(volume.fat32) {
+		pread(volume.fd, e, 4, (off_t) volume.fat * 512 + cluster * 4);
+		cluster = get32(e) & 0x0fffffff;
+		return cluster >= 0x0ffffff8 ? 0 : cluster;
+	}
+	pread(volume.fd, e, 2, (off_t) volume.fat * 512 + cluster * 2);
+	cluster = get16(e);
+	return cluster >= 0xfff8 ? 0 : cluster;
+}
+
+/* Read the root directory file 'name' (8.3 as in the directory entry) from
+ * the image, FAT16 or FAT32 with or without MBR. Returns its size, or -1 if
+ * there is no such file. */
+static long read_log(const char* image, const char* name, char** text)
+{
+	uint8_t block[512], entry[32];
+	uint32_t start = 0, fat_blocks, root_blocks, cluster, size, entries, i, n;
+	long length = -1;
+
+	volume.fd = open(image, O_RDONLY);
+	if(volume.fd < 0 || pread(volume.fd, block, 512, 0) != 512) {
+		return -1;
+	}
+	if(block[0] != 0xeb && block[0] != 0xe9) {
+		start = get32(block + 0x1c6);
+		pread(volume.fd, block, 512, (off_t) start * 512);
+	}
+	volume.spc = block[13];
+	volume.fat = start + get16(block + 14);
+	fat_blocks = get16(block + 22);
+	volume.fat32 = !fat_blocks;
+	if(volume.fat32) {
+		fat_blocks = get32(block + 36);
+	}
+	root_blocks = (get16(block + 17) * 32 + 511) / 512;
+	volume.root = volume.fat + block[16] * fat_blocks;
+	volume.data = volume.root + root_blocks;
+
+	cluster = volume.fat32 ? get32(block + 44) : 0;
+	entries = (volume.fat32 ? volume.spc : root_blocks) * 16;
+	do {
+		for(i = 0; i < entries; i++) {
+			pread(volume.fd, entry, 32, cluster_offset(cluster) + i * 32);
+			if(!entry[0]) {
+				break;
+			}
+			if(entry[0] == 0xe5 || entry[11] == 0x0f || strncasecmp((char*) entry, name, 11)) {
+				continue;
+			}
+			cluster = get16(entry + 26) | (volume.fat32 ? (uint32_t) get16(entry + 20) << 16 : 0);
+			size = get32(entry + 28);
+			*text = malloc(size + 1);
+			for(length = 0; (uint32_t) length < size && cluster >= 2; cluster = next_cluster(cluster)) {
+				n = size - length < volume.spc * 512 ? size - length : volume.spc * 512;
+				pread(volume.fd, *text + length, n, cluster_offset(cluster));
+				length += n;
+			}
+			break;
+		}
+	} while(length < 0 && i == entries && volume.fat32 && (cluster = next_cluster(cluster)));
+
+	close(volume.fd);
+	return length;
+}
+
+static int write_file(const char* path, const char* data, size_t length)
+{
+	FILE* f = fopen(path, "wb");
+
+	if(!f || fwrite(data, 1, length, f) != length || fclose(f) != 0) {
+		perror(path);
+		return 0;
+	}
+	return 1;
+}
+
+/* -e: leave umeter.dlt and the records the model expects of it for
+ * delta_decode */
+static int export_delta(const char* image, const char* ini, const char* path)
+{
+	char expected_path[1024];
+	char* data = 0;
+	long length;
+	int ok;
+
+	if(!ini) {
+		fprintf(stderr, "-e needs a new image, formatted with -c\n");
+		return 0;
+	}
+	length = read_log(image, "UMETER  DLT", &data);
+	if(length < 0) {
+		printf("umeter.dlt: not found\n");
+		return 0;
+	}
+	snprintf(expected_path, sizeof(expected_path), "%s.expected", path);
+	ok = write_file(path, data, length) && write_file(expected_path, expected, expected_length);
+	if(ok) {
+		printf("umeter.dlt: %ld bytes to %s, decoded it has to match %s\n", length, path, expected_path);
+	}
+	free(data);
+	return ok;
+}
+
+static int set_timing(const char* arg)
+{
+	static const struct { const char* name; host_time_t* value; } params[] = {
+		{ "spi_byte", &host_time.spi_byte },
+		{ "card_command", &host_time.card_command },
+		{ "card_read", &host_time.card_read },
+		{ "card_busy", &host_time.card_busy },
+		{ "card_busy_multi", &host_time.card_busy_multi },
+		{ "card_erase", &host_time.card_erase },
+		{ "adc_conversion", &host_time.adc_conversion },
+	};
+	const char* eq = strchr(arg, '=');
+	unsigned i;
+
+	for(i = 0; eq && i < sizeof(params) / sizeof(params[0]); i++) {
+		if(strlen(params[i].name) == (size_t) (eq - arg) && !strncmp(arg, params[i].name, eq - arg)) {
+			*params[i].value = (host_time_t) (atof(eq + 1) * 1000);
+			return 1;
+		}
+	}
+	fprintf(stderr, "unknown timing parameter '%s'\n", arg);
+	return 0;
+}
+
+static void print_time(host_time_t t)
+{
+	double s = (double) t / NS_PER_S;
+
+	if(s >= 86400) {
+		printf("%7.2fd", s / 86400);
+	}
+	else {
+		printf("%7.2fh", s / 3600);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* image = "log_sim.img";
+	const char* ini = 0;
+	const char* export = 0;
+	const char* written_out = 0;
+	const char* written_bound = 0;
+	FILE* f;
+	double per_sample, bound;
+	unsigned long size = 256;
+	double duration = 86400, every = 3600;
+	const umeter_config* umeter;
+	host_counters last;
+	host_time_t end, next_report, task_start, task, task_total = 0, task_max = 0;
+	host_time_t due, lag = 0, lag_bound = 0;
+	uint64_t samples = 0, samples_total = 0, records = 0, written = 0;
+	double cmds_first = -1, cmds = 0;
+	unsigned int delay;
+	uint8_t mask;
+	char* text = 0;
+	long length;
+	size_t i;
+	int opt, rc = 0;
+
+	for(i = 0; i < 4; i++) {
+		sources[i].p[0] = 1000;
+	}
+	while((opt = getopt(argc, argv, "i:s:c:d:r:a:t:e:w:b:")) != -1) {
+		switch(opt) {
+		case 'i':
+			image = optarg;
+			break;
+		case 's':
+			size = strtoul(optarg, 0, 0);
+			break;
+		case 'c':
+			ini = optarg;
+			break;
+		case 'd':
+			duration = parse_time(optarg);
+			break;
+		case 'r':
+			every = parse_time(optarg);
+			break;
+		case 'a':
+			if(!set_source(optarg)) {
+				return 2;
+			}
+			break;
+		case 't':
+			if(!set_timing(optarg)) {
+				return 2;
+			}
+			break;
+		case 'e':
+			export = optarg;
+			break;
+		case 'w':
+			written_out = optarg;
+			break;
+		case 'b':
+			written_bound = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i image] [-s MiB] [-c ini] [-d time] [-r time] "
+			        "[-a sensor=source] [-t name=us] [-e file] [-w file] [-b file]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(every <= 0) {
+		every = duration;
+	}
+
+	if(ini && !format_image(image, size, ini)) {
+		return 1;
+	}
+	/* what the log already holds stays in front of the new records */
+	length = read_log(image, "UMETER  TXT", &text);
+	if(length > 0) {
+		expect(text, length);
+		if(text[length - 1] != '\n') {
+			expect("\n", 1);
+		}
+	}
+	free(text);
+	text = 0;
+
+	if(!host_card_open(image, 0)) {
+		return 1;
+	}
+	host_adc_input = adc_input;
+	host_mcp3208_input = mcp3208_input;
+
+	/* boot like main() and data_logger_main() */
+	clock_init();
+	adc_init();
+	mcp3208_init();
+	SDCardManager_Init();
+	umeter = UMeter_Init();
+	if(!umeter) {
+		fprintf(stderr, "%s: no file system or umeter.ini\n", image);
+		return 1;
+	}
+	config = umeter;
+	if(umeter->trigger.enabled) {
+		fprintf(stderr, "%s: trigger mode isn't simulated\n", image);
+		return 1;
+	}
+	sched_init(umeter);
+
+	printf("%s: %.0f s of logging\n", image, duration);
+	printf("    time   log KiB    samples  cmds/sample  rd/sample  wr/sample  task ms avg  task ms max\n");
+	memset(&host_count, 0, sizeof(host_count));
+	last = host_count;
+	end = host_now + (host_time_t) (duration * NS_PER_S);
+	due = host_now;
+	next_report = host_now + (host_time_t) (every * NS_PER_S);
+	while(host_now < end) {
+		mask = sched_next(&delay);
+		if(!mask) {
+			fprintf(stderr, "%s: no sensor enabled\n", image);
+			return 1;
+		}
+		sched_wait(delay);
+		task_start = host_now;
+		due += (host_time_t) delay * 1000000;
+		lag = task_start > due ? task_start - due : 0;
+		UMeter_Task(mask);
+		task = host_now - task_start;
+		task_total += task;
+		if(task > task_max) {
+			task_max = task;
+		}
+		if(task > lag_bound) {
+			lag_bound = task;
+		}
+		samples++;
+		samples_total++;
+		written = expected_length;
+		model_task(umeter, mask);
+		records += expected_length != written;
+
+		if(host_now >= next_report || host_now >= end) {
+			cmds = (double) (host_count.card_commands - last.card_commands) / samples;
+			print_time(host_now);
+			printf(" %9lu %10llu %12.3f %10.3f %10.3f %12.3f %12.3f\n",
+			       (unsigned long) (expected_length / 1024), (unsigned long long) samples, cmds,
+			       (double) (host_count.card_blocks_read - last.card_blocks_read) / samples,
+			       (double) (host_count.card_blocks_written - last.card_blocks_written) / samples,
+			       task_total / 1e6 / samples, task_max / 1e6);
+			if(cmds_first < 0) {
+				cmds_first = cmds;
+			}
+			last = host_count;
+			samples = task_total = task_max = 0;
+			next_report += (host_time_t) (every * NS_PER_S);
+		}
+	}
+	if(cmds > cmds_first * 1.5 + 0.01) {
+		printf("card commands per sample grew from %.3f to %.3f\n", cmds_first, cmds);
+		rc = 1;
+	}
+	per_sample = (double) host_count.card_blocks_written / samples_total;
+	if(written_out) {
+		f = fopen(written_out, "w");
+		if(!f || fprintf(f, "%.6f\n", per_sample) < 0 || fclose(f)) {
+			perror(written_out);
+			rc = 1;
+		}
+	}
+	if(written_bound) {
+		f = fopen(written_bound, "r");
+		if(!f || fscanf(f, "%lf", &bound) != 1) {
+			fprintf(stderr, "%s: no blocks per sample to compare with\n", written_bound);
+			rc = 1;
+		}
+		else if(per_sample > bound) {
+			printf("%.3f blocks written per sample, more than %.3f\n", per_sample, bound);
+			rc = 1;
+		}
+		if(f) {
+			fclose(f);
+		}
+	}
+	/* a clock tick of slack, the deadlines are whole ms */
+	if(lag > lag_bound + 1000000) {
+		printf("the last sample was taken %.3f ms after it was due\n", lag / 1e6);
+		rc = 1;
+	}
+
+	UMeter_Close_Log();
+	host_card_close();
+
+	if(umeter->format == FORMAT_DELTA) {
+		if(export) {
+			rc |= !export_delta(image, ini, export);
+		}
+		else {
+			printf("umeter.dlt not checked, see -e\n");
+		}
+		free(expected);
+		return rc;
+	}
+	length = read_log(image, "UMETER  TXT", &text);
+	for(i = 0; length >= 0 && i < (size_t) length && i < expected_length && text[i] == expected[i]; i++) {
+		;
+	}
+	if(length < 0) {
+		printf("umeter.txt: not found\n");
+		rc = 1;
+	}
+	else if(i != (size_t) length || i != expected_length) {
+		printf("umeter.txt: %ld bytes, expected %lu, differs from byte %lu on\n",
+		       length, (unsigned long) expected_length, (unsigned long) i);
+		rc = 1;
+	}
+	else {
+		printf("umeter.txt: %ld bytes, %llu records as expected\n", length, (unsigned long long) records);
+	}
+	free(text);
+	free(expected);
+	return rc;
+}
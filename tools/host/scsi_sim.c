@@ -0,0 +1,494 @@
+/*
+ * scsi_sim: replay mass storage command sequences against the firmware's
+ * Bulk-Only Transport and SCSI code on the host.
+ *
+ * usage: scsi_sim [-i image] [-s MiB] [-t name=us ...] [-v] trace...
+ *
+ * The real MassStorage_Task(), SCSI_DecodeSCSICommand(), SDCardManager block
+ * functions and sd_raw driver run against a simulated USB endpoint pair
+ * (host_usb.c) and a file backed SD card (host_card.c). For every trace the
+ * simulated transfer time and bytes per transaction are reported, per command
+ * and in total.
+ *
+ * -i image   card image, created (sparse) if missing, default scsi_sim.img
+ * -s MiB     grow the image to this size, default 64
+ * -t name=us override a timing parameter in microseconds, see host.h:
+ *            spi_byte, ep_byte, usb_packet, usb_turnaround, card_command,
+ *            card_read, card_busy, card_busy_multi, card_erase
+ * -v         print every command with its status and time
+ *
+ * Trace files hold one command per line, '#' starts a comment:
+ *   inquiry [alloc]              request_sense [alloc]
+ *   test_unit_ready              read_capacity
+ *   mode_sense6 page [alloc]     mode_sense10 page [alloc]
+ *   read_format_capacities [alloc]
+ *   prevent_allow prevent        start_stop loej start
+ *   sync_cache
+ *   read10 lba blocks [xN]       write10 lba blocks [xN]
+ *   cbw in|out|none length cdb-byte...
+ *   lun n                        issue the following commands to LUN n
+ *   wait ms                      let the bus idle for a while
+ *   card_drop ms                 the card stops answering for a while
+ * xN repeats a read or write N times at consecutive addresses. The cbw form
+ * takes the CDB in hex as captured (e.g. by usbmon), so traffic recorded from
+ * a real host can be replayed as is.
+ *
+ * Written blocks are filled with a pattern derived from their address and
+ * read back blocks written earlier in the same run are checked against it.
+ * When sync_cache or start_stop succeeds on the card's LUN, the card must
+ * not be within a write or busy programming anymore.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "UMeter.h"
+#include "sd_raw.h"
+#include "lib/Timer/umeter_clock.h"
+#include "host.h"
+
+#define CBW_LENGTH	31
+#define CSW_LENGTH	13
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t failed;
+	uint64_t bytes;
+	host_time_t time;
+} command_stats;
+
+static command_stats stats[256];
+static uint32_t tag;
+static uint8_t lun;
+static uint8_t* written;		/* bitmap of blocks written in this run */
+static uint64_t mismatches;
+static uint64_t unsettled;		/* flushes the card wasn't done with */
+static int verbose;
+static struct sd_raw_errors errors_start;	/* card error counters when the trace started */
+
+static const char* command_name(uint8_t opcode)
+{
+	switch(opcode) {
+	case SCSI_CMD_TEST_UNIT_READY:			return "TEST UNIT READY";
+	case SCSI_CMD_REQUEST_SENSE:			return "REQUEST SENSE";
+	case SCSI_CMD_INQUIRY:					return "INQUIRY";
+	case SCSI_CMD_MODE_SENSE_6:				return "MODE SENSE(6)";
+	case SCSI_CMD_START_STOP_UNIT:			return "START STOP UNIT";
+	case SCSI_CMD_SEND_DIAGNOSTIC:			return "SEND DIAGNOSTIC";
+	case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:	return "PREVENT ALLOW";
+	case SCSI_CMD_READ_FORMAT_CAPACITIES:	return "READ FORMAT CAP";
+	case SCSI_CMD_READ_CAPACITY_10:			return "READ CAPACITY(10)";
+	case SCSI_CMD_READ_10:					return "READ(10)";
+	case SCSI_CMD_WRITE_10:					return "WRITE(10)";
+	case SCSI_CMD_VERIFY_10:				return "VERIFY(10)";
+	case SCSI_CMD_SYNCHRONIZE_CACHE_10:		return "SYNC CACHE(10)";
+	case SCSI_CMD_MODE_SENSE_10:			return "MODE SENSE(10)";
+	default:								return 0;
+	}
+}
+
+static uint8_t pattern(uint32_t lba, uint16_t i)
+{
+	return (uint8_t) (lba * 13 + (lba >> 8) + i * 7);
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Run one command through the device. 'in' receives up to 'length' bytes
+ * for data-in commands. Returns the CSW status, or -1 if there was no valid
+ * CSW. */
+static int transaction(const uint8_t* cdb, uint8_t cdb_length, char direction, uint32_t length,
+					   const uint8_t* out, uint8_t* in)
+{
+	uint8_t cbw[CBW_LENGTH];
+	uint8_t* reply;
+	uint32_t n, data, residue;
+	host_time_t start;
+	int status;
+
+	memset(cbw, 0, sizeof(cbw));
+	put32(&cbw[0], CBW_SIGNATURE);
+	put32(&cbw[4], ++tag);
+	put32(&cbw[8], (direction == 'n') ? 0 : length);
+	cbw[12] = (direction == 'i') ? COMMAND_DIRECTION_DATA_IN : COMMAND_DIRECTION_DATA_OUT;
+	cbw[13] = lun;
+	cbw[14] = cdb_length;
+	memcpy(&cbw[15], cdb, cdb_length);
+
+	/* the host issues the command once the previous one is done */
+	host_now = host_usb_idle_time() + host_time.usb_turnaround;
+	start = host_now;
+
+	host_usb_reset();
+	host_usb_queue_out(cbw, sizeof(cbw));
+	if(direction == 'o' && length) {
+		host_usb_queue_out(out, length);
+	}
+
+	MassStorage_Task();
+
+	host_now = host_usb_idle_time();
+
+	reply = malloc(length + CSW_LENGTH + 64);
+	n = host_usb_take_in(reply, length + CSW_LENGTH + 64);
+	status = -1;
+	residue = 0;
+	data = 0;
+	if(n >= CSW_LENGTH && get32(&reply[n - CSW_LENGTH]) == CSW_SIGNATURE &&
+	   get32(&reply[n - CSW_LENGTH + 4]) == tag) {
+		data = n - CSW_LENGTH;
+		residue = get32(&reply[n - CSW_LENGTH + 8]);
+		status = reply[n - 1];
+		if(in && data) {
+			memcpy(in, reply, (data < length) ? data : length);
+		}
+	}
+	free(reply);
+
+	stats[cdb[0]].count++;
+	stats[cdb[0]].time += host_now - start;
+	if(status != 0) {
+		stats[cdb[0]].failed++;
+	}
+	else if(direction != 'n') {
+		stats[cdb[0]].bytes += length - residue;
+	}
+
+	if(verbose) {
+		const char* name = command_name(cdb[0]);
+		printf("%6u %-20s %7u bytes  status %2d  %9.3f ms\n", tag,
+			   name ? name : "?", (direction == 'i') ? data : (direction == 'o') ? length : 0,
+			   status, (host_now - start) / 1e6);
+	}
+	return status;
+}
+
+static void mark_written(uint32_t lba, uint32_t blocks)
+{
+	while(blocks--) {
+		if(lba < host_card_blocks()) {
+			written[lba / 8] |= 1 << (lba % 8);
+		}
+		lba++;
+	}
+}
+
+static void read_write_10(uint8_t opcode, uint32_t lba, uint16_t blocks)
+{
+	uint8_t cdb[10] = { opcode, 0, lba >> 24, lba >> 16, lba >> 8, lba, 0, blocks >> 8, blocks, 0 };
+	uint32_t length = (uint32_t) blocks * 512;
+	uint8_t* data = malloc(length ? length : 1);
+	uint32_t b, i;
+
+	if(opcode == SCSI_CMD_WRITE_10) {
+		for(b = 0; b < blocks; b++) {
+			for(i = 0; i < 512; i++) {
+				data[b * 512 + i] = pattern(lba + b, i);
+			}
+		}
+		if(transaction(cdb, sizeof(cdb), 'o', length, data, 0) == 0 && lun == CARD_LUN) {
+			mark_written(lba, blocks);
+		}
+	}
+	else {
+		memset(data, 0, length);
+		if(transaction(cdb, sizeof(cdb), 'i', length, 0, data) == 0 && lun == CARD_LUN) {
+			for(b = 0; b < blocks; b++) {
+				if(lba + b >= host_card_blocks() || !(written[(lba + b) / 8] & (1 << ((lba + b) % 8)))) {
+					continue;
+				}
+				for(i = 0; i < 512; i++) {
+					if(data[b * 512 + i] != pattern(lba + b, i)) {
+						mismatches++;
+						break;
+					}
+				}
+			}
+		}
+	}
+	free(data);
+}
+
+static void simple(const uint8_t* cdb, uint8_t cdb_length, char direction, uint32_t length)
+{
+	uint8_t* data = malloc(length ? length : 1);
+
+	memset(data, 0, length);
+	transaction(cdb, cdb_length, direction, length, data, data);
+	free(data);
+}
+
+/* A command after which the host may cut the power: once it succeeds, the
+ * card has to hold everything written. */
+static void flush(const uint8_t* cdb, uint8_t cdb_length)
+{
+	if(transaction(cdb, cdb_length, 'n', 0, 0, 0) == 0 && lun == CARD_LUN && !host_card_settled()) {
+		unsettled++;
+	}
+}
+
+/* parse and run one trace line */
+static int run_line(char* line, const char* file, int line_number)
+{
+	char* argv[24];
+	int argc = 0;
+	char* token;
+	unsigned long a[4] = { 0, 0, 0, 0 };
+	int i;
+
+	if((token = strchr(line, '#'))) {
+		*token = '\0';
+	}
+	for(token = strtok(line, " \t\r\n"); token && argc < 24; token = strtok(0, " \t\r\n")) {
+		argv[argc++] = token;
+	}
+	if(!argc) {
+		return 1;
+	}
+	for(i = 1; i < argc && i <= 4; i++) {
+		a[i - 1] = strtoul(argv[i], 0, 0);
+	}
+
+	if(!strcmp(argv[0], "inquiry")) {
+		uint8_t alloc = (argc > 1) ? a[0] : 36;
+		uint8_t cdb[6] = { SCSI_CMD_INQUIRY, 0, 0, 0, alloc, 0 };
+		simple(cdb, 6, 'i', alloc);
+	}
+	else if(!strcmp(argv[0], "request_sense")) {
+		uint8_t alloc = (argc > 1) ? a[0] : 18;
+		uint8_t cdb[6] = { SCSI_CMD_REQUEST_SENSE, 0, 0, 0, alloc, 0 };
+		simple(cdb, 6, 'i', alloc);
+	}
+	else if(!strcmp(argv[0], "test_unit_ready")) {
+		uint8_t cdb[6] = { SCSI_CMD_TEST_UNIT_READY };
+		simple(cdb, 6, 'n', 0);
+	}
+	else if(!strcmp(argv[0], "read_capacity")) {
+		uint8_t cdb[10] = { SCSI_CMD_READ_CAPACITY_10 };
+		simple(cdb, 10, 'i', 8);
+	}
+	else if(!strcmp(argv[0], "mode_sense6") && argc > 1) {
+		uint8_t alloc = (argc > 2) ? a[1] : 192;
+		uint8_t cdb[6] = { SCSI_CMD_MODE_SENSE_6, 0, a[0], 0, alloc, 0 };
+		simple(cdb, 6, 'i', alloc);
+	}
+	else if(!strcmp(argv[0], "mode_sense10") && argc > 1) {
+		uint16_t alloc = (argc > 2) ? a[1] : 192;
+		uint8_t cdb[10] = { SCSI_CMD_MODE_SENSE_10, 0, a[0], 0, 0, 0, 0, alloc >> 8, alloc, 0 };
+		simple(cdb, 10, 'i', alloc);
+	}
+	else if(!strcmp(argv[0], "read_format_capacities")) {
+		uint16_t alloc = (argc > 1) ? a[0] : 252;
+		uint8_t cdb[10] = { SCSI_CMD_READ_FORMAT_CAPACITIES, 0, 0, 0, 0, 0, 0, alloc >> 8, alloc, 0 };
+		simple(cdb, 10, 'i', alloc);
+	}
+	else if(!strcmp(argv[0], "prevent_allow") && argc > 1) {
+		uint8_t cdb[6] = { SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL, 0, 0, 0, a[0] & 1, 0 };
+		simple(cdb, 6, 'n', 0);
+	}
+	else if(!strcmp(argv[0], "start_stop") && argc > 2) {
+		uint8_t cdb[6] = { SCSI_CMD_START_STOP_UNIT, 0, 0, 0, ((a[0] & 1) << 1) | (a[1] & 1), 0 };
+		flush(cdb, 6);
+	}
+	else if(!strcmp(argv[0], "sync_cache")) {
+		uint8_t cdb[10] = { SCSI_CMD_SYNCHRONIZE_CACHE_10 };
+		flush(cdb, 10);
+	}
+	else if((!strcmp(argv[0], "read10") || !strcmp(argv[0], "write10")) && argc > 2) {
+		unsigned long repeat = (argc > 3 && argv[3][0] == 'x') ? strtoul(argv[3] + 1, 0, 0) : 1;
+		uint8_t opcode = (argv[0][0] == 'r') ? SCSI_CMD_READ_10 : SCSI_CMD_WRITE_10;
+		unsigned long r;
+
+		for(r = 0; r < repeat; r++) {
+			read_write_10(opcode, a[0] + r * a[1], a[1]);
+		}
+	}
+	else if(!strcmp(argv[0], "lun") && argc > 1) {
+		lun = a[0];
+	}
+	else if(!strcmp(argv[0], "wait") && argc > 1) {
+		host_now = host_usb_idle_time() + (host_time_t) a[0] * 1000000;
+	}
+	else if(!strcmp(argv[0], "card_drop") && argc > 1) {
+		host_card_disconnect((host_time_t) a[0] * 1000000);
+	}
+	else if(!strcmp(argv[0], "cbw") && argc > 3) {
+		uint8_t cdb[16];
+		int n = 0;
+		uint32_t length = a[1];
+		uint8_t* data = malloc(length ? length : 1);
+
+		for(i = 3; i < argc && n < 16; i++) {
+			cdb[n++] = strtoul(argv[i], 0, 16);
+		}
+		memset(data, 0, length);
+		transaction(cdb, n, argv[1][0], length, data, data);
+		free(data);
+	}
+	else {
+		fprintf(stderr, "%s:%d: bad command '%s'\n", file, line_number, argv[0]);
+		return 0;
+	}
+	return 1;
+}
+
+static void report(const char* name, host_time_t total)
+{
+	struct sd_raw_errors errors;
+	uint64_t count = 0, bytes = 0, failed = 0;
+	const char* command;
+	int i;
+
+	printf("\n%s\n", name);
+	printf("  %-20s %8s %12s %12s %10s %10s\n", "command", "count", "bytes", "time ms", "bytes/txn", "KB/s");
+	for(i = 0; i < 256; i++) {
+		if(!stats[i].count) {
+			continue;
+		}
+		command = command_name(i);
+		printf("  %-20s %8u %12llu %12.3f %10.1f %10.1f\n", command ? command : "?",
+			   stats[i].count, (unsigned long long) stats[i].bytes, stats[i].time / 1e6,
+			   (double) stats[i].bytes / stats[i].count,
+			   stats[i].time ? stats[i].bytes / 1024.0 / (stats[i].time / 1e9) : 0.0);
+		count += stats[i].count;
+		bytes += stats[i].bytes;
+		failed += stats[i].failed;
+	}
+	printf("  %-20s %8llu %12llu %12.3f %10.1f %10.1f\n", "total",
+		   (unsigned long long) count, (unsigned long long) bytes, total / 1e6,
+		   count ? (double) bytes / count : 0.0, total ? bytes / 1024.0 / (total / 1e9) : 0.0);
+	printf("  usb packets out/in %llu/%llu, spi bytes %llu, card commands %llu, blocks read/written %llu/%llu"
+		   " (%llu multiple block)\n",
+		   (unsigned long long) host_count.usb_packets_out, (unsigned long long) host_count.usb_packets_in,
+		   (unsigned long long) host_count.spi_bytes, (unsigned long long) host_count.card_commands,
+		   (unsigned long long) host_count.card_blocks_read, (unsigned long long) host_count.card_blocks_written,
+		   (unsigned long long) host_count.card_multi_blocks);
+	printf("  busy polls %llu (%.3f ms), stalls %llu, failed commands %llu, read mismatches %llu\n",
+		   (unsigned long long) host_count.card_busy_polls,
+		   host_count.card_busy_polls * host_time.spi_byte / 1e6,
+		   (unsigned long long) host_count.stalls, (unsigned long long) failed,
+		   (unsigned long long) mismatches);
+	sd_raw_get_errors(&errors);
+	printf("  card errors: command %u, timeout %u, data %u, init %u\n",
+		   errors.command - errors_start.command, errors.timeout - errors_start.timeout,
+		   errors.data - errors_start.data, errors.init - errors_start.init);
+}
+
+static int set_timing(const char* arg)
+{
+	static const struct { const char* name; host_time_t* value; } params[] = {
+		{ "spi_byte", &host_time.spi_byte },
+		{ "ep_byte", &host_time.ep_byte },
+		{ "usb_packet", &host_time.usb_packet },
+		{ "usb_turnaround", &host_time.usb_turnaround },
+		{ "card_command", &host_time.card_command },
+		{ "card_read", &host_time.card_read },
+		{ "card_busy", &host_time.card_busy },
+		{ "card_busy_multi", &host_time.card_busy_multi },
+		{ "card_erase", &host_time.card_erase },
+	};
+	const char* eq = strchr(arg, '=');
+	unsigned i;
+
+	for(i = 0; eq && i < sizeof(params) / sizeof(params[0]); i++) {
+		if(strlen(params[i].name) == (size_t) (eq - arg) && !strncmp(arg, params[i].name, eq - arg)) {
+			*params[i].value = (host_time_t) (atof(eq + 1) * 1000);
+			return 1;
+		}
+	}
+	fprintf(stderr, "unknown timing parameter '%s'\n", arg);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* image = "scsi_sim.img";
+	unsigned long size = 64;
+	char line[512];
+	FILE* trace;
+	host_time_t start;
+	int opt, line_number, rc = 0;
+
+	while((opt = getopt(argc, argv, "i:s:t:v")) != -1) {
+		switch(opt) {
+		case 'i':
+			image = optarg;
+			break;
+		case 's':
+			size = strtoul(optarg, 0, 0);
+			break;
+		case 't':
+			if(!set_timing(optarg)) {
+				return 2;
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i image] [-s MiB] [-t name=us] [-v] trace...\n", argv[0]);
+			return 2;
+		}
+	}
+	if(optind == argc) {
+		fprintf(stderr, "usage: %s [-i image] [-s MiB] [-t name=us] [-v] trace...\n", argv[0]);
+		return 2;
+	}
+
+	if(!host_card_open(image, size * 2048)) {
+		return 1;
+	}
+	written = calloc(host_card_blocks() / 8 + 1, 1);
+
+	/* bring up the card like the firmware does, mounting may fail on a blank image */
+	clock_init();
+	SDCardManager_Init();
+	StatusDisk_Init();
+
+	for(; optind < argc; optind++) {
+		if(!(trace = fopen(argv[optind], "r"))) {
+			perror(argv[optind]);
+			rc = 1;
+			continue;
+		}
+		memset(stats, 0, sizeof(stats));
+		memset(&host_count, 0, sizeof(host_count));
+		lun = 0;
+		mismatches = unsettled = 0;
+		sd_raw_get_errors(&errors_start);
+		start = host_now = host_usb_idle_time();
+
+		line_number = 0;
+		while(fgets(line, sizeof(line), trace)) {
+			if(!run_line(line, argv[optind], ++line_number)) {
+				rc = 1;
+			}
+		}
+		fclose(trace);
+		report(argv[optind], host_usb_idle_time() - start);
+		if(mismatches) {
+			rc = 1;
+		}
+		if(unsettled) {
+			printf("  %llu flushes returned before the card was done writing\n", (unsigned long long) unsettled);
+			rc = 1;
+		}
+	}
+
+	host_card_close();
+	return rc;
+}
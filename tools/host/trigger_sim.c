@@ -0,0 +1,125 @@
+/*
+ * trigger_sim: run the firmware's burst capture on the host against a
+ * triangle wave and check that it fires on both edges.
+ *
+ * usage: trigger_sim
+ *
+ * The real trigger_capture() samples the internal ADC or the MCP3208 of
+ * host.c, fed with a triangle wave sweeping the whole range of the ADC. For
+ * every case the burst has to come back within a few periods of the wave,
+ * with the trigger sample at index 'pre' on the right side of the level and
+ * the one before it on the other. Among the cases are the level and
+ * hysteresis pairs trigger_can_arm() rejects: trigger_capture() still has to
+ * return on them (and umeter.ini can't set them).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/io.h>
+
+/* trigger_config is read as laid out by the firmware's -fpack-struct */
+#pragma pack(push, 1)
+#include "lib/INI/umeter_ini.h"
+#include "lib/Inputs/umeter_adc.h"
+#include "lib/Inputs/umeter_mcp3208.h"
+#include "lib/Inputs/umeter_trigger.h"
+#pragma pack(pop)
+#include "host.h"
+
+#define PERIOD		400		/* samples of one period of the wave */
+#define PERIODS_MAX	4		/* before a capture counts as hung */
+
+typedef struct
+{
+	uint8_t adc;
+	uint8_t edge;
+	uint16_t level;
+	uint16_t hysteresis;
+	uint8_t can_arm;		/* what trigger_can_arm() has to say */
+} trigger_case;
+
+static const trigger_case cases[] = {
+	{ ADC_INTERNAL, TRIGGER_RISING, 512, 20, 1 },
+	{ ADC_INTERNAL, TRIGGER_FALLING, 512, 20, 1 },
+	{ ADC_MCP3208 + 2, TRIGGER_RISING, 3000, 100, 1 },
+	{ ADC_MCP3208 + 2, TRIGGER_FALLING, 1000, 100, 1 },
+	/* hysteresis beyond code 0 below a rising level */
+	{ ADC_INTERNAL, TRIGGER_RISING, 10, 50, 0 },
+	{ ADC_MCP3208 + 2, TRIGGER_RISING, 50, 60, 0 },
+	/* hysteresis beyond full scale above a falling level */
+	{ ADC_INTERNAL, TRIGGER_FALLING, 1000, 40, 0 },
+	{ ADC_MCP3208 + 2, TRIGGER_FALLING, 4000, 200, 0 },
+};
+
+static uint16_t full_scale;
+static unsigned long conversions;
+
+/* triangle from 0 to full_scale and back, starting at mid scale */
+static uint16_t triangle(void)
+{
+	unsigned long t = (conversions++ + PERIOD / 4) % PERIOD;
+
+	if(conversions > PERIOD * PERIODS_MAX) {
+		printf("trigger_capture() doesn't return\n");
+		exit(1);
+	}
+	if(t >= PERIOD / 2) {
+		t = PERIOD - t;
+	}
+	return (uint16_t) (t * full_scale / (PERIOD / 2));
+}
+
+static uint16_t adc_input(uint8_t mux)
+{
+	return triangle();
+}
+
+static uint16_t mcp3208_input(uint8_t channel)
+{
+	return triangle();
+}
+
+int main(void)
+{
+	static uint16_t ring[TRIGGER_RING_SIZE];
+	trigger_config cfg = { 1, 1, 0, 0, 0, 0, 32, 95 };
+	trigger_header hdr;
+	uint16_t at, before;
+	uint8_t start;
+	unsigned int i;
+	int rc = 0;
+
+	host_adc_input = adc_input;
+	host_mcp3208_input = mcp3208_input;
+	/* there is no card, it stays deselected like sd_raw leaves it */
+	PORTB |= (1 << PORTB0);
+	adc_init();
+	mcp3208_init();
+
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		cfg.adc = cases[i].adc;
+		cfg.edge = cases[i].edge;
+		cfg.level = cases[i].level;
+		cfg.hysteresis = cases[i].hysteresis;
+		full_scale = cfg.adc != ADC_INTERNAL ? 4095 : 1023;
+		conversions = 0;
+
+		printf("%s %s level %u hysteresis %u: ", cfg.adc != ADC_INTERNAL ? "mcp3208" : "internal",
+		       cfg.edge == TRIGGER_FALLING ? "falling" : "rising", cfg.level, cfg.hysteresis);
+		if(trigger_can_arm(&cfg) != cases[i].can_arm) {
+			printf("trigger_can_arm() says %u\n", !cases[i].can_arm);
+			rc = 1;
+			continue;
+		}
+		start = trigger_capture(&cfg, ring, &hdr);
+		at = ring[(start + cfg.pre) & TRIGGER_RING_MASK];
+		before = ring[(start + cfg.pre - 1) & TRIGGER_RING_MASK];
+		printf("fired at %u after %u, %lu conversions\n", at, before, conversions);
+		if(cfg.edge == TRIGGER_FALLING ? (at > cfg.level || before <= cfg.level) :
+		                                 (at < cfg.level || before >= cfg.level)) {
+			printf("  the trigger sample doesn't cross the level\n");
+			rc = 1;
+		}
+	}
+	return rc;
+}
@@ -0,0 +1,110 @@
+/*
+ * log_decode: print the serial debug output of the UMeter in readable form.
+ *
+ * usage: log_decode < /dev/ttyACM0
+ *
+ * Plain text is passed through as is. Binary events (LOG_SYNC, event id and
+ * the 16 bit little endian arguments) are formatted with the format strings
+ * of src/lib/Debug/umeter_log_events.h, one event per line.
+ *
+ * The serial port has to be set up beforehand, e.g.
+ *   stty -F /dev/ttyACM0 57600 raw
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// keep in sync with src/lib/Debug/umeter_log.h
+#define LOG_SYNC	0xA5
+
+typedef struct
+{
+	const char* name;
+	int args;
+	const char* format;
+} event;
+
+static const event events[] = {
+#define LOG_EVENT(id, level, args, format) {#id, args, format},
+#include "../src/lib/Debug/umeter_log_events.h"
+#undef LOG_EVENT
+};
+
+#define EVENT_COUNT	(sizeof(events) / sizeof(events[0]))
+
+// Print 'format' with the 16 bit arguments in 'args': %d takes a signed
+// argument, %u and %X an unsigned one, %c a character. Flags and width are
+// passed on to printf.
+static void print_event(const char* format, const uint16_t* args)
+{
+	char spec[16];
+	const char* p;
+	size_t n;
+
+	while(*format) {
+		if(*format != '%') {
+			putchar(*format++);
+			continue;
+		}
+		if(format[1] == '%') {
+			putchar('%');
+			format += 2;
+			continue;
+		}
+		p = format + 1;
+		while(*p && !strchr("duXc", *p)) {
+			p++;
+		}
+		if(!*p) { // unsupported conversion, print the rest as is
+			fputs(format, stdout);
+			return;
+		}
+		n = p - format + 1;
+		if(n >= sizeof(spec)) {
+			n = sizeof(spec) - 1;
+		}
+		memcpy(spec, format, n);
+		spec[n] = '\0';
+		if(*p == 'd') {
+			printf(spec, (int)(int16_t)*args++);
+		}
+		else {
+			printf(spec, (unsigned int)*args++);
+		}
+		format = p + 1;
+	}
+}
+
+int main(void)
+{
+	uint16_t args[8];
+	int c, id, i, lo, hi;
+
+	while((c = getchar()) != EOF) {
+		if(c != LOG_SYNC) {
+			if(c != '\r') {
+				putchar(c);
+			}
+			continue;
+		}
+		if((id = getchar()) == EOF) {
+			break;
+		}
+		if(id >= (int)EVENT_COUNT) {
+			printf("<unknown event %d>\n", id);
+			continue;
+		}
+		for(i = 0; i < events[id].args; i++) {
+			if((lo = getchar()) == EOF || (hi = getchar()) == EOF) {
+				return 0;
+			}
+			args[i] = lo | (hi << 8);
+		}
+		print_event(events[id].format, args);
+		putchar('\n');
+		fflush(stdout);
+	}
+	return 0;
+}
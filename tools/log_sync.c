@@ -0,0 +1,371 @@
+/*
+ * log_sync: bring a copy of umeter.txt up to date with the card, reading only
+ * what was appended since the last sync.
+ *
+ * usage: log_sync [-f] [-v] card copy
+ *
+ * 'card' is the logger's disk as the host sees it (/dev/sdX, not a
+ * partition) or an image of it, 'copy' the local copy of umeter.txt. The
+ * card is only read, through the firmware's own FAT code for the file system
+ * and with raw block reads for the log.
+ *
+ * With manifest=1 in umeter.ini, the firmware lists where the records of
+ * umeter.txt are on the card in umeter.man, with a CRC of each piece (see
+ * src/lib/FatSD/umeter_manifest.h). The pieces which continue the copy are
+ * read straight from their blocks and checked; whatever the manifest doesn't
+ * cover (records from before it was there, taken back after a power failure,
+ * not listed yet, or from pieces whose CRC doesn't match any more) is read
+ * through the file system, from where the copy ends. Either way only the new
+ * part of the log is read, the manifest just spares following the cluster
+ * chain of a large file.
+ *
+ * copy.sync keeps the volume serial of the card and the size of the copy.
+ * The log is copied from the start again if the card was replaced or
+ * formatted, if umeter.txt got shorter than the copy, if the copy was changed
+ * since, or with -f.
+ *
+ * -f   copy the whole log
+ * -v   list the pieces read
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* the FAT code is built with -fpack-struct like the firmware */
+#pragma pack(push, 1)
+#include "partition.h"
+#include "fat.h"
+#pragma pack(pop)
+
+#define LOG_FILE		"/umeter.txt"
+#define MANIFEST_FILE	"/umeter.man"
+#define ENTRY_SIZE		16
+#define CHUNK			(64 * 1024)
+
+typedef struct
+{
+	uint32_t seq;
+	uint32_t offset;
+	uint32_t block;
+	uint16_t length;
+	uint16_t crc;
+} manifest_entry;
+
+static int card_fd = -1;
+static unsigned long long card_bytes;		// read from the card
+static int verbose = 0;
+
+static uint16_t get16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+/* like _crc16_update() of avr-libc */
+static uint16_t crc16_update(uint16_t crc, uint8_t a)
+{
+	int i;
+
+	crc ^= a;
+	for(i = 0; i < 8; i++) {
+		crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+	}
+	return crc;
+}
+
+/* card access for the FAT code, which only gets to read */
+
+static uint8_t card_read(offset_t offset, uint8_t* buffer, uintptr_t length)
+{
+	card_bytes += length;
+	return pread(card_fd, buffer, length, offset) == (ssize_t) length;
+}
+
+static uint8_t card_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interval,
+	uintptr_t length, device_read_callback_t callback, void* p)
+{
+	if(!buffer || interval == 0 || length < interval || !callback) {
+		return 0;
+	}
+	while(length >= interval) {
+		if(!card_read(offset, buffer, interval)) {
+			return 0;
+		}
+		if(!callback(buffer, offset, p)) {
+			break;
+		}
+		offset += interval;
+		length -= interval;
+	}
+	return 1;
+}
+
+static uint8_t card_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
+{
+	return 0;
+}
+
+static uint8_t card_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length,
+	device_write_callback_t callback, void* p)
+{
+	return 0;
+}
+
+static uint8_t card_erase(offset_t start, offset_t end)
+{
+	return 0;
+}
+
+static int compare_seq(const void* a, const void* b)
+{
+	const manifest_entry* x = a;
+	const manifest_entry* y = b;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Read the entries of umeter.man in the order they were written. Returns
+// their number, 0 if there is no manifest.
+static size_t load_manifest(struct fat_fs_struct* fs, manifest_entry** entries)
+{
+	struct fat_dir_entry_struct entry;
+	struct fat_file_struct* fd;
+	uint8_t raw[ENTRY_SIZE];
+	manifest_entry* e;
+	size_t n = 0, max;
+
+	*entries = NULL;
+	if(!fat_get_dir_entry_of_path(fs, MANIFEST_FILE, &entry) || !(fd = fat_open_file(fs, &entry))) {
+		return 0;
+	}
+	max = entry.file_size / ENTRY_SIZE;
+	e = calloc(max ? max : 1, sizeof(*e));
+	while(e && n < max && fat_read_file(fd, raw, sizeof(raw)) == sizeof(raw)) {
+		e[n].seq = get32(raw);
+		if(!e[n].seq) {
+			continue;
+		}
+		e[n].offset = get32(raw + 4);
+		e[n].block = get32(raw + 8);
+		e[n].length = get16(raw + 12);
+		e[n].crc = get16(raw + 14);
+		n++;
+	}
+	fat_close_file(fd);
+	qsort(e, n, sizeof(*e), compare_seq);
+	*entries = e;
+	return n;
+}
+
+// Append [from, to) of umeter.txt to 'copy', read through the file system.
+static int fetch_file(struct fat_file_struct* fd, uint32_t from, uint32_t to, FILE* copy)
+{
+	static uint8_t buffer[CHUNK];
+	int32_t pos = from;
+	intptr_t n;
+
+	if(verbose) {
+		fprintf(stderr, "  %10u-%-10u through the file system\n", from, to);
+	}
+	if(!fat_seek_file(fd, &pos, FAT_SEEK_SET)) {
+		return 0;
+	}
+	while(from < to) {
+		n = fat_read_file(fd, buffer, to - from < CHUNK ? to - from : CHUNK);
+		if(n <= 0 || fwrite(buffer, 1, n, copy) != (size_t) n) {
+			return 0;
+		}
+		from += n;
+	}
+	return 1;
+}
+
+// Read the piece listed by 'e' into 'buffer' with raw block reads. Returns
+// 0 if it doesn't match its CRC.
+static int fetch_entry(const manifest_entry* e, uint8_t* buffer)
+{
+	offset_t start = (offset_t) e->block * 512 + e->offset % 512;
+	uint16_t crc = 0xFFFF;
+	uint32_t i;
+
+	if(!card_read(start, buffer, e->length)) {
+		return 0;
+	}
+	for(i = 0; i < e->length; i++) {
+		crc = crc16_update(crc, buffer[i]);
+	}
+	return crc == e->crc;
+}
+
+static int load_state(const char* path, uint32_t* serial, uint32_t* size)
+{
+	FILE* f = fopen(path, "r");
+	int ok;
+
+	if(!f) {
+		return 0;
+	}
+	ok = fscanf(f, "serial=%x size=%u", serial, size) == 2;
+	fclose(f);
+	return ok;
+}
+
+static int store_state(const char* path, uint32_t serial, uint32_t size)
+{
+	FILE* f = fopen(path, "w");
+
+	if(!f) {
+		return 0;
+	}
+	fprintf(f, "serial=%08X size=%u\n", serial, size);
+	return fclose(f) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	static uint8_t piece[UINT16_MAX];
+	struct partition_struct* partition;
+	struct fat_fs_struct* fs;
+	struct fat_dir_entry_struct entry;
+	struct fat_file_struct* fd;
+	struct timespec t0, t1;
+	struct stat st;
+	manifest_entry* entries;
+	size_t count, i, used = 0;
+	uint32_t serial, state_serial, state_size, pos, end, size, fetched;
+	char state[1024];
+	const char* path;
+	FILE* copy;
+	int full = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "fv")) != -1) {
+		switch(opt) {
+		case 'f':
+			full = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f] [-v] card copy\n", argv[0]);
+			return 2;
+		}
+	}
+	if(argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-f] [-v] card copy\n", argv[0]);
+		return 2;
+	}
+	path = argv[optind + 1];
+	snprintf(state, sizeof(state), "%s.sync", path);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	card_fd = open(argv[optind], O_RDONLY);
+	if(card_fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	// the logger writes the card behind the back of the host, what the
+	// kernel kept of the last sync may be stale
+	posix_fadvise(card_fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	partition = partition_open(card_read, card_read_interval, card_write,
+		card_write_interval, card_erase, card_erase, 0);
+	if(!partition) {
+		// no MBR, a "superfloppy"
+		partition = partition_open(card_read, card_read_interval, card_write,
+			card_write_interval, card_erase, card_erase, -1);
+	}
+	fs = partition ? fat_open(partition) : NULL;
+	if(!fs || !fat_get_volume_serial(fs, &serial)) {
+		fprintf(stderr, "%s: no FAT file system\n", argv[optind]);
+		return 1;
+	}
+	// the FAT code has a single file handle, the manifest goes first
+	count = load_manifest(fs, &entries);
+	if(!fat_get_dir_entry_of_path(fs, LOG_FILE, &entry) || !(fd = fat_open_file(fs, &entry))) {
+		fprintf(stderr, "%s: no umeter.txt\n", argv[optind]);
+		return 1;
+	}
+	end = entry.file_size;
+
+	// continue the copy if it is the one synced last from this card
+	pos = 0;
+	if(!full && stat(path, &st) == 0 && load_state(state, &state_serial, &state_size) &&
+	   state_serial == serial && state_size == st.st_size && state_size <= end) {
+		pos = state_size;
+	}
+	else if(verbose) {
+		fprintf(stderr, "  copying the whole log\n");
+	}
+	copy = fopen(path, pos ? "r+b" : "wb");
+	if(!copy || fseek(copy, pos, SEEK_SET) != 0 || ftruncate(fileno(copy), pos) != 0) {
+		perror(path);
+		return 1;
+	}
+	size = pos;
+
+	for(i = 0; i < count && pos < end; i++) {
+		if(entries[i].offset + entries[i].length <= pos) {
+			continue;
+		}
+		if(entries[i].offset > pos) {
+			// not in the manifest
+			if(!fetch_file(fd, pos, entries[i].offset < end ? entries[i].offset : end, copy)) {
+				break;
+			}
+			pos = entries[i].offset < end ? entries[i].offset : end;
+			if(pos == end) {
+				break;
+			}
+		}
+		if(!fetch_entry(&entries[i], piece)) {
+			// overwritten since, e.g. taken back after a power failure
+			if(verbose) {
+				fprintf(stderr, "  %10u-%-10u entry %u doesn't match its CRC\n", entries[i].offset,
+					entries[i].offset + entries[i].length, entries[i].seq);
+			}
+			continue;
+		}
+		// the last piece may reach beyond the size committed
+		fetched = (entries[i].offset + entries[i].length < end ? entries[i].offset + entries[i].length : end) - pos;
+		if(verbose) {
+			fprintf(stderr, "  %10u-%-10u entry %u, block %u\n", pos, pos + fetched, entries[i].seq,
+				entries[i].block);
+		}
+		if(fwrite(piece + (pos - entries[i].offset), 1, fetched, copy) != fetched) {
+			break;
+		}
+		pos += fetched;
+		used += fetched;
+	}
+	if(pos < end && fetch_file(fd, pos, end, copy)) {
+		pos = end;
+	}
+	fat_close_file(fd);
+	free(entries);
+
+	if(fclose(copy) != 0 || pos != end) {
+		fprintf(stderr, "%s: copying umeter.txt failed at %u of %u bytes\n", argv[optind], pos, end);
+		return 1;
+	}
+	if(!store_state(state, serial, pos)) {
+		perror(state);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("%s: %u new bytes, %lu from the manifest, %u through the file system; "
+		"%llu KiB read from the card in %.2f s\n", path, end - size, (unsigned long) used,
+		(unsigned) (end - size - used), card_bytes / 1024,
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	return 0;
+}